@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace aot {
+
+// bumped whenever State or the generated code changes, older modules are rebuilt
+constexpr uint32_t kAbiVersion = 4;
+
+struct State;
+using block_fn_t = void (*)(State *state);
+
+// Interface between the executor and translated blocks, the generated code repeats this layout.
+// A block runs its instructions on regs and mem directly, stores into the translated text or
+// while the hart watches writes and every access that isn't in memory or aligned go through the
+// load/store callbacks, which do what Hart::load/store do.
+struct State {
+    uint64_t *regs;
+    uint8_t *mem;
+    uint64_t mem_size;
+    uint64_t pc;        // next instruction once a block returns, the accessing one in callbacks
+    uint64_t retired;   // instructions of the blocks run since the executor called in, in
+                        // callbacks also the ones of the block in front of the access
+    uint64_t limit;     // a block that doesn't fit in limit - retired returns before it starts
+    uint32_t fast_stores;
+    uint32_t code_changed;  // a store hit the translated text, the module is no longer valid
+    // translated block at pc that a block ending in a direct jump continues with, nullptr
+    // otherwise; the executor calls it, so chains don't grow the host stack
+    block_fn_t next;
+    void *hart;
+    const void *module;
+    int (*load)(State *state, uint64_t addr, unsigned size, uint64_t *value);  // 0 on a trap
+    int (*store)(State *state, uint64_t addr, unsigned size, uint64_t value);  // 0 on a trap
+};
+
+struct BlockEntry {
+    uint64_t pc;
+    block_fn_t fn;
+};
+
+// Ahead-of-time translation of the executable segments of an ELF file. Basic blocks are found
+// from the segment starts, the entry, direct branch targets and the instructions after every
+// control transfer; each one becomes a C++ function that hands the block it branches to
+// directly back to the executor's dispatch loop. The source is compiled once into
+// "<elf>.aot.so", later runs dlopen it as long as the hash of the text still matches. Indirect
+// jumps to other addresses are interpreted.
+class Module final {
+   private:
+    struct Segment {
+        uint64_t begin;
+        uint64_t size;
+        std::vector<block_fn_t> blocks;  // one slot per instruction, nullptr inside blocks
+    };
+
+    void *m_handle;
+    std::vector<Segment> m_segments;
+
+    explicit Module(void *handle) : m_handle(handle) {}
+
+    // nullptr if the shared object is missing, stale or broken
+    static std::unique_ptr<Module> open(const std::string &so_file, uint64_t hash);
+
+   public:
+    // nullptr if the module can't be built or loaded, the reason is logged
+    static std::unique_ptr<Module> load_or_build(const std::string &elf_file,
+                                                 const std::string &compiler);
+
+    ~Module();
+
+    Module(const Module &) = delete;
+    Module &operator=(const Module &) = delete;
+
+    block_fn_t block(uint64_t pc) const noexcept {
+        for (const auto &segment : m_segments) {
+            uint64_t offset = pc - segment.begin;
+            if (offset < segment.size && !(offset & 3)) {
+                return segment.blocks[offset / 4];
+            }
+        }
+        return nullptr;
+    }
+
+    bool covers(uint64_t addr, size_t size) const noexcept {
+        for (const auto &segment : m_segments) {
+            if (addr + size > segment.begin && addr < segment.begin + segment.size) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}  // namespace aot
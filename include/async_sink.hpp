@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Asynchronous log sink: every producer thread owns a lock-free SPSC byte ring of
+// pre-serialized records, a single background thread drains all rings into the log file.
+// Records of one thread keep their order, records of different threads may interleave.
+class AsyncSink final {
+   public:
+    enum class overflow_policy { block, drop, count_drops };
+
+   private:
+    class Ring final {
+       private:
+        static constexpr uint32_t kSkipMarker = ~uint32_t(0);
+
+        const size_t m_capacity;
+        std::unique_ptr<char[]> m_data;
+
+        alignas(64) std::atomic<uint64_t> m_head{0};  // written by the producer only
+        uint64_t m_cached_tail = 0;                   // producer's view of m_tail
+        uint64_t m_pending_head = 0;
+        alignas(64) std::atomic<uint64_t> m_tail{0};  // written by the consumer only
+        std::atomic<uint64_t> m_drops{0};
+
+        static size_t record_size(size_t length) { return (sizeof(uint32_t) + length + 7) & ~7; }
+
+       public:
+        explicit Ring(size_t capacity);
+
+        size_t max_record_length() const noexcept { return m_capacity / 2 - sizeof(uint32_t); }
+
+        // reserves space for a record of the given length, returns nullptr if the ring is full
+        char *try_reserve(size_t length);
+        void commit();
+
+        void count_drop() noexcept { m_drops.fetch_add(1, std::memory_order_relaxed); }
+        uint64_t drops() const noexcept { return m_drops.load(std::memory_order_relaxed); }
+
+        // consumer side: writes every committed record, returns false if the ring was empty
+        bool drain(std::ostream &out);
+        bool empty() const noexcept {
+            return m_head.load(std::memory_order_acquire) ==
+                   m_tail.load(std::memory_order_relaxed);
+        }
+    };
+
+    const uint64_t m_id;
+    const size_t m_ring_capacity;
+    const overflow_policy m_policy;
+
+    std::ofstream m_out;
+
+    std::mutex m_rings_mutex;
+    std::vector<std::shared_ptr<Ring>> m_rings;
+    std::atomic<uint64_t> m_rings_version{0};
+    uint64_t m_retired_drops = 0;  // drops of rings whose threads already exited
+
+    std::atomic<bool> m_stop{false};
+    std::thread m_writer;
+
+    Ring &thread_ring();
+    void writer_loop();
+    void collect_rings(std::vector<std::shared_ptr<Ring>> &rings);
+
+   public:
+    AsyncSink(const std::string &file_name, size_t ring_capacity, overflow_policy policy);
+    ~AsyncSink();
+
+    AsyncSink(const AsyncSink &) = delete;
+    AsyncSink &operator=(const AsyncSink &) = delete;
+
+    // serializes "module: message" straight into the calling thread's ring
+    void push(std::string_view module_name, std::string_view message);
+
+    uint64_t dropped();
+};
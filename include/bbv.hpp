@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hart.hpp"
+#include "instruction.hpp"
+
+namespace sampling {
+
+// Collects basic-block vectors in the SimPoint ".bb" format:
+// one "T:<block id>:<instructions> :<block id>:<instructions> ..." line per interval
+class BbvCollector final {
+   private:
+    std::ofstream m_out;
+    uint64_t m_interval;
+
+    std::unordered_map<hart::addr_t, uint32_t> m_block_ids;
+    std::unordered_map<uint32_t, uint64_t> m_counts;
+
+    hart::addr_t m_block_start = 0;
+    uint64_t m_block_len = 0;
+    uint64_t m_interval_len = 0;
+    uint64_t m_intervals = 0;
+
+    void end_block();
+    void flush_interval();
+
+   public:
+    BbvCollector(const std::string &bbv_file, uint64_t interval, hart::addr_t start_pc);
+    ~BbvCollector();
+
+    BbvCollector(const BbvCollector &) = delete;
+    BbvCollector &operator=(const BbvCollector &) = delete;
+
+    void retire(const instruction::EncInstr &instr, hart::addr_t pc_next) {
+        ++m_block_len;
+        if (instruction::is_control_transfer(instr.id)) {
+            end_block();
+            m_block_start = pc_next;
+        }
+        if (++m_interval_len == m_interval) {
+            flush_interval();
+        }
+    }
+
+    void finish();
+
+    uint64_t intervals() const noexcept { return m_intervals; }
+};
+
+}  // namespace sampling
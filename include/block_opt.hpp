@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "code_cache.hpp"
+#include "hart.hpp"
+#include "instruction.hpp"
+
+namespace blockopt {
+
+// Optimized copy of decoded.instrs, index for index. Within every block, from the instruction
+// after a control transfer up to the next one, register values are tracked as constants or as
+// another register's value plus an offset:
+// - instructions with constant sources become li
+// - addi and add with a constant fold into the address they compute from
+// - loads and stores use the oldest register holding their base address
+// - writes overwritten before any read become nops
+// Loads, stores, atomics, system and illegal instructions read every register, so the state
+// is exact whenever one of them traps; the copy is only valid for a block entered at its
+// start and run to its end. Instruction counts don't change.
+std::vector<instruction::EncInstr> optimize(const codecache::DecodedCode &decoded);
+
+// block evaluated on scratch registers, stores are kept here instead of reaching memory
+struct Outcome {
+    hart::addr_t pc;       // of the first instruction
+    hart::addr_t next_pc;  // after the last one, or of the trapping one
+    uint64_t retired;
+    bool trapped;
+    bool unchecked;  // stopped at a device or translated access, an atomic or system instruction
+    std::array<hart::reg_t, hart::g_regfile_size> regs;
+    std::map<hart::addr_t, uint8_t> stored;  // last value per byte
+};
+
+// runs len instructions from block on a copy of the hart's registers and memory
+Outcome evaluate(const instruction::EncInstr *block, size_t len, const hart::Hart &hart);
+
+// throws if the hart, after running the decoded block the optimized one was evaluated for,
+// ended up in a different state
+void check(const Outcome &optimized, const hart::Hart &hart, uint64_t retired, bool trapped);
+
+}  // namespace blockopt
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "instruction.hpp"
+
+namespace predictor {
+
+struct PredictorStats {
+    uint64_t return_hits = 0;
+    uint64_t return_misses = 0;
+    uint64_t indirect_hits = 0;
+    uint64_t indirect_misses = 0;
+};
+
+// Predicts the block that follows a jalr: returns through a return-address stack, other
+// indirect jumps through a small cache of the last target of every jalr site. A prediction is
+// the predecoded block to continue with and is only used after its address was compared with
+// the real target.
+class BranchPredictor final {
+   public:
+    struct Target {
+        uint64_t pc = 0;
+        const instruction::EncInstr *block = nullptr;
+    };
+
+   private:
+    static constexpr size_t kReturnStackSize = 16;
+    static constexpr size_t kIndirectCacheSize = 256;
+
+    std::array<Target, kReturnStackSize> m_return_stack{};
+    size_t m_return_top = 0;  // wraps around, the oldest entries are overwritten
+
+    struct IndirectEntry {
+        uint64_t site = 0;
+        Target target{};
+    };
+    std::array<IndirectEntry, kIndirectCacheSize> m_indirect{};
+
+    PredictorStats m_stats{};
+
+    static size_t indirect_slot(uint64_t site) noexcept {
+        return (site >> 2) & (kIndirectCacheSize - 1);
+    }
+
+   public:
+    // ra and t0 are the link registers of the standard calling convention
+    static bool is_link(uint8_t reg_id) noexcept { return reg_id == 1 || reg_id == 5; }
+
+    void push_return(const Target &target) noexcept {
+        m_return_stack[m_return_top++ % kReturnStackSize] = target;
+    }
+
+    // block to continue with after a return to pc, nullptr on a misprediction
+    const instruction::EncInstr *pop_return(uint64_t pc) noexcept {
+        const Target &top = m_return_stack[--m_return_top % kReturnStackSize];
+        if (top.pc == pc && top.block) [[likely]] {
+            ++m_stats.return_hits;
+            return top.block;
+        }
+        ++m_stats.return_misses;
+        return nullptr;
+    }
+
+    // block to continue with after jalr at site jumped to pc, nullptr on a misprediction
+    const instruction::EncInstr *predict_indirect(uint64_t site, uint64_t pc) noexcept {
+        const IndirectEntry &entry = m_indirect[indirect_slot(site)];
+        if (entry.site == site && entry.target.pc == pc && entry.target.block) {
+            ++m_stats.indirect_hits;
+            return entry.target.block;
+        }
+        ++m_stats.indirect_misses;
+        return nullptr;
+    }
+
+    void update_indirect(uint64_t site, const Target &target) noexcept {
+        m_indirect[indirect_slot(site)] = {site, target};
+    }
+
+    // drops every prediction, e.g. once the predecoded blocks they point at are replaced
+    void forget_targets() noexcept {
+        m_return_stack = {};
+        m_indirect = {};
+    }
+
+    const PredictorStats &stats() const noexcept { return m_stats; }
+};
+
+}  // namespace predictor
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "instruction.hpp"
+
+namespace codecache {
+
+// text segment decoded once, never changes after it is published
+struct DecodedCode {
+    uint64_t hash;  // of the segment bytes
+    uint64_t base;
+    std::vector<instruction::EncInstr> instrs{};  // one per 4 bytes from base
+    // instructions from here up to and including the next control transfer, system or illegal
+    // one
+    std::vector<uint32_t> block_len{};
+    // blockopt::optimize copy of instrs, empty unless the store optimizes blocks
+    std::vector<instruction::EncInstr> optimized{};
+    // executors check the optimized blocks against the decoded ones instead of running them
+    bool verify_optimized = false;
+
+    uint64_t size_bytes() const noexcept { return instrs.size() * sizeof(instruction::instr_t); }
+};
+
+enum class BlockOpt { off, on, verify };
+
+// Process-wide store of decoded text segments keyed by content hash and load address.
+// Harts running the same binary share one read-only copy; the first one to miss decodes it
+// and publishes it into a slot with a single compare-exchange, published code lives until exit.
+class CodeStore final {
+   private:
+    static constexpr size_t kSlots = 256;
+
+    std::array<std::atomic<const DecodedCode *>, kSlots> m_slots{};
+    std::atomic<bool> m_persistent = false;
+    std::atomic<BlockOpt> m_block_opt = BlockOpt::off;
+    std::atomic<size_t> m_decode_threads = 1;
+
+    CodeStore() = default;
+
+    static void split_blocks(DecodedCode &decoded);
+
+    void decode(std::span<const uint8_t> code, DecodedCode &decoded, bool parallel) const;
+
+    std::unique_ptr<DecodedCode> build(std::span<const uint8_t> code, uint64_t base, uint64_t hash,
+                                       const std::string &persist_file, bool parallel) const;
+
+   public:
+    static CodeStore &getInstance();
+
+    CodeStore(const CodeStore &) = delete;
+    CodeStore &operator=(const CodeStore &) = delete;
+
+    // also keep decoded segments in "<elf file>.decoded" files, reused by later processes
+    void set_persistent(bool persistent) noexcept { m_persistent = persistent; }
+
+    // applies to segments decoded from now on
+    void set_block_opt(BlockOpt block_opt) noexcept { m_block_opt = block_opt; }
+
+    // large segments of parallel gets are decoded in chunks by up to this many threads
+    void set_decode_threads(size_t threads) noexcept {
+        m_decode_threads = std::max<size_t>(threads, 1);
+    }
+
+    // nullptr once the store is full; persist_file may be empty for code without a file, only
+    // parallel gets decode large segments on the decode threads
+    const DecodedCode *get(std::span<const uint8_t> code, uint64_t base,
+                           const std::string &persist_file = "", bool parallel = false);
+};
+
+}  // namespace codecache
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace csr {
+
+enum class Privilege : uint64_t {
+    user = 0,
+    supervisor = 1,
+    machine = 3,
+};
+
+// unprivileged counters
+constexpr uint16_t kCycle = 0xc00;
+constexpr uint16_t kTime = 0xc01;
+constexpr uint16_t kInstret = 0xc02;
+
+// supervisor
+constexpr uint16_t kSstatus = 0x100;
+constexpr uint16_t kSie = 0x104;
+constexpr uint16_t kStvec = 0x105;
+constexpr uint16_t kScounteren = 0x106;
+constexpr uint16_t kSscratch = 0x140;
+constexpr uint16_t kSepc = 0x141;
+constexpr uint16_t kScause = 0x142;
+constexpr uint16_t kStval = 0x143;
+constexpr uint16_t kSip = 0x144;
+constexpr uint16_t kSatp = 0x180;
+
+// machine
+constexpr uint16_t kMstatus = 0x300;
+constexpr uint16_t kMisa = 0x301;
+constexpr uint16_t kMedeleg = 0x302;
+constexpr uint16_t kMideleg = 0x303;
+constexpr uint16_t kMie = 0x304;
+constexpr uint16_t kMtvec = 0x305;
+constexpr uint16_t kMcounteren = 0x306;
+constexpr uint16_t kMscratch = 0x340;
+constexpr uint16_t kMepc = 0x341;
+constexpr uint16_t kMcause = 0x342;
+constexpr uint16_t kMtval = 0x343;
+constexpr uint16_t kMip = 0x344;
+constexpr uint16_t kMcycle = 0xb00;
+constexpr uint16_t kMinstret = 0xb02;
+constexpr uint16_t kMvendorid = 0xf11;
+constexpr uint16_t kMarchid = 0xf12;
+constexpr uint16_t kMimpid = 0xf13;
+constexpr uint16_t kMhartid = 0xf14;
+
+// mstatus fields, sstatus is a view of the supervisor ones
+constexpr uint64_t kStatusSie = uint64_t(1) << 1;
+constexpr uint64_t kStatusMie = uint64_t(1) << 3;
+constexpr uint64_t kStatusSpie = uint64_t(1) << 5;
+constexpr uint64_t kStatusMpie = uint64_t(1) << 7;
+constexpr uint64_t kStatusSpp = uint64_t(1) << 8;
+constexpr unsigned kStatusMppShift = 11;
+constexpr uint64_t kStatusMpp = uint64_t(3) << kStatusMppShift;
+constexpr uint64_t kStatusMprv = uint64_t(1) << 17;
+constexpr uint64_t kStatusSum = uint64_t(1) << 18;
+constexpr uint64_t kStatusMxr = uint64_t(1) << 19;
+constexpr uint64_t kStatusUxl64 = uint64_t(2) << 32;
+constexpr uint64_t kStatusSxl64 = uint64_t(2) << 34;
+
+constexpr uint64_t kSstatusMask =
+    kStatusSie | kStatusSpie | kStatusSpp | kStatusSum | kStatusMxr | kStatusUxl64;
+constexpr uint64_t kMstatusWritable = kStatusSie | kStatusMie | kStatusSpie | kStatusMpie |
+                                      kStatusSpp | kStatusMpp | kStatusMprv | kStatusSum |
+                                      kStatusMxr;
+
+// RV64 with A, I, S and U
+constexpr uint64_t kMisaValue =
+    (uint64_t(2) << 62) | (uint64_t(1) << ('A' - 'A')) | (uint64_t(1) << ('I' - 'A')) |
+    (uint64_t(1) << ('S' - 'A')) | (uint64_t(1) << ('U' - 'A'));
+
+// every exception but an ecall from M-mode can be delegated; supervisor software, timer and
+// external interrupts can be delegated, pending and enabled
+constexpr uint64_t kMedelegWritable = 0xb3ff;
+constexpr uint64_t kSupervisorInterrupts = 0x222;
+constexpr uint64_t kInterrupts = 0xaaa;
+
+// counteren bits CY, TM and IR let the next lower privilege read cycle, time and instret;
+// there are no hpm counters
+constexpr uint64_t kCounterenMask = 0x7;
+
+// satp: mode, address space id and root page table ppn
+constexpr unsigned kSatpModeShift = 60;
+constexpr uint64_t kSatpModeBare = 0;
+constexpr uint64_t kSatpModeSv39 = 8;
+constexpr unsigned kSatpAsidShift = 44;
+constexpr uint64_t kSatpAsidMask = 0xffff;
+constexpr uint64_t kSatpPpnMask = (uint64_t(1) << 44) - 1;
+
+// lowest privilege allowed to access the csr and whether it is read only, from its number
+constexpr Privilege min_privilege(uint16_t csr) { return static_cast<Privilege>((csr >> 8) & 3); }
+constexpr bool is_read_only(uint16_t csr) { return (csr >> 10) == 3; }
+
+// every value only uint64_t wide, so the state can be hashed and saved as plain bytes
+struct State {
+    Privilege privilege = Privilege::machine;
+
+    uint64_t mstatus = kStatusUxl64 | kStatusSxl64;
+    uint64_t medeleg = 0;
+    uint64_t mideleg = 0;
+    uint64_t mie = 0;
+    uint64_t mip = 0;
+    uint64_t mtvec = 0;
+    uint64_t mscratch = 0;
+    uint64_t mepc = 0;
+    uint64_t mcause = 0;
+    uint64_t mtval = 0;
+    uint64_t mcounteren = 0;
+    // retired instructions of the finished executor runs, the running one adds its own count;
+    // there is no timing model, so cycles count them too, from a different origin once written
+    uint64_t mcycle = 0;
+    uint64_t minstret = 0;
+
+    uint64_t stvec = 0;
+    uint64_t sscratch = 0;
+    uint64_t sepc = 0;
+    uint64_t scause = 0;
+    uint64_t stval = 0;
+    uint64_t satp = 0;
+    uint64_t scounteren = 0;
+};
+
+// assembler name, empty for csrs the hart doesn't implement
+constexpr std::string_view name(uint16_t csr) {
+    switch (csr) {
+        case kCycle: return "cycle";
+        case kTime: return "time";
+        case kInstret: return "instret";
+        case kSstatus: return "sstatus";
+        case kSie: return "sie";
+        case kStvec: return "stvec";
+        case kScounteren: return "scounteren";
+        case kSscratch: return "sscratch";
+        case kSepc: return "sepc";
+        case kScause: return "scause";
+        case kStval: return "stval";
+        case kSip: return "sip";
+        case kSatp: return "satp";
+        case kMstatus: return "mstatus";
+        case kMisa: return "misa";
+        case kMedeleg: return "medeleg";
+        case kMideleg: return "mideleg";
+        case kMie: return "mie";
+        case kMtvec: return "mtvec";
+        case kMcounteren: return "mcounteren";
+        case kMscratch: return "mscratch";
+        case kMepc: return "mepc";
+        case kMcause: return "mcause";
+        case kMtval: return "mtval";
+        case kMip: return "mip";
+        case kMcycle: return "mcycle";
+        case kMinstret: return "minstret";
+        case kMvendorid: return "mvendorid";
+        case kMarchid: return "marchid";
+        case kMimpid: return "mimpid";
+        case kMhartid: return "mhartid";
+        default: return "";
+    }
+}
+
+}  // namespace csr
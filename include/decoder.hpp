@@ -49,10 +49,15 @@ class Decoder final {
     static void decode_b_type(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr);
     static void decode_u_type(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr);
     static void decode_j_type(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr);
+    static void decode_csr(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr);
+    static void decode_priv(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr);
 
    public:
     static void decode_instruction(instruction::instr_t raw_instr,
                                    instruction::EncInstr &enc_instr);
+
+    // picks the handler variant for the operands, decode_instruction already calls it
+    static void select_variant(instruction::EncInstr &enc_instr);
 };
 
 }  // namespace decoder
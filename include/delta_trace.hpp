@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace trace {
+
+// Compact binary trace of architectural changes. Every instruction starts with a step record
+// (or a keyframe with the full register file every keyframe_interval instructions), followed
+// by the register and memory writes which actually changed state.
+// A footer indexes all keyframes so readers can seek without scanning the whole file.
+enum class Tag : uint8_t { step = 1, reg = 2, mem = 3, keyframe = 4, end = 5 };
+
+constexpr uint32_t kMagic = 0x54445652;  // "RVDT"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kRegNum = 32;
+
+class DeltaTrace final {
+   private:
+    std::ofstream m_out;
+    std::vector<uint8_t> m_buffer;
+
+    uint64_t m_keyframe_interval;
+    uint64_t m_index = 0;
+    uint64_t m_offset = 0;  // file offset of m_buffer[0]
+    std::vector<std::pair<uint64_t, uint64_t>> m_keyframes;  // instruction index, file offset
+
+    bool m_finished = false;
+
+    static constexpr size_t kFlushThreshold = 1 << 20;
+
+    template <typename T>
+    void put(T value) {
+        size_t pos = m_buffer.size();
+        m_buffer.resize(pos + sizeof(T));
+        std::memcpy(m_buffer.data() + pos, &value, sizeof(T));
+    }
+
+    void flush();
+
+   public:
+    DeltaTrace(const std::string &trace_file, uint64_t keyframe_interval);
+    ~DeltaTrace();
+
+    DeltaTrace(const DeltaTrace &) = delete;
+    DeltaTrace &operator=(const DeltaTrace &) = delete;
+
+    // called before every traced instruction with the state it starts from
+    void begin_instruction(uint64_t pc, std::span<const uint64_t, kRegNum> regs);
+
+    void record_reg(uint8_t reg_id, uint64_t value) {
+        put(Tag::reg);
+        put(reg_id);
+        put(value);
+    }
+
+    void record_mem(uint64_t addr, uint8_t size, uint64_t value) {
+        put(Tag::mem);
+        put(size);
+        put(addr);
+        put(value);
+    }
+
+    void finish();
+
+    uint64_t instructions() const noexcept { return m_index; }
+};
+
+struct TraceState {
+    uint64_t index = 0;
+    uint64_t pc = 0;
+    std::array<uint64_t, kRegNum> regs{};
+};
+
+struct RegWrite {
+    uint8_t reg_id;
+    uint64_t value;
+};
+
+struct MemWrite {
+    uint64_t addr;
+    uint8_t size;
+    uint64_t value;
+};
+
+struct InstrChanges {
+    std::vector<RegWrite> regs;
+    std::vector<MemWrite> mem;
+};
+
+class DeltaTraceReader final {
+   private:
+    std::vector<uint8_t> m_data;
+    std::vector<std::pair<uint64_t, uint64_t>> m_keyframes;
+    uint64_t m_keyframe_interval = 0;
+    uint64_t m_instructions = 0;
+    uint64_t m_records_end = 0;
+
+    // throws on a record cut off by the end of the file
+    template <typename T>
+    T get(uint64_t &pos) const {
+        if (pos > m_data.size() || sizeof(T) > m_data.size() - pos) {
+            throw std::runtime_error{"Trace record runs past the end of the file"};
+        }
+        T value;
+        std::memcpy(&value, m_data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+   public:
+    explicit DeltaTraceReader(const std::string &trace_file);
+
+    uint64_t instructions() const noexcept { return m_instructions; }
+    uint64_t keyframe_interval() const noexcept { return m_keyframe_interval; }
+
+    // state right before instruction `index` executes, rebuilt from the nearest keyframe;
+    // changes made by that instruction are appended to `changes` if given
+    TraceState state_at(uint64_t index, InstrChanges *changes = nullptr) const;
+};
+
+}  // namespace trace
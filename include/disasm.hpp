@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "hart.hpp"
+#include "instruction.hpp"
+
+namespace disasm {
+
+// symbol start address -> name
+using SymbolTable = std::map<hart::addr_t, std::string>;
+
+// lower case assembler mnemonic, e.g. "addi"
+std::string mnemonic(instruction::InstrId id);
+
+// "0x1048 <out>" or "0x104c <out+0x4>", just the address outside of every symbol
+std::string format_target(hart::addr_t addr, const SymbolTable &symbols);
+
+// standard assembly syntax with ABI register names, pc resolves branch and jump targets;
+// unsupported encodings are printed as ".word <raw>"
+std::string format_instruction(const instruction::EncInstr &instr, hart::addr_t pc,
+                               const SymbolTable &symbols);
+
+}  // namespace disasm
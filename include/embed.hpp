@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "executor.hpp"
+#include "hart.hpp"
+#include "memory.hpp"
+
+namespace embed {
+
+struct Options {
+    size_t memory_size = memory::Memory::default_mem_size;
+    // if set, guest memory is this host buffer of memory_size bytes and is never copied;
+    // reset() only undoes host writes made through Instance::guest_memory
+    uint8_t *host_memory = nullptr;
+    // huge pages and NUMA placement of memory the instance maps itself
+    memory::Backing backing{};
+};
+
+// In-process simulation for host applications: load once, then run and reset repeatedly.
+// Nothing is logged unless the host initializes the Logger itself.
+class Instance final {
+   private:
+    hart::Hart m_hart;
+    hart::Snapshot m_initial;
+
+    explicit Instance(hart::Hart &&hart);
+
+    static memory::Memory make_memory(const Options &options);
+
+   public:
+    static Instance from_elf(std::span<const std::byte> elf_image, const Options &options = {});
+    static Instance from_code(std::span<const std::byte> code, hart::addr_t load_addr,
+                              const Options &options = {});
+
+    Instance(Instance &&) = default;
+
+    executor::RunResult run(uint64_t max_instructions);
+    // reaching pc is reported as StopReason::breakpoint
+    executor::RunResult run_until(hart::addr_t pc, uint64_t max_instructions);
+
+    // back to the state right after loading, copies only the pages written since the last reset
+    void reset();
+
+    hart::reg_t get_reg(hart::reg_id_t reg_id) const { return m_hart.get_reg(reg_id); }
+    void set_reg(hart::reg_id_t reg_id, hart::reg_t value) { m_hart.set_reg(reg_id, value); }
+
+    hart::addr_t get_pc() const noexcept { return m_hart.get_pc(); }
+    void set_pc(hart::addr_t pc) noexcept;
+
+    // zero-copy view of guest memory, throws std::out_of_range outside of memory
+    std::span<uint8_t> guest_memory(hart::addr_t addr, size_t size);
+
+    // equal digests mean equal pc, registers and memory up to hash collisions, e.g. to cache
+    // results by final state; cheap between calls as only written pages are hashed again
+    uint64_t state_digest() { return m_hart.state_digest(); }
+
+    hart::Hart &hart() noexcept { return m_hart; }
+};
+
+}  // namespace embed
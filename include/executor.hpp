@@ -1,8 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
 #include "hart.hpp"
 #include "instruction.hpp"
 
+namespace sampling {
+class BbvCollector;
+}  // namespace sampling
+
 namespace executor {
 
+enum class StopReason {
+    budget,      // instruction budget exhausted
+    exit,        // program finished
+    fault,       // instruction trapped, pc points to it and hart.get_trap() describes the trap
+    breakpoint,  // pc points to an instruction with a breakpoint
+};
+
+struct RunResult {
+    StopReason reason;
+    uint64_t instructions;
+};
+
+// SimPoint-style sampling: fast_forward instructions without instrumentation followed by
+// detail_window instrumented ones, repeated until the program exits
+struct SamplingConfig {
+    uint64_t fast_forward = 0;
+    uint64_t detail_window = 0;
+
+    uint64_t bbv_interval = 100'000'000;
+    std::string bbv_file{};
+};
+
 class Executor {
    private:
     // R - type
@@ -44,11 +75,6 @@ class Executor {
     static void execute_slliw(hart::Hart &hart, const instruction::EncInstr &instr);
     static void execute_srliw(hart::Hart &hart, const instruction::EncInstr &instr);
     static void execute_sraiw(hart::Hart &hart, const instruction::EncInstr &instr);
-    // static void execute_ecall(hart::Hart &hart, const instruction::EncInstr &instr);
-    // static void execute_ebreak(hart::Hart &hart, const instruction::EncInstr &instr);
-    // static void execute_fence(hart::Hart &hart, const instruction::EncInstr &instr);
-    // static void execute_fence_i(hart::Hart &hart, const instruction::EncInstr &instr);
-
     // static void execute_pause(hart::Hart &hart, const instruction::EncInstr &instr);
 
     // S - type
@@ -72,11 +98,98 @@ class Executor {
     // J - type
     static void execute_jal(hart::Hart &hart, const instruction::EncInstr &instr);
 
+    // A - extension
+    static void execute_lr_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_sc_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoswap_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoadd_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoxor_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoand_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoor_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amomin_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amomax_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amominu_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amomaxu_w(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_lr_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_sc_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoswap_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoadd_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoxor_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoand_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amoor_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amomin_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amomax_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amominu_d(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_amomaxu_d(hart::Hart &hart, const instruction::EncInstr &instr);
+
+    // system
+    static void execute_fence(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_ecall(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_ebreak(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_mret(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_sret(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_wfi(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_sfence_vma(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_csrrw(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_csrrs(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_csrrc(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_csrrwi(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_csrrsi(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_csrrci(hart::Hart &hart, const instruction::EncInstr &instr);
+
+    static void execute_illegal(hart::Hart &hart, const instruction::EncInstr &instr);
+
+    // instruction::Variant handlers, rd is never x0 for the writing ones
+    static void execute_nop(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_mv(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_li(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_zero(hart::Hart &hart, const instruction::EncInstr &instr);
+    static void execute_j(hart::Hart &hart, const instruction::EncInstr &instr);   // jal x0
+    static void execute_jr(hart::Hart &hart, const instruction::EncInstr &instr);  // jalr x0
+    template <typename ValType>
+    static void execute_load_discard(hart::Hart &hart, const instruction::EncInstr &instr);
+
     using executor_func_t = void (*)(hart::Hart &hart, const instruction::EncInstr &instr);
-    static const std::array<Executor::executor_func_t, 49> functions;
+    using function_table_t =
+        std::array<std::array<executor_func_t, instruction::kVariantNum>,
+                   instruction::InstrName.size()>;
+
+    static constexpr function_table_t make_functions();
+    static const function_table_t functions;
+
+    static void execute(hart::Hart &hart, const instruction::EncInstr &instr) {
+        functions[instr.id][static_cast<size_t>(instr.variant)](hart, instr);
+    }
+
+    static void log_trap(const hart::Hart &hart);
+
+    // false if the instruction trapped and the guest doesn't handle the trap, the hart then
+    // stays in front of it; a handled trap counts as a step of the budget and replay positions,
+    // but doesn't retire
+    template <bool kDetailed>
+    static bool step(hart::Hart &hart, instruction::EncInstr &enc_instr);
+
+    // one instruction at a time, stops on breakpoints
+    static RunResult run_slice(hart::Hart &hart, uint64_t max_instructions);
+    // whole predecoded blocks, jalr targets are predicted
+    static RunResult run_blocks(hart::Hart &hart, uint64_t max_instructions);
+    // translated blocks of the hart's aot module, interprets whatever isn't translated
+    static RunResult run_native(hart::Hart &hart, uint64_t max_instructions);
+
+    template <bool kDetailed>
+    static RunResult run_phase(hart::Hart &hart, uint64_t max_instructions,
+                               sampling::BbvCollector *bbv);
 
    public:
+    // logs every instruction with its raw bits, so it fetches and decodes each one from memory
+    // and never uses the predecoded text; the run with a budget below is the fast path;
+    // false if the program stopped on a trap
     static bool run(hart::Hart &hart);
+    static bool run_sampled(hart::Hart &hart, const SamplingConfig &config);
+
+    // runs a slice of at most max_instructions without instrumentation, the next call resumes
+    // exactly where it stopped; a breakpoint under the pc doesn't stop the slice's first step
+    static RunResult run(hart::Hart &hart, uint64_t max_instructions);
 };
 
 }  // namespace executor
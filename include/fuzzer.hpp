@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hart.hpp"
+
+namespace fuzz {
+
+struct FuzzConfig {
+    std::string elf_file;
+
+    // the program runs from its elf entry up to here once, every execution starts from there
+    // with a0 = input_addr and a1 = input length; returning through ra ends the execution
+    hart::addr_t harness_entry = 0;
+    hart::addr_t input_addr = 0;
+    size_t max_input_size = 4096;
+
+    uint64_t budget = 1'000'000;  // instructions per execution, exceeding it is a hang
+    size_t workers = 1;
+    uint64_t max_executions = 0;  // 0 - until stop() is called
+    uint64_t seed = 0;
+
+    std::string corpus_dir{};  // seed inputs, new coverage is written back
+    std::string crash_dir{};   // one input per distinct (trap cause, epc)
+};
+
+struct FuzzStats {
+    uint64_t executions;
+    uint64_t corpus_size;
+    uint64_t edges;
+    uint64_t crashes;  // unique ones
+    uint64_t hangs;
+};
+
+// Coverage guided fuzzer: every worker restores its own copy of the harness snapshot before
+// each execution, dirty page tracking keeps that proportional to the pages the guest wrote.
+// Edge hit counts are bucketed like in AFL and merged into one map shared by all workers.
+class Fuzzer final {
+   private:
+    FuzzConfig m_config;
+    hart::Snapshot m_snapshot{};
+
+    // bucket bits seen so far for every edge
+    std::vector<std::atomic<uint8_t>> m_virgin;
+
+    std::mutex m_mutex;
+    std::vector<std::vector<uint8_t>> m_corpus{};
+    std::atomic<size_t> m_corpus_size = 0;  // lets workers skip the lock while nothing is new
+    std::set<std::pair<hart::TrapCause, hart::addr_t>> m_crashes{};
+
+    std::atomic<uint64_t> m_executions = 0;
+    std::atomic<uint64_t> m_edges = 0;
+    std::atomic<uint64_t> m_hangs = 0;
+    std::atomic<bool> m_stop = false;
+
+    void load_corpus();
+    void worker(size_t worker_id);
+
+    // classifies the hit counts in trace, merges them into the shared map and clears trace
+    bool merge_coverage(uint8_t *trace);
+
+    void add_to_corpus(const std::vector<uint8_t> &input);
+    void report_crash(const hart::Trap &trap, const std::vector<uint8_t> &input);
+
+   public:
+    explicit Fuzzer(const FuzzConfig &config);
+
+    // blocks until max_executions are done or stop() is called
+    void run();
+    void stop() noexcept { m_stop = true; }
+
+    FuzzStats stats();
+};
+
+}  // namespace fuzz
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "hart.hpp"
+
+namespace gdb {
+
+// GDB remote serial protocol stub serving a single hart over a localhost TCP socket
+class GdbServer final {
+   private:
+    hart::Hart &m_hart;
+    int m_listen_fd = -1;
+    int m_conn_fd = -1;
+    bool m_no_ack = false;
+
+    // instructions executed between checks for an interrupt request from gdb
+    static constexpr uint64_t kInterruptPollInterval = 1 << 20;
+
+    std::optional<char> read_byte();
+    std::optional<std::string> read_packet();
+    void write_packet(std::string_view payload);
+    bool interrupt_requested();
+
+    std::string handle_query(std::string_view packet);
+    std::string handle_breakpoint(std::string_view packet, bool insert);
+    std::string read_registers() const;
+    std::string write_registers(std::string_view hex);
+    std::string read_register(std::string_view packet) const;
+    std::string write_register(std::string_view packet);
+    std::string read_memory(std::string_view packet) const;
+    std::string write_memory(std::string_view packet);
+    std::string resume(bool single_step);
+
+   public:
+    GdbServer(hart::Hart &hart, uint16_t port);
+    ~GdbServer();
+
+    GdbServer(const GdbServer &) = delete;
+    GdbServer &operator=(const GdbServer &) = delete;
+
+    // accepts one debugger connection and serves it until kill or detach,
+    // returns true if the debugger detached and the program should keep running
+    bool serve();
+};
+
+}  // namespace gdb
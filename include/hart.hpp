@@ -1,10 +1,45 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <span>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "branch_predictor.hpp"
+#include "code_cache.hpp"
+#include "csr.hpp"
+#include "delta_trace.hpp"
+#include "instruction.hpp"
+#ifdef SIM_MEMORY_PROFILER
+#include "mem_profiler.hpp"
+#endif
 #include "memory.hpp"
-#include "regfile.hpp"
+#include "mmu.hpp"
+
+namespace ELFIO {
+class elfio;
+}  // namespace ELFIO
+
+namespace replay {
+class Session;
+}  // namespace replay
+
+namespace aot {
+class Module;
+}  // namespace aot
+
+namespace stats {
+struct HartSlot;
+}  // namespace stats
 
 namespace hart {
 
@@ -17,6 +52,103 @@ using signed_reg_t = int64_t;
 
 using reg_id_t = uint32_t;  // TODO: add GPRegId enum class with regs names
 
+// time csr and CLINT mtime ticks per second
+constexpr uint64_t g_timer_frequency = 10'000'000;
+// virtual time passes a tick every this many retired instructions, as on a 100 MIPS hart
+constexpr uint64_t g_virtual_tick_instructions = 10;
+
+constexpr size_t g_coverage_map_bits = 16;
+constexpr size_t g_coverage_map_size = size_t(1) << g_coverage_map_bits;
+
+constexpr std::array<std::string_view, g_regfile_size> g_reg_names{{
+    "zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "s0", "s1", "a0",
+    "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
+    "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+}};
+
+// exception codes as in the RISC-V mcause register
+enum class TrapCause : uint64_t {
+    instruction_address_misaligned = 0,
+    instruction_access_fault = 1,
+    illegal_instruction = 2,
+    breakpoint = 3,
+    load_address_misaligned = 4,
+    load_access_fault = 5,
+    store_address_misaligned = 6,
+    store_access_fault = 7,
+    user_ecall = 8,
+    supervisor_ecall = 9,
+    machine_ecall = 11,
+    instruction_page_fault = 12,
+    load_page_fault = 13,
+    store_page_fault = 15,
+};
+
+constexpr std::string_view trap_cause_name(TrapCause cause) {
+    switch (cause) {
+        case TrapCause::instruction_address_misaligned:
+            return "instruction address misaligned";
+        case TrapCause::instruction_access_fault:
+            return "instruction access fault";
+        case TrapCause::illegal_instruction:
+            return "illegal instruction";
+        case TrapCause::breakpoint:
+            return "breakpoint";
+        case TrapCause::load_address_misaligned:
+            return "load address misaligned";
+        case TrapCause::load_access_fault:
+            return "load access fault";
+        case TrapCause::store_address_misaligned:
+            return "store address misaligned";
+        case TrapCause::store_access_fault:
+            return "store access fault";
+        case TrapCause::user_ecall:
+            return "environment call from U-mode";
+        case TrapCause::supervisor_ecall:
+            return "environment call from S-mode";
+        case TrapCause::machine_ecall:
+            return "environment call from M-mode";
+        case TrapCause::instruction_page_fault:
+            return "instruction page fault";
+        case TrapCause::load_page_fault:
+            return "load page fault";
+        case TrapCause::store_page_fault:
+            return "store page fault";
+    }
+    return "unknown trap";
+}
+
+// cause, faulting address or instruction bits (tval) and pc of the trapping instruction (epc)
+struct Trap {
+    TrapCause cause;
+    uint64_t tval;
+    addr_t epc;
+};
+
+// lr's reservation: the physical address, size and the value it loaded. sc succeeds if the
+// memory still holds that value, checked and written with one compare-exchange, so harts
+// never share a lock or a reservation table; size 0 is no reservation
+struct Reservation {
+    addr_t addr = 0;
+    uint64_t value = 0;
+    uint64_t size = 0;
+};
+
+struct Snapshot {
+    addr_t pc, pc_next;
+    std::array<reg_t, g_regfile_size> regfile;
+    csr::State csrs;
+    Reservation reservation;
+    std::vector<uint8_t> memory;  // empty in snapshots taken without memory
+    std::vector<mmio::DeviceState> devices;
+};
+
+// a page of guest memory, e.g. one written between two snapshots
+struct PageCopy {
+    addr_t addr;
+    std::vector<uint8_t> bytes;
+};
+
 class Hart final {
    private:
     memory::Memory m_mem{};
@@ -24,30 +156,578 @@ class Hart final {
     addr_t m_pc, m_pc_next;
     std::array<reg_t, g_regfile_size> m_regfile{};
 
+    // set by raise_trap and consumed by the executor after every instruction
+    bool m_trap_pending = false;
+    Trap m_trap{};
+
+    // privilege mode and the machine and supervisor csrs
+    csr::State m_csrs{};
+
+    Reservation m_reservation{};
+
+    // count of the executor run in progress, added to mcycle and minstret when it returns; the
+    // executor counts trapping instructions as steps, but they don't retire
+    const uint64_t *m_run_retired = nullptr;
+    uint64_t m_run_traps = 0;
+
+    bool m_virtual_time = false;
+    std::chrono::steady_clock::time_point m_time_origin = std::chrono::steady_clock::now();
+
+    // Sv39 translation, derived from satp, the privilege and mstatus by update_translation;
+    // in M-mode and without satp.MODE set addresses are physical and the TLBs are never read
+    bool m_translate_fetch = false;
+    bool m_translate_data = false;
+    uint16_t m_asid = 0;
+    std::array<mmu::Permission, mmu::kAccessNum> m_permissions{};
+    mmu::Tlb m_itlb{};
+    mmu::Tlb m_dtlb{};
+
+    // breakpoints are looked up on every instruction while debugging: a bit filter indexed by
+    // the pc rejects almost all of them before the hashed set is consulted
+    static constexpr size_t kBreakpointFilterBits = 4096;
+
+    trace::DeltaTrace *m_trace = nullptr;
+    replay::Session *m_session = nullptr;
+    stats::HartSlot *m_stats = nullptr;
+
+    uint8_t *m_coverage = nullptr;
+    size_t m_prev_location = 0;
+
+#ifdef SIM_MEMORY_PROFILER
+    memprof::MemoryProfiler *m_mem_profiler = nullptr;
+#endif
+
+    // an executable segment with its shared predecoded text; pages written since it was
+    // attached are stale and run decoded from memory until a restore attaches it again
+    struct CodeSegment {
+        addr_t begin;
+        uint64_t length;
+        std::string persist_file;
+        const codecache::DecodedCode *code = nullptr;
+        uint64_t size = 0;  // predecoded bytes, 0 while the store had no room for the segment
+        std::vector<bool> stale_pages{};
+        bool stale = false;
+    };
+    std::vector<CodeSegment> m_code{};
+    // bumped whenever a page of predecoded text goes stale
+    uint64_t m_code_writes = 0;
+
+    predictor::BranchPredictor m_predictor{};
+
+    // translated text of the loaded ELF, owned by whoever loaded it
+    const aot::Module *m_aot = nullptr;
+
+    std::unordered_set<addr_t> m_breakpoints{};
+    std::array<uint64_t, kBreakpointFilterBits / 64> m_breakpoint_filter{};
+
+    static size_t breakpoint_filter_bit(addr_t pc) noexcept {
+        return (pc >> 2) & (kBreakpointFilterBits - 1);
+    }
+
    private:
-    void load_elf_file(std::string &elf_file);
+    void load_elf_file(const std::string &elf_file);
+    void load_elf_image(std::span<const std::byte> elf_image);
+    void load_elf(ELFIO::elfio &reader, const std::string &elf_file = "");
+    void load_code(std::span<const std::byte> code, addr_t load_addr);
+
+    void attach_code(addr_t addr, size_t size, const std::string &persist_file);
+    // parallel decodes large segments on several threads, which only pays off at load time
+    void predecode(CodeSegment &segment, bool parallel);
+    // predecodes every segment again from what memory holds now, e.g. after a restore
+    void reattach_code();
+
+    void stale_code_on_write(addr_t addr, size_t count) noexcept {
+        if (m_aot) [[unlikely]] {
+            forget_aot_on_write(addr, count);
+        }
+        for (auto &segment : m_code) {
+            if (addr - segment.begin < segment.size ||
+                (segment.size != 0 && segment.begin - addr < count)) [[unlikely]] {
+                stale_code(segment, addr, count);
+            }
+        }
+    }
+    [[gnu::cold, gnu::noinline]] void stale_code(CodeSegment &segment, addr_t addr,
+                                                 size_t count) noexcept;
+    // translated text that gets written is no longer valid, the interpreter takes over
+    [[gnu::cold, gnu::noinline]] void forget_aot_on_write(addr_t addr, size_t count) noexcept;
+
+    // predecoded text that instr, which comes from decoded(), belongs to
+    const codecache::DecodedCode &code_of(const instruction::EncInstr *instr) const noexcept {
+        for (const auto &segment : m_code) {
+            if (!segment.code) {
+                continue;
+            }
+            const auto &instrs = segment.code->instrs;
+            if (std::less_equal<>{}(instrs.data(), instr) &&
+                std::less<>{}(instr, instrs.data() + instrs.size())) {
+                return *segment.code;
+            }
+        }
+        return *m_code.front().code;
+    }
+
+    template <typename ValType>
+    static bool is_misaligned(addr_t addr) noexcept {
+        return addr & (sizeof(ValType) - 1);
+    }
+
+    void update_translation() noexcept;
+    // cycle, time and instret below M-mode need their mcounteren bit, in U-mode scounteren's too
+    bool counter_enabled(uint16_t csr) const noexcept;
+    uint64_t running_retired() const noexcept {
+        return m_run_retired ? *m_run_retired - m_run_traps : 0;
+    }
+
+    // replaces every csr, e.g. from a snapshot; cached translations are dropped
+    void set_csrs(const csr::State &csrs) noexcept;
+
+    // walks the page tables and fills the TLB, raises the access's page or access fault
+    [[gnu::noinline]] bool translate_miss(addr_t addr, mmu::Access access, addr_t &paddr);
+
+    // virtual to physical, only called while translation is on for the access
+    bool translate(addr_t addr, mmu::Access access, addr_t &paddr) {
+        const mmu::Tlb &tlb = access == mmu::Access::fetch ? m_itlb : m_dtlb;
+        const auto *entry = tlb.find(addr >> mmu::kPageShift, m_asid);
+        if (entry && m_permissions[static_cast<size_t>(access)].allows(entry->flags)) [[likely]] {
+            paddr = entry->page | (addr & mmu::kPageOffsetMask);
+            return true;
+        }
+        return translate_miss(addr, access, paddr);
+    }
+
+    // translated address of an AMO, lr or sc; raises the trap of a misaligned or faulting one
+    template <typename ValType>
+    bool translate_atomic(addr_t addr, mmu::Access access, addr_t &paddr) {
+        if (is_misaligned<ValType>(addr)) [[unlikely]] {
+            raise_trap(access == mmu::Access::load ? TrapCause::load_address_misaligned
+                                                   : TrapCause::store_address_misaligned,
+                       addr);
+            return false;
+        }
+        paddr = addr;
+        return !m_translate_data || translate(addr, access, paddr);
+    }
+
+    // the store side of an atomic that wrote, what store() does besides writing
+    template <typename ValType>
+    void record_atomic_store(addr_t paddr, uint64_t old_value) {
+        if (m_trace) [[unlikely]] {
+            uint64_t value;
+            m_mem.load<ValType>(paddr, value);
+            if (static_cast<ValType>(value) != static_cast<ValType>(old_value)) {
+                m_trace->record_mem(paddr, sizeof(ValType), static_cast<ValType>(value));
+            }
+        }
+        stale_code_on_write(paddr, sizeof(ValType));
+#ifdef SIM_MEMORY_PROFILER
+        if (m_mem_profiler) [[unlikely]] {
+            m_mem_profiler->access(m_pc, paddr, true);
+        }
+#endif
+    }
+
+    // extends like a RAM load of ValType would
+    template <typename ValType>
+    [[gnu::noinline]] bool load_device(addr_t addr, addr_t paddr, uint64_t &value) {
+        uint64_t raw;
+        if (!m_mem.load_device(paddr, sizeof(ValType), raw)) {
+            raise_trap(TrapCause::load_access_fault, addr);
+            return false;
+        }
+        value = static_cast<ValType>(raw);
+        return true;
+    }
 
    public:
-    Hart(std::string &elf_file) { load_elf_file(elf_file); }
+    explicit Hart(const std::string &elf_file, memory::Memory mem = memory::Memory{})
+        : m_mem(std::move(mem)) {
+        load_elf_file(elf_file);
+    }
+
+    // ELF file already in host memory
+    explicit Hart(std::span<const std::byte> elf_image, memory::Memory mem = memory::Memory{})
+        : m_mem(std::move(mem)) {
+        load_elf_image(elf_image);
+    }
+
+    // raw code blob, execution starts at load_addr
+    Hart(std::span<const std::byte> code, addr_t load_addr, memory::Memory mem = memory::Memory{})
+        : m_mem(std::move(mem)) {
+        load_code(code, load_addr);
+    }
 
     std::string format_registers();
 
     addr_t get_pc() const noexcept;
     addr_t get_pc_next() const noexcept;
-    reg_t get_reg(reg_id_t reg_id) const;
+    reg_t get_reg(reg_id_t reg_id) const { return m_regfile[reg_id]; }
 
     void set_pc(addr_t pc) noexcept;
     void set_next_pc(addr_t pc_next) noexcept;
+    // pc_next of a jump or taken branch; a target that isn't instruction aligned raises the
+    // trap at the jump instead, whose handler then leaves rd alone
+    bool jump(addr_t target) noexcept {
+        if (is_misaligned<instruction::instr_t>(target)) [[unlikely]] {
+            raise_trap(TrapCause::instruction_address_misaligned, target);
+            return false;
+        }
+        m_pc_next = target;
+        return true;
+    }
+    // writes to x0 are ignored
     void set_reg(reg_id_t reg_id, reg_t value);
 
+    // destination of an executed instruction: the decoder sends instructions with rd == x0 to
+    // handlers that don't write, so there is no x0 fixup here
+    void set_rd(reg_id_t rd, reg_t value) {
+        if (m_trace && m_regfile[rd] != value) [[unlikely]] {
+            m_trace->record_reg(rd, value);
+        }
+        m_regfile[rd] = value;
+    }
+
+    std::span<const reg_t, g_regfile_size> get_regs() const noexcept { return m_regfile; }
+
+    // records register and memory changes into the trace while set
+    void set_trace(trace::DeltaTrace *trace) noexcept { m_trace = trace; }
+    trace::DeltaTrace *get_trace() const noexcept { return m_trace; }
+
+    // live counters for external monitors, the executor publishes retired instructions into it
+    void set_stats(stats::HartSlot *slot) noexcept { m_stats = slot; }
+    stats::HartSlot *get_stats() const noexcept { return m_stats; }
+
+#ifdef SIM_MEMORY_PROFILER
+    // sees every load and store that reaches memory
+    void set_mem_profiler(memprof::MemoryProfiler *profiler) noexcept { m_mem_profiler = profiler; }
+#endif
+    size_t memory_size() const noexcept { return m_mem.size(); }
+    bool bind_memory_numa(int node) noexcept { return m_mem.bind_numa(node); }
+
+    // devices answer the loads and stores that miss memory
+    mmio::Device &map_device(addr_t base, uint64_t size, std::unique_ptr<mmio::Device> device) {
+        return m_mem.map_device(base, size, std::move(device));
+    }
+    void flush_devices() { m_mem.flush_devices(); }
+
+    // without memory a snapshot only keeps what restore_state puts back
+    Snapshot snapshot(bool with_memory = true) const;
+    void restore(const Snapshot &snapshot);
+    // pc, registers, csrs, reservation and devices of the snapshot, memory stays as it is
+    void restore_state(const Snapshot &snapshot);
+
+    // hash of pc, registers and memory; after the first call only rehashes the memory pages
+    // written since the previous one, so it can be queried at any time
+    uint64_t state_digest();
+
+    // from now on restore_dirty only copies the pages written since the last restore
+    void track_dirty_pages();
+    // memory has to match snapshot when tracking starts, e.g. right after restore(snapshot)
+    void restore_dirty(const Snapshot &snapshot);
+    // copies of the pages written since tracking started or since the previous call
+    std::vector<PageCopy> take_dirty_pages();
+    // writes pages back, e.g. the ones take_dirty_pages returned
+    void write_pages(std::span<const PageCopy> pages);
+
+    // AFL-style edge coverage: every control transfer bumps the hit counter of the
+    // (previous target, target) pair in a map of g_coverage_map_size bytes
+    void set_coverage_map(uint8_t *map) noexcept {
+        m_coverage = map;
+        m_prev_location = 0;
+    }
+
+    void cover_edge(addr_t target) noexcept {
+        if (m_coverage) {
+            size_t location = (target >> 2) * 0x9e3779b97f4a7c15 >> (64 - g_coverage_map_bits);
+            ++m_coverage[location ^ m_prev_location];
+            m_prev_location = location >> 1;
+        }
+    }
+
+    // every nondeterministic value (time, host input) reaches the guest through here,
+    // so a record/replay session can log it and feed it back
+    void set_session(replay::Session *session) noexcept { m_session = session; }
+    uint64_t input(uint64_t host_value);
+
+    // host view of guest memory for zero-copy access, nullptr if the range is out of memory;
+    // the range counts as written for restore_dirty and makes predecoded text in it stale
+    uint8_t *host_pointer(addr_t addr, size_t count) noexcept;
+
+    bool read_memory(addr_t addr, void *dst, size_t count) const;
+    bool write_memory(addr_t addr, const void *src, size_t count);
+
+    void add_breakpoint(addr_t pc);
+    void remove_breakpoint(addr_t pc);
+
+    bool has_breakpoints() const noexcept { return !m_breakpoints.empty(); }
+
+    bool is_breakpoint(addr_t pc) const {
+        size_t bit = breakpoint_filter_bit(pc);
+        if (!((m_breakpoint_filter[bit / 64] >> (bit % 64)) & 1)) {
+            return false;
+        }
+        return m_breakpoints.contains(pc);
+    }
+
+    // records the trap of the current instruction, the executor stops in front of it;
+    // out of line so that the fast paths only pay for a predicted branch
+    [[gnu::cold, gnu::noinline]] void raise_trap(TrapCause cause, uint64_t tval) noexcept;
+
+    // true once for every raised trap
+    bool take_trap() noexcept {
+        bool pending = m_trap_pending;
+        m_trap_pending = false;
+        return pending;
+    }
+
+    // the last raised trap
+    const Trap &get_trap() const noexcept { return m_trap; }
+
+    // hands the trap take_trap just reported to the guest: updates the csrs of the mode it is
+    // taken in and continues at its trap vector; false if the guest installed no vector, the
+    // hart then stays in front of the trapping instruction
+    bool enter_trap();
+
+    // mret and sret, false if the current privilege may not return from level
+    bool trap_return(csr::Privilege level);
+
+    csr::Privilege privilege() const noexcept { return m_csrs.privilege; }
+
+    // false if the csr doesn't exist or the current privilege may not access it that way,
+    // nothing changes then
+    bool read_csr(uint16_t csr, uint64_t &value);
+    bool write_csr(uint16_t csr, uint64_t value);
+
+    // The executor counts retired instructions per run and doesn't touch the csrs for it:
+    // retired points at its counter until end_run folds the count into mcycle and minstret.
+    void begin_run(const uint64_t *retired) noexcept {
+        m_run_retired = retired;
+        m_run_traps = 0;
+    }
+    void end_run() noexcept {
+        m_csrs.mcycle += running_retired();
+        m_csrs.minstret += running_retired();
+        m_run_retired = nullptr;
+    }
+    // points the run at another counter without starting over, e.g. one that is further along
+    const uint64_t *swap_run_counter(const uint64_t *retired) noexcept {
+        return std::exchange(m_run_retired, retired);
+    }
+    uint64_t instret() const noexcept { return m_csrs.minstret + running_retired(); }
+
+    // time csr and mtime in g_timer_frequency ticks: host time since the hart was created, read
+    // through input(), or with virtual time derived from instret and the same on every run
+    void set_virtual_time(bool virtual_time) noexcept { m_virtual_time = virtual_time; }
+    uint64_t time();
+
+    // sfence.vma, an empty argument stands for all addresses or all address spaces
+    void fence_vma(std::optional<addr_t> addr, std::optional<uint16_t> asid) noexcept;
+
+    bool translates_fetch() const noexcept { return m_translate_fetch; }
+    bool translates_data() const noexcept { return m_translate_data; }
+
+    // predecoded instruction at pc, nullptr if pc isn't in a shared text segment or on a stale
+    // page of one; with translation on only a TLB hit is used, a miss is left to fetch
+    const instruction::EncInstr *decoded(addr_t pc) const noexcept {
+        if (m_translate_fetch) [[unlikely]] {
+            const auto *entry = m_itlb.find(pc >> mmu::kPageShift, m_asid);
+            if (!entry || !m_permissions[static_cast<size_t>(mmu::Access::fetch)].allows(
+                              entry->flags)) {
+                return nullptr;
+            }
+            pc = entry->page | (pc & mmu::kPageOffsetMask);
+        }
+        for (const auto &segment : m_code) {
+            uint64_t offset = pc - segment.begin;
+            if (offset < segment.size && !(offset & (sizeof(instruction::instr_t) - 1))) {
+                if (segment.stale && segment.stale_pages[offset / memory::Memory::page_size])
+                    [[unlikely]] {
+                    return nullptr;
+                }
+                return &segment.code->instrs[offset / sizeof(instruction::instr_t)];
+            }
+        }
+        return nullptr;
+    }
+
+    // length of the predecoded block that starts with first, first comes from decoded(); the
+    // block may reach into a stale page once has_stale_code()
+    uint32_t block_len(const instruction::EncInstr *first) const noexcept {
+        const auto &code = code_of(first);
+        return code.block_len[first - code.instrs.data()];
+    }
+
+    bool has_stale_code() const noexcept {
+        return std::ranges::any_of(m_code, [](const auto &segment) { return segment.stale; });
+    }
+    // changes whenever predecoded text goes stale
+    uint64_t code_writes() const noexcept { return m_code_writes; }
+
+    // optimized copy of the block that starts with first, nullptr if there is none or first
+    // isn't the start of a block; it may only be run whole
+    const instruction::EncInstr *optimized_block(const instruction::EncInstr *first) const {
+        const auto &code = code_of(first);
+        size_t index = first - code.instrs.data();
+        if (code.optimized.empty() || (index != 0 && code.block_len[index - 1] != 1)) {
+            return nullptr;
+        }
+        return &code.optimized[index];
+    }
+
+    bool verifies_optimized(const instruction::EncInstr *first) const noexcept {
+        return code_of(first).verify_optimized;
+    }
+
+    // the module has to be translated from the ELF this hart loaded
+    void attach_aot(const aot::Module *module) noexcept { m_aot = module; }
+    const aot::Module *get_aot() const noexcept { return m_aot; }
+
+    // translated code skips every per-instruction hook
+    bool is_instrumented() const noexcept {
+        bool instrumented = m_trace || m_coverage || has_breakpoints();
+#ifdef SIM_MEMORY_PROFILER
+        instrumented = instrumented || m_mem_profiler;
+#endif
+        return instrumented;
+    }
+
+    // direct access for translated code, stores have to go through store() while
+    // memory watches writes
+    reg_t *regfile() noexcept { return m_regfile.data(); }
+    uint8_t *memory_base() const noexcept { return m_mem.data(); }
+    bool watches_writes() const noexcept { return m_mem.watches_writes(); }
+
+    predictor::BranchPredictor &get_predictor() noexcept { return m_predictor; }
+
+    bool fetch(addr_t pc, uint64_t &instr) {
+        if (is_misaligned<instruction::instr_t>(pc)) [[unlikely]] {
+            raise_trap(TrapCause::instruction_address_misaligned, pc);
+            return false;
+        }
+        addr_t paddr = pc;
+        if (m_translate_fetch && !translate(pc, mmu::Access::fetch, paddr)) [[unlikely]] {
+            return false;
+        }
+        if (!m_mem.load<instruction::instr_t>(paddr, instr)) [[unlikely]] {
+            raise_trap(TrapCause::instruction_access_fault, pc);
+            return false;
+        }
+        return true;
+    }
+
+    // load and store raise a trap and return false instead of accessing memory on a fault
+    template <typename ValType>
+    bool load(addr_t addr, uint64_t &value) {
+        if (is_misaligned<ValType>(addr)) [[unlikely]] {
+            raise_trap(TrapCause::load_address_misaligned, addr);
+            return false;
+        }
+        addr_t paddr = addr;
+        if (m_translate_data && !translate(addr, mmu::Access::load, paddr)) [[unlikely]] {
+            return false;
+        }
+        if (!m_mem.load<ValType>(paddr, value)) [[unlikely]] {
+            return load_device<ValType>(addr, paddr, value);
+        }
+#ifdef SIM_MEMORY_PROFILER
+        if (m_mem_profiler) [[unlikely]] {
+            m_mem_profiler->access(m_pc, paddr, false);
+        }
+#endif
+        return true;
+    }
+
+    template <typename ValType>
+    bool store(addr_t addr, uint64_t value) {
+        if (is_misaligned<ValType>(addr)) [[unlikely]] {
+            raise_trap(TrapCause::store_address_misaligned, addr);
+            return false;
+        }
+        addr_t paddr = addr;
+        if (m_translate_data && !translate(addr, mmu::Access::store, paddr)) [[unlikely]] {
+            return false;
+        }
+        if (m_trace) [[unlikely]] {
+            uint64_t old_value;
+            if (m_mem.load<ValType>(paddr, old_value) &&
+                static_cast<ValType>(old_value) != static_cast<ValType>(value)) {
+                m_trace->record_mem(paddr, sizeof(ValType), static_cast<ValType>(value));
+            }
+        }
+        if (!m_mem.store<ValType>(paddr, value)) [[unlikely]] {
+            if (!m_mem.store_device(paddr, sizeof(ValType), value)) {
+                raise_trap(TrapCause::store_access_fault, addr);
+                return false;
+            }
+            return true;
+        }
+        stale_code_on_write(paddr, sizeof(ValType));
+#ifdef SIM_MEMORY_PROFILER
+        if (m_mem_profiler) [[unlikely]] {
+            m_mem_profiler->access(m_pc, paddr, true);
+        }
+#endif
+        return true;
+    }
+
+    // Atomics only work on RAM, devices answer them with an access fault. Translation
+    // checks write permission for everything but lr.
+
+    // lr: loads and reserves
+    template <typename ValType>
+    bool load_reserved(addr_t addr, uint64_t &value) {
+        addr_t paddr;
+        if (!translate_atomic<ValType>(addr, mmu::Access::load, paddr)) [[unlikely]] {
+            return false;
+        }
+        // an aligned host load is single-copy atomic already
+        if (!m_mem.load<ValType>(paddr, value)) [[unlikely]] {
+            raise_trap(TrapCause::load_access_fault, addr);
+            return false;
+        }
+        m_reservation = {paddr, value, sizeof(ValType)};
+#ifdef SIM_MEMORY_PROFILER
+        if (m_mem_profiler) [[unlikely]] {
+            m_mem_profiler->access(m_pc, paddr, false);
+        }
+#endif
+        return true;
+    }
+
+    // sc: stores if the reservation still holds, success tells; the reservation is gone
+    // either way
     template <typename ValType>
-    void load(uint64_t addr, uint64_t &value) const {
-        m_mem.load<ValType>(addr, value);
+    bool store_conditional(addr_t addr, uint64_t value, bool &success) {
+        addr_t paddr;
+        if (!translate_atomic<ValType>(addr, mmu::Access::store, paddr)) [[unlikely]] {
+            return false;
+        }
+        if (paddr > m_mem.size() - sizeof(ValType)) [[unlikely]] {
+            raise_trap(TrapCause::store_access_fault, addr);
+            return false;
+        }
+        Reservation reservation = std::exchange(m_reservation, {});
+        success = reservation.size == sizeof(ValType) && reservation.addr == paddr &&
+                  m_mem.compare_exchange<ValType>(paddr, reservation.value, value);
+        if (success) {
+            record_atomic_store<ValType>(paddr, reservation.value);
+        }
+        return true;
     }
 
+    // amo: old gets the value before the operation
     template <typename ValType>
-    void store(addr_t addr, uint64_t value) {
-        m_mem.store<ValType>(addr, value);
+    bool amo(addr_t addr, memory::Amo op, uint64_t operand, uint64_t &old) {
+        addr_t paddr;
+        if (!translate_atomic<ValType>(addr, mmu::Access::store, paddr)) [[unlikely]] {
+            return false;
+        }
+        if (!m_mem.amo<ValType>(paddr, op, operand, old)) [[unlikely]] {
+            raise_trap(TrapCause::store_access_fault, addr);
+            return false;
+        }
+        record_atomic_store<ValType>(paddr, old);
+        return true;
     }
 };
 }  // namespace hart
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace hashing {
+
+// fast non-cryptographic hash for content keys, not stable across versions
+inline uint64_t hash_bytes(std::span<const uint8_t> bytes) noexcept {
+    uint64_t hash = 0xcbf29ce484222325 ^ bytes.size();
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+        hash ^= hash >> 29;
+    }
+    for (; i < bytes.size(); ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash ^ (hash >> 32);
+}
+
+// splitmix64 finalizer
+constexpr uint64_t mix64(uint64_t value) noexcept {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+}  // namespace hashing
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace hostperf {
+
+enum Counter { dtlb_load_misses, dtlb_store_misses, itlb_misses, page_faults, kCounterNum };
+
+// Host TLB and page fault counters of the calling thread and of every thread it creates after
+// start(), read through perf_event_open. Counters the host doesn't provide or doesn't allow
+// (perf_event_paranoid, containers) stay closed and read as empty.
+class HostCounters final {
+   private:
+    std::array<int, kCounterNum> m_fds;
+    std::chrono::steady_clock::time_point m_start{};
+    std::chrono::steady_clock::duration m_elapsed{};
+
+   public:
+    HostCounters();
+    ~HostCounters();
+
+    HostCounters(const HostCounters &) = delete;
+    HostCounters &operator=(const HostCounters &) = delete;
+
+    void start();
+    // threads created after start() have to be joined before stop() for their counts
+    void stop();
+
+    std::optional<uint64_t> read(Counter counter) const;
+
+    // elapsed time and counters, MIPS if the number of instructions is known
+    std::string format(std::optional<uint64_t> instructions = std::nullopt) const;
+};
+
+}  // namespace hostperf
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -73,9 +74,51 @@ enum InstrId {
 
     // J - type
     JAL,
+
+    // A - extension: address in rs1, operand in rs2, the aq and rl bits aren't kept
+    LR_W,
+    SC_W,
+    AMOSWAP_W,
+    AMOADD_W,
+    AMOXOR_W,
+    AMOAND_W,
+    AMOOR_W,
+    AMOMIN_W,
+    AMOMAX_W,
+    AMOMINU_W,
+    AMOMAXU_W,
+    LR_D,
+    SC_D,
+    AMOSWAP_D,
+    AMOADD_D,
+    AMOXOR_D,
+    AMOAND_D,
+    AMOOR_D,
+    AMOMIN_D,
+    AMOMAX_D,
+    AMOMINU_D,
+    AMOMAXU_D,
+
+    // system: fence, environment, privileged and Zicsr instructions, csr number in imm
+    FENCE,
+    ECALL,
+    EBREAK,
+    MRET,
+    SRET,
+    WFI,
+    SFENCE_VMA,
+    CSRRW,
+    CSRRS,
+    CSRRC,
+    CSRRWI,  // the immediate variants keep their 5 bit immediate in rs1
+    CSRRSI,
+    CSRRCI,
+
+    // any encoding that isn't supported, imm holds the raw instruction
+    ILLEGAL,
 };
 
-constexpr std::array<std::string_view, 49> InstrName{{
+constexpr std::array<std::string_view, 85> InstrName{{
     // R - rype
     "ADD",
     "SUB",
@@ -136,14 +179,96 @@ constexpr std::array<std::string_view, 49> InstrName{{
 
     // J - type
     "JAL",
+
+    // A - extension
+    "LR.W",
+    "SC.W",
+    "AMOSWAP.W",
+    "AMOADD.W",
+    "AMOXOR.W",
+    "AMOAND.W",
+    "AMOOR.W",
+    "AMOMIN.W",
+    "AMOMAX.W",
+    "AMOMINU.W",
+    "AMOMAXU.W",
+    "LR.D",
+    "SC.D",
+    "AMOSWAP.D",
+    "AMOADD.D",
+    "AMOXOR.D",
+    "AMOAND.D",
+    "AMOOR.D",
+    "AMOMIN.D",
+    "AMOMAX.D",
+    "AMOMINU.D",
+    "AMOMAXU.D",
+
+    // system
+    "FENCE",
+    "ECALL",
+    "EBREAK",
+    "MRET",
+    "SRET",
+    "WFI",
+    "SFENCE.VMA",
+    "CSRRW",
+    "CSRRS",
+    "CSRRC",
+    "CSRRWI",
+    "CSRRSI",
+    "CSRRCI",
+
+    "ILLEGAL",
 }};
 
+constexpr bool is_control_transfer(InstrId id) {
+    switch (id) {
+        case JALR:
+        case BEQ:
+        case BNE:
+        case BLT:
+        case BGE:
+        case BLTU:
+        case BGEU:
+        case JAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// atomic memory operations, executed as one host atomic access each
+constexpr bool is_atomic(InstrId id) { return id >= LR_W && id <= AMOMAXU_D; }
+
+// read or change state beyond the registers and memory, e.g. the privilege mode or address
+// translation; they end predecoded blocks and are never translated or optimized
+constexpr bool is_system(InstrId id) { return id >= FENCE && id <= CSRRCI; }
+
+// false for stores, branches, illegal and system instructions other than the csr ones
+constexpr bool writes_rd(InstrId id) {
+    return !(id >= SB && id <= SD) && !(id >= BEQ && id <= BGEU) && id != ILLEGAL &&
+           !(id >= FENCE && id <= SFENCE_VMA);
+}
+
+// operand patterns that have a cheaper handler than the general one, picked by the decoder
+enum class Variant : uint8_t {
+    generic,
+    discard,   // rd is x0: nothing is written, loads still access memory and jumps still jump
+    move,      // rd = rs1, e.g. mv (addi rd, rs, 0), add rd, rs, x0, and rd, rs, rs
+    load_imm,  // rd = imm, e.g. li (addi rd, x0, imm), lui
+    zero,      // rd = 0, e.g. xor rd, rs, rs, andi rd, rs, 0
+};
+
+constexpr size_t kVariantNum = 5;
+
 struct EncInstr final {
     InstrId id;
 
     uint8_t rd = 0;
     uint8_t rs1 = 0;
     uint8_t rs2 = 0;
+    Variant variant = Variant::generic;
 
     uint64_t imm = 0;
 
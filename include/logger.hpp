@@ -1,9 +1,13 @@
 #pragma once
 
+#include <array>
 #include <boost/log/sources/severity_logger.hpp>
+#include <memory>
 #include <string>
 #include <string_view>
 
+#include "async_sink.hpp"
+
 class Logger {
    public:
     enum severity_level { standard, verbose };
@@ -19,12 +23,16 @@ class Logger {
         {verbose, "verbose"},
     }};
 
-    using logger_t = boost::log::sources::severity_logger<Logger::severity_level>;
+    using logger_t = boost::log::sources::severity_logger_mt<Logger::severity_level>;
     logger_t& getLogger() { return m_logger; };
 
     logger_t m_logger;
     Logger() {};
 
+    bool m_initialized = false;  // library users get no log output until init
+    severity_level m_log_level = standard;
+    std::unique_ptr<AsyncSink> m_async_sink;
+
    public:
     static Logger& getInstance() {
         static Logger logger;
@@ -32,6 +40,11 @@ class Logger {
     }
 
     void init(severity_level log_level);
+    // replaces the synchronous Boost.Log sink with a per-thread ring buffered one
+    void init_async(severity_level log_level, size_t ring_capacity,
+                    AsyncSink::overflow_policy policy);
+
+    uint64_t dropped_messages();
 
     Logger(const Logger&) = delete;
     Logger& operator=(const Logger&) = delete;
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memory.hpp"
+
+namespace memprof {
+
+struct ProfilerConfig {
+    std::string report_file;  // the heatmap goes to "<report_file>.csv"
+    uint64_t window = 1000000;  // memory accesses per working-set window
+    uint64_t sample_period = 64;  // one cache line out of sample_period is followed for reuse
+};
+
+// Profiles the data accesses of one hart. Page read/write counts and strides per load/store pc
+// are exact, the per-window page counts are streamed to a "window,page,reads,writes" csv.
+// Reuse distances and working-set bytes are sampled spatially: only lines whose hash falls
+// into 1 / sample_period of the hash space are followed, their LRU stack distances and counts
+// scaled back up estimate those of all lines.
+class MemoryProfiler final {
+   public:
+    static constexpr uint64_t kLineSize = 64;
+
+   private:
+    static constexpr size_t kStrideTableSize = 4096;
+    static constexpr size_t kHistogramBuckets = 48;
+    static constexpr size_t kFenwickSize = size_t(1) << 20;  // initially, compact() grows it
+
+    struct StrideEntry {
+        uint64_t pc = 0;
+        uint64_t last_addr = 0;
+        int64_t stride = 0;
+        uint64_t accesses = 0;
+        uint64_t strided = 0;  // accesses at the same distance from the previous one
+    };
+
+    struct WorkingSet {
+        uint64_t pages;
+        uint64_t bytes;  // estimated from the sampled lines
+    };
+
+    ProfilerConfig m_config;
+    std::ofstream m_report;
+    std::ofstream m_csv;
+    bool m_finished = false;
+
+    // counts of the current window, added to the totals when it ends
+    std::vector<uint32_t> m_window_reads, m_window_writes;
+    std::vector<uint32_t> m_touched;  // pages accessed in the current window
+    std::vector<uint64_t> m_reads, m_writes;
+    uint64_t m_window_len = 0;
+    std::vector<WorkingSet> m_working_sets;
+
+    // direct mapped by pc, entries of a conflicting pc are moved to m_evicted_strides
+    std::vector<StrideEntry> m_strides;
+    std::unordered_map<uint64_t, StrideEntry> m_evicted_strides;
+
+    uint64_t m_sample_threshold;  // line hashes below it are sampled
+    uint64_t m_time = 0;  // accesses to sampled lines
+    std::unordered_map<uint64_t, uint64_t> m_last_use;  // sampled line -> time of its last access
+    std::vector<int32_t> m_fenwick;  // 1 at the last access time of every sampled line
+    std::array<uint64_t, kHistogramBuckets> m_reuse_histogram{};  // by bit width of the distance
+    uint64_t m_cold_accesses = 0;
+    uint64_t m_window_start = 0;  // m_time when the current window started
+    uint64_t m_window_lines = 0;  // sampled lines accessed in the current window
+
+    static uint64_t line_hash(uint64_t line) noexcept { return line * 0x9e3779b97f4a7c15; }
+
+    void fenwick_add(uint64_t time, int32_t delta) noexcept;
+    uint64_t fenwick_sum(uint64_t time) const noexcept;
+    void compact();
+
+    void sample_line(uint64_t line);
+    void evict_stride(const StrideEntry &entry);
+    void end_window();
+    void write_report();
+
+   public:
+    MemoryProfiler(const ProfilerConfig &config, size_t mem_size);
+    ~MemoryProfiler();
+
+    MemoryProfiler(const MemoryProfiler &) = delete;
+    MemoryProfiler &operator=(const MemoryProfiler &) = delete;
+
+    // addr is the physical address of an access that already succeeded; pages past the
+    // profiled memory size aren't counted
+    void access(uint64_t pc, uint64_t addr, bool write) {
+        uint64_t page = addr / memory::Memory::page_size;
+        if (page < m_window_reads.size()) [[likely]] {
+            if (m_window_reads[page] == 0 && m_window_writes[page] == 0) {
+                m_touched.push_back(page);
+            }
+            ++(write ? m_window_writes : m_window_reads)[page];
+        }
+
+        StrideEntry &entry = m_strides[(pc >> 2) & (kStrideTableSize - 1)];
+        if (entry.pc != pc) [[unlikely]] {
+            evict_stride(entry);
+            entry = {pc, addr, 0, 0, 0};
+        } else if (int64_t stride = addr - entry.last_addr; stride == entry.stride) {
+            ++entry.strided;
+        } else {
+            entry.stride = stride;
+        }
+        entry.last_addr = addr;
+        ++entry.accesses;
+
+        uint64_t line = addr / kLineSize;
+        if (line_hash(line) < m_sample_threshold) [[unlikely]] {
+            sample_line(line);
+        }
+
+        if (++m_window_len == m_config.window) [[unlikely]] {
+            end_window();
+        }
+    }
+
+    // writes the report, also done by the destructor
+    void finish();
+};
+
+}  // namespace memprof
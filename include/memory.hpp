@@ -2,58 +2,468 @@
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cerrno>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <climits>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "fmt/format.h"
+#include "hash.hpp"
 #include "logger.hpp"
+#include "mmio.hpp"
 
 namespace memory {
 
+enum class HugePages {
+    none,
+    transparent,  // 2 MB aligned mapping advised with MADV_HUGEPAGE
+    hugetlb,      // MAP_HUGETLB from the reserved pool, transparent if the pool is empty
+};
+
+constexpr int kNoNode = -1;
+constexpr int kLocalNode = -2;  // NUMA node of the calling thread
+
+// read-modify-write of an AMO instruction
+enum class Amo : uint8_t { swap, add, bit_xor, bit_and, bit_or, min, max, minu, maxu };
+
+// how guest memory is backed by host pages
+struct Backing {
+    HugePages huge_pages = HugePages::none;
+    int numa_node = kNoNode;
+    // maps /dev/shm/<shared_name> shared instead of anonymous memory, so other processes can
+    // map the guest memory too; the file stays after exit, huge pages don't apply to it
+    std::string shared_name{};
+};
+
 class Memory {
+   public:
+    static constexpr size_t default_mem_size = 0x100000;  // 1 MB
+    static constexpr size_t page_size = 0x1000;
+    static constexpr size_t huge_page_size = 0x200000;
+
    private:
     size_t m_size;
-    uint8_t *m_mem;
+    size_t m_mapped_size;  // m_size rounded up to whole huge pages if they are used
+    uint8_t *m_mem = nullptr;
+    bool m_owned = true;
+
+    // one bit per page written since the last clear_dirty_pages, empty while not tracking
+    std::vector<uint64_t> m_dirty_pages{};
+
+    // hash of every page and the sum of their digest terms; pages written since the last
+    // digest() are marked stale and hashed again by it, all empty before the first digest()
+    std::vector<uint64_t> m_page_hashes{};
+    std::vector<uint64_t> m_stale_pages{};
+    uint64_t m_pages_digest = 0;
+
+    bool m_watch_writes = false;  // dirty pages or page hashes are tracked
 
-    static constexpr size_t default_mem_size = 0x100000;  // 1 GB
+    struct MappedDevice {
+        uint64_t base;
+        uint64_t size;
+        std::unique_ptr<mmio::Device> device;
+    };
+
+    // only searched once an access misses RAM, there are a handful at most
+    std::vector<MappedDevice> m_devices{};
+
+    MappedDevice *find_device(uint64_t addr, unsigned size) const noexcept {
+        for (const MappedDevice &mapped : m_devices) {
+            if (addr >= mapped.base && addr - mapped.base <= mapped.size - size) {
+                return const_cast<MappedDevice *>(&mapped);
+            }
+        }
+        return nullptr;
+    }
+
+    static void mark_pages(std::vector<uint64_t> &bits, uint64_t addr, size_t count) noexcept {
+        for (uint64_t page = addr / page_size; page <= (addr + count - 1) / page_size; ++page) {
+            bits[page / 64] |= uint64_t(1) << (page % 64);
+        }
+    }
+
+    void mark_written(uint64_t addr, size_t count) noexcept {
+        if (!m_dirty_pages.empty()) {
+            mark_pages(m_dirty_pages, addr, count);
+        }
+        if (!m_stale_pages.empty()) {
+            mark_pages(m_stale_pages, addr, count);
+        }
+    }
+
+    uint64_t hash_page(size_t page) const noexcept {
+        size_t offset = page * page_size;
+        return hashing::hash_bytes({m_mem + offset, std::min(page_size, m_size - offset)});
+    }
+
+    // summed, so a page's term can be replaced without touching the others
+    static uint64_t digest_term(size_t page, uint64_t page_hash) noexcept {
+        return hashing::mix64(page_hash ^ (page * 0x9e3779b97f4a7c15));
+    }
 
    public:
-    Memory(size_t size = default_mem_size) : m_size(size) {
-        errno = 0;
+    static uint8_t *map(size_t size, int flags) noexcept {
         void *mmap_result =
-            mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (mmap_result == MAP_FAILED) {
-            throw std::runtime_error{fmt::format("Can't mmap memory size of {} with errno: {}",
-                                                 std::to_string(m_size), std::strerror(errno))};
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        return mmap_result == MAP_FAILED ? nullptr : static_cast<uint8_t *>(mmap_result);
+    }
+
+    // replaces an older file of that name, a process still mapping it keeps the old pages
+    static uint8_t *map_shared(const std::string &path, size_t size) noexcept {
+        unlink(path.c_str());
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            return nullptr;
+        }
+        void *mmap_result = MAP_FAILED;
+        if (ftruncate(fd, size) == 0) {
+            mmap_result = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
         }
-        m_mem = static_cast<uint8_t *>(mmap_result);
+        int map_errno = errno;
+        close(fd);
+        errno = map_errno;
+        return mmap_result == MAP_FAILED ? nullptr : static_cast<uint8_t *>(mmap_result);
+    }
+
+    // transparent huge pages need 2 MB aligned ranges, the unaligned ends are unmapped again
+    static uint8_t *map_huge_aligned(size_t size) noexcept {
+        uint8_t *mapping = map(size + huge_page_size, 0);
+        if (!mapping) {
+            return nullptr;
+        }
+        size_t head = -reinterpret_cast<uintptr_t>(mapping) & (huge_page_size - 1);
+        if (head != 0) {
+            munmap(mapping, head);
+        }
+        munmap(mapping + head + size, huge_page_size - head);
+        madvise(mapping + head, size, MADV_HUGEPAGE);
+        return mapping + head;
+    }
 
+   public:
+    explicit Memory(size_t size = default_mem_size, const Backing &backing = {})
+        : m_size(size), m_mapped_size(size) {
         Logger &myLogger = Logger::getInstance();
+
+        if (!backing.shared_name.empty()) {
+            const auto &name = backing.shared_name;
+            if (name.find('/') != std::string::npos || name == "." || name == "..") {
+                throw std::runtime_error{fmt::format("Invalid shared memory name: '{}'", name)};
+            }
+            std::string path = fmt::format("/dev/shm/{}", name);
+            m_mem = map_shared(path, m_mapped_size);
+            if (!m_mem) {
+                throw std::runtime_error{fmt::format("Can't map {} of size {} with errno: {}",
+                                                     path, m_size, std::strerror(errno))};
+            }
+        } else {
+            if (backing.huge_pages != HugePages::none) {
+                m_mapped_size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+            }
+            if (backing.huge_pages == HugePages::hugetlb) {
+                m_mem = map(m_mapped_size, MAP_HUGETLB);
+                if (!m_mem) {
+                    myLogger.message(Logger::severity_level::standard, "Memory",
+                                     fmt::format("MAP_HUGETLB failed with errno: {}, falling "
+                                                 "back to transparent huge pages",
+                                                 std::strerror(errno)));
+                }
+            }
+            if (!m_mem) {
+                errno = 0;
+                m_mem = backing.huge_pages == HugePages::none ? map(m_mapped_size, 0)
+                                                              : map_huge_aligned(m_mapped_size);
+            }
+            if (!m_mem) {
+                throw std::runtime_error{fmt::format("Can't mmap memory size of {} with errno: {}",
+                                                     std::to_string(m_size),
+                                                     std::strerror(errno))};
+            }
+        }
+
+        if (backing.numa_node != kNoNode) {
+            bind_numa(backing.numa_node);
+        }
+
         myLogger.message(Logger::severity_level::standard, "Memory",
                          fmt::format("{} - {}", static_cast<void *>(m_mem),
                                      static_cast<void *>(m_mem + m_size)));
     }
 
+    // guest memory backed by a host owned buffer, nothing is copied
+    Memory(uint8_t *host_buffer, size_t size)
+        : m_size(size), m_mapped_size(size), m_mem(host_buffer), m_owned(false) {}
+
+    Memory(const Memory &) = delete;
+    Memory &operator=(const Memory &) = delete;
+
+    Memory(Memory &&other) noexcept
+        : m_size(other.m_size),
+          m_mapped_size(other.m_mapped_size),
+          m_mem(other.m_mem),
+          m_owned(other.m_owned),
+          m_dirty_pages(std::move(other.m_dirty_pages)),
+          m_page_hashes(std::move(other.m_page_hashes)),
+          m_stale_pages(std::move(other.m_stale_pages)),
+          m_pages_digest(other.m_pages_digest),
+          m_watch_writes(other.m_watch_writes),
+          m_devices(std::move(other.m_devices)) {
+        other.m_mem = nullptr;
+        other.m_owned = false;
+    }
+
+    ~Memory() {
+        if (m_owned) {
+            munmap(m_mem, m_mapped_size);
+        }
+    }
+
+    // false if the access is out of memory, alignment is checked by the caller
     template <typename ValType>
-    void load(uint64_t addr, uint64_t &value) const {
-        // check alignment
+    bool load(uint64_t addr, uint64_t &value) const {
+        if (addr > m_size - sizeof(ValType)) [[unlikely]] {
+            return false;
+        }
         value = *reinterpret_cast<ValType *>(m_mem + addr);
+        return true;
     }
 
     template <typename ValType>
-    void store(uint64_t addr, uint64_t value) {
-        // check alignment
+    bool store(uint64_t addr, uint64_t value) {
+        if (addr > m_size - sizeof(ValType)) [[unlikely]] {
+            return false;
+        }
+        if (m_watch_writes) [[unlikely]] {
+            mark_written(addr, sizeof(ValType));
+        }
         *reinterpret_cast<ValType *>(m_mem + addr) = value;
+        return true;
+    }
+
+    // one host atomic read-modify-write, old gets the value before it; false if the access
+    // is out of memory, addr has to be aligned
+    template <typename ValType>
+    bool amo(uint64_t addr, Amo op, uint64_t operand, uint64_t &old) {
+        if (addr > m_size - sizeof(ValType)) [[unlikely]] {
+            return false;
+        }
+        if (m_watch_writes) [[unlikely]] {
+            mark_written(addr, sizeof(ValType));
+        }
+        using Signed = std::make_signed_t<ValType>;
+        std::atomic_ref<ValType> cell{*reinterpret_cast<ValType *>(m_mem + addr)};
+        auto value = static_cast<ValType>(operand);
+        switch (op) {
+            case Amo::swap: old = cell.exchange(value); return true;
+            case Amo::add: old = cell.fetch_add(value); return true;
+            case Amo::bit_xor: old = cell.fetch_xor(value); return true;
+            case Amo::bit_and: old = cell.fetch_and(value); return true;
+            case Amo::bit_or: old = cell.fetch_or(value); return true;
+            default: break;
+        }
+        // no host instruction for min and max, a compare-exchange loop instead
+        ValType current = cell.load(std::memory_order_relaxed);
+        ValType result;
+        do {
+            switch (op) {
+                case Amo::min:
+                    result = std::min<Signed>(current, value);
+                    break;
+                case Amo::max:
+                    result = std::max<Signed>(current, value);
+                    break;
+                case Amo::minu:
+                    result = std::min(current, value);
+                    break;
+                default:
+                    result = std::max(current, value);
+                    break;
+            }
+        } while (!cell.compare_exchange_weak(current, result));
+        old = current;
+        return true;
+    }
+
+    // stores desired only if addr still holds expected, atomically; out of memory fails too
+    template <typename ValType>
+    bool compare_exchange(uint64_t addr, uint64_t expected, uint64_t desired) {
+        if (addr > m_size - sizeof(ValType)) [[unlikely]] {
+            return false;
+        }
+        std::atomic_ref<ValType> cell{*reinterpret_cast<ValType *>(m_mem + addr)};
+        auto current = static_cast<ValType>(expected);
+        if (!cell.compare_exchange_strong(current, static_cast<ValType>(desired))) {
+            return false;
+        }
+        if (m_watch_writes) [[unlikely]] {
+            mark_written(addr, sizeof(ValType));
+        }
+        return true;
+    }
+
+    // device accesses, called after load or store found addr outside of RAM; false if no
+    // device covers the whole access or the device rejects it
+    bool load_device(uint64_t addr, unsigned size, uint64_t &value) const {
+        MappedDevice *mapped = find_device(addr, size);
+        return mapped && mapped->device->read(addr - mapped->base, size, value);
+    }
+
+    bool store_device(uint64_t addr, unsigned size, uint64_t value) {
+        MappedDevice *mapped = find_device(addr, size);
+        return mapped && mapped->device->write(addr - mapped->base, size, value);
+    }
+
+    // device ranges must lie above RAM and must not overlap
+    mmio::Device &map_device(uint64_t base, uint64_t size, std::unique_ptr<mmio::Device> device) {
+        if (size == 0 || base < m_size || base + size < base) {
+            throw std::runtime_error{
+                fmt::format("Can't map device at {:#x} size {:#x} over memory", base, size)};
+        }
+        for (const MappedDevice &mapped : m_devices) {
+            if (base < mapped.base + mapped.size && mapped.base < base + size) {
+                throw std::runtime_error{fmt::format(
+                    "Device at {:#x} size {:#x} overlaps the one at {:#x}", base, size, mapped.base)};
+            }
+        }
+        m_devices.push_back({base, size, std::move(device)});
+        return *m_devices.back().device;
+    }
+
+    void flush_devices() {
+        for (MappedDevice &mapped : m_devices) {
+            mapped.device->flush();
+        }
+    }
+
+    // one state per device in mapping order
+    std::vector<mmio::DeviceState> save_device_states() const {
+        std::vector<mmio::DeviceState> states;
+        for (const MappedDevice &mapped : m_devices) {
+            states.push_back(mapped.device->save_state());
+        }
+        return states;
+    }
+
+    void restore_device_states(const std::vector<mmio::DeviceState> &states) {
+        if (states.size() != m_devices.size()) {
+            throw std::runtime_error{"Snapshot devices don't match with the mapped devices"};
+        }
+        for (size_t device = 0; device < states.size(); ++device) {
+            m_devices[device].device->restore_state(states[device]);
+        }
     }
 
     void store(size_t mem_offset, const void *src, size_t count) {
+        if (m_watch_writes && count != 0) {
+            mark_written(mem_offset, count);
+        }
         std::memcpy(m_mem + mem_offset, src, count);
     }
+
+    // a page can only be written through store once tracking is on, so restoring the dirty
+    // pages from a copy taken at that point brings the whole memory back
+    void track_dirty_pages() {
+        size_t pages = (m_size + page_size - 1) / page_size;
+        m_dirty_pages.assign((pages + 63) / 64, 0);
+        m_watch_writes = true;
+    }
+
+    bool tracks_dirty_pages() const noexcept { return !m_dirty_pages.empty(); }
+    bool watches_writes() const noexcept { return m_watch_writes; }
+
+    // for host writes that bypass store, e.g. through data()
+    void touch(size_t mem_offset, size_t count) noexcept {
+        if (m_watch_writes && count != 0) {
+            mark_written(mem_offset, count);
+        }
+    }
+
+    template <typename Func>
+    void for_each_dirty_page(Func &&func) const {
+        for (size_t word = 0; word < m_dirty_pages.size(); ++word) {
+            for (uint64_t bits = m_dirty_pages[word]; bits != 0; bits &= bits - 1) {
+                func((word * 64 + std::countr_zero(bits)) * page_size);
+            }
+        }
+    }
+
+    void clear_dirty_pages() noexcept {
+        std::fill(m_dirty_pages.begin(), m_dirty_pages.end(), 0);
+    }
+
+    // hash of the whole contents, only the pages written since the last call are read again;
+    // the first call hashes every page and from then on stores mark the pages they write
+    uint64_t digest() {
+        size_t pages = (m_size + page_size - 1) / page_size;
+        if (m_page_hashes.empty() && pages != 0) {
+            m_page_hashes.resize(pages);
+            for (size_t page = 0; page < pages; ++page) {
+                m_page_hashes[page] = hash_page(page);
+                m_pages_digest += digest_term(page, m_page_hashes[page]);
+            }
+            m_stale_pages.assign((pages + 63) / 64, 0);
+            m_watch_writes = true;
+            return m_pages_digest;
+        }
+
+        for (size_t word = 0; word < m_stale_pages.size(); ++word) {
+            for (uint64_t bits = m_stale_pages[word]; bits != 0; bits &= bits - 1) {
+                size_t page = word * 64 + std::countr_zero(bits);
+                m_pages_digest -= digest_term(page, m_page_hashes[page]);
+                m_page_hashes[page] = hash_page(page);
+                m_pages_digest += digest_term(page, m_page_hashes[page]);
+            }
+            m_stale_pages[word] = 0;
+        }
+        return m_pages_digest;
+    }
+
+    void load(size_t mem_offset, void *dst, size_t count) const {
+        std::memcpy(dst, m_mem + mem_offset, count);
+    }
+
+    // moves the pages to node and allocates new ones there, kLocalNode is the node of the
+    // calling thread; false if the host has no NUMA support
+    bool bind_numa(int node) noexcept {
+        if (node == kLocalNode) {
+            unsigned cpu, local_node;
+            if (syscall(SYS_getcpu, &cpu, &local_node, nullptr) != 0) {
+                return false;
+            }
+            node = local_node;
+        }
+
+        // <numaif.h> belongs to libnuma, the syscall itself needs nothing
+        constexpr int kMpolBind = 2;
+        constexpr unsigned kMpolMfMove = 1 << 1;
+        constexpr size_t kMaskBits = sizeof(unsigned long) * CHAR_BIT;
+
+        std::vector<unsigned long> mask(node / kMaskBits + 1);
+        mask[node / kMaskBits] = 1ul << (node % kMaskBits);
+        if (syscall(SYS_mbind, m_mem, m_mapped_size, kMpolBind, mask.data(),
+                    mask.size() * kMaskBits + 1, kMpolMfMove) != 0) {
+            Logger::getInstance().message(
+                Logger::severity_level::standard, "Memory",
+                fmt::format("mbind to node {} failed with errno: {}", node, std::strerror(errno)));
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const noexcept { return m_size; }
+    uint8_t *data() const noexcept { return m_mem; }
 };
 
 }  // namespace memory
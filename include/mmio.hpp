@@ -0,0 +1,109 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mmio {
+
+// registers of a device as snapshots keep them, whatever the device puts there
+using DeviceState = std::vector<uint64_t>;
+
+// Memory-mapped device. Memory only dispatches accesses outside of RAM here, so devices cost
+// nothing on the load/store fast path. offset is relative to the base the device is mapped
+// at, size is 1, 2, 4 or 8 and the access lies within the mapped range.
+class Device {
+   public:
+    virtual ~Device() = default;
+
+    // false turns the access into an access fault
+    virtual bool read(uint64_t offset, unsigned size, uint64_t &value) = 0;
+    virtual bool write(uint64_t offset, unsigned size, uint64_t value) = 0;
+
+    // pushes buffered output to the host
+    virtual void flush() {}
+
+    // guest visible registers for snapshots, restore_state gets back what save_state returned
+    virtual DeviceState save_state() const { return {}; }
+    virtual void restore_state(const DeviceState &state) { (void)state; }
+};
+
+// QEMU virt machine layout
+constexpr uint64_t kUartBase = 0x10000000;
+constexpr uint64_t kUartSize = 0x100;
+constexpr uint64_t kClintBase = 0x2000000;
+constexpr uint64_t kClintSize = 0x10000;
+
+// 16550 transmitter: always ready, nothing is ever received. Output bytes are collected and
+// written to fd once the buffer is full, on flush(), or per line if fd is a terminal.
+class Uart16550 final : public Device {
+   private:
+    enum Reg : uint64_t { rbr_thr = 0, ier = 1, iir_fcr = 2, lcr = 3, mcr = 4, lsr = 5, msr = 6, scr = 7 };
+
+    static constexpr uint8_t kLcrDlab = 0x80;
+    static constexpr uint8_t kLsrIdle = 0x60;  // THR empty, transmitter empty
+    static constexpr uint8_t kIirNone = 0x01;  // no interrupt pending
+
+    int m_fd;
+    bool m_line_buffered;
+    size_t m_capacity;
+    std::string m_buffer;
+
+    uint8_t m_ier = 0, m_fcr = 0, m_lcr = 0, m_mcr = 0, m_scr = 0;
+    uint8_t m_dll = 0, m_dlm = 0;
+
+    uint64_t m_bytes = 0;
+    uint64_t m_writes = 0;
+
+   public:
+    explicit Uart16550(int fd = STDOUT_FILENO, size_t capacity = 4096);
+    ~Uart16550() override;
+
+    bool read(uint64_t offset, unsigned size, uint64_t &value) override;
+    bool write(uint64_t offset, unsigned size, uint64_t value) override;
+    void flush() override;
+
+    // the registers, not the output that wasn't flushed yet
+    DeviceState save_state() const override;
+    void restore_state(const DeviceState &state) override;
+
+    uint64_t bytes() const noexcept { return m_bytes; }
+    uint64_t host_writes() const noexcept { return m_writes; }
+};
+
+// SiFive CLINT for one hart: msip, mtimecmp and mtime. mtime comes from a callback, e.g.
+// Hart::time, which reads the host clock through Hart::input so that record/replay sees it;
+// pending bits are only exposed until the hart takes interrupts.
+class Clint final : public Device {
+   private:
+    static constexpr uint64_t kMsip = 0x0;
+    static constexpr uint64_t kMtimecmp = 0x4000;
+    static constexpr uint64_t kMtime = 0xbff8;
+
+    std::function<uint64_t()> m_now;
+    uint64_t m_mtime_offset = 0;  // set by guest writes to mtime
+    uint64_t m_mtimecmp = ~uint64_t(0);
+    uint32_t m_msip = 0;
+
+    static bool access_64(uint64_t offset, unsigned size, uint64_t reg, unsigned &shift);
+
+   public:
+    explicit Clint(std::function<uint64_t()> now) : m_now(std::move(now)) {}
+
+    bool read(uint64_t offset, unsigned size, uint64_t &value) override;
+    bool write(uint64_t offset, unsigned size, uint64_t value) override;
+
+    // the mtime offset, so the same callback time reads as the same mtime after a restore
+    DeviceState save_state() const override { return {m_mtime_offset, m_mtimecmp, m_msip}; }
+    void restore_state(const DeviceState &state) override;
+
+    uint64_t mtime() const { return m_now() + m_mtime_offset; }
+    bool timer_pending() const { return mtime() >= m_mtimecmp; }
+    bool software_pending() const noexcept { return m_msip & 1; }
+};
+
+}  // namespace mmio
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "csr.hpp"
+#include "memory.hpp"
+
+namespace mmu {
+
+enum class Access : uint8_t { fetch, load, store };
+constexpr size_t kAccessNum = 3;
+
+constexpr unsigned kPageShift = 12;
+constexpr uint64_t kPageSize = uint64_t(1) << kPageShift;
+constexpr uint64_t kPageOffsetMask = kPageSize - 1;
+
+// page table entry bits
+constexpr uint16_t kPteV = 1 << 0;
+constexpr uint16_t kPteR = 1 << 1;
+constexpr uint16_t kPteW = 1 << 2;
+constexpr uint16_t kPteX = 1 << 3;
+constexpr uint16_t kPteU = 1 << 4;
+constexpr uint16_t kPteG = 1 << 5;
+constexpr uint16_t kPteA = 1 << 6;
+constexpr uint16_t kPteD = 1 << 7;
+// no PTE bit: set in TLB entries of readable or executable pages, what loads need under MXR
+constexpr uint16_t kReadableOrExecutable = 1 << 8;
+
+// leaf entry bits as a TLB entry keeps them
+constexpr uint16_t entry_flags(uint16_t pte_flags) {
+    return pte_flags & (kPteR | kPteX) ? pte_flags | kReadableOrExecutable : pte_flags;
+}
+
+enum class WalkResult { ok, page_fault, access_fault };
+
+// Sv39 walk of the page tables satp points to: page gets the physical address of the 4 KiB
+// page holding addr, also inside superpages, and flags the bits of the leaf entry. Permissions
+// are the caller's; A and D are never set here, a clear one makes the access fault instead.
+WalkResult walk(const memory::Memory &mem, uint64_t satp, uint64_t addr, uint64_t &page,
+                uint16_t &flags);
+
+// entry bits an access needs set and must find clear
+struct Permission {
+    uint16_t need = 0;
+    uint16_t forbid = 0;
+
+    bool allows(uint16_t flags) const noexcept {
+        return (flags & need) == need && !(flags & forbid);
+    }
+};
+
+// privilege is the effective one, e.g. mstatus.MPP for loads and stores under MPRV
+Permission permission(Access access, csr::Privilege privilege, bool sum, bool mxr);
+
+// Direct mapped cache of leaf translations tagged with the address space id, global pages
+// match every id. An entry covers one 4 KiB page, superpages take one per page in use. Empty
+// entries have no flags, so they never pass a permission check.
+class Tlb final {
+   public:
+    struct Entry {
+        uint64_t vpn = 0;
+        uint64_t page = 0;
+        uint16_t asid = 0;
+        uint16_t flags = 0;
+    };
+
+   private:
+    static constexpr size_t kEntries = 256;
+
+    std::array<Entry, kEntries> m_entries{};
+
+   public:
+    // the entry vpn would use, check it with Permission::allows before trusting it
+    const Entry *find(uint64_t vpn, uint16_t asid) const noexcept {
+        const Entry &entry = m_entries[vpn & (kEntries - 1)];
+        if (entry.vpn != vpn || (entry.asid != asid && !(entry.flags & kPteG))) {
+            return nullptr;
+        }
+        return &entry;
+    }
+
+    // flags from entry_flags
+    void insert(uint64_t vpn, uint16_t asid, uint64_t page, uint16_t flags) noexcept {
+        m_entries[vpn & (kEntries - 1)] = {vpn, page, asid, flags};
+    }
+
+    // sfence.vma: one page or all of them, in one address space (global pages excepted) or in
+    // all of them
+    void flush(std::optional<uint64_t> vpn, std::optional<uint16_t> asid) noexcept;
+    void flush() noexcept { m_entries.fill({}); }
+};
+
+}  // namespace mmu
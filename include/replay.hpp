@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hart.hpp"
+
+namespace replay {
+
+// Deterministic record/replay: a recording keeps the nondeterministic inputs consumed by the
+// guest plus a hart snapshot every keyframe_interval instructions. Only the first keyframe
+// holds all of memory. Every kCheckpointInterval-th one holds each page written since then,
+// the others the pages written since the keyframe before. Seeking takes memory back to the
+// first keyframe's by the pages written since the last seek, applies the checkpoint and at
+// most kCheckpointInterval - 1 keyframes after it and executes forward, so its cost grows with
+// the pages the program writes but neither with the length of the recording nor with memory.
+class Session final {
+   private:
+    struct Keyframe {
+        uint64_t index;        // instructions executed before the snapshot
+        uint64_t input_index;  // inputs consumed before the snapshot
+        hart::Snapshot snapshot;             // with memory in the first keyframe only
+        // written since the previous keyframe, in a checkpoint since the first one
+        std::vector<hart::PageCopy> pages;
+    };
+
+    static constexpr size_t kCheckpointInterval = 64;
+
+    uint64_t m_keyframe_interval;
+    std::vector<Keyframe> m_keyframes;
+    std::vector<uint64_t> m_inputs;
+
+    uint64_t m_length = 0;
+    uint64_t m_position = 0;
+    uint64_t m_input_index = 0;
+    bool m_replaying = false;
+
+    const Keyframe &keyframe_before(uint64_t index) const;
+    void restore(hart::Hart &hart, const Keyframe &keyframe);
+
+   public:
+    explicit Session(uint64_t keyframe_interval);
+
+    static Session load(const std::string &recording_file);
+    void save(const std::string &recording_file) const;
+
+    // runs the hart until exit, returns the number of recorded instructions
+    uint64_t record(hart::Hart &hart);
+
+    // brings the hart to the state right before instruction `index` of the recording
+    void seek(hart::Hart &hart, uint64_t index);
+    // steps one instruction back, returns false at the beginning of the recording
+    bool reverse_step(hart::Hart &hart);
+
+    uint64_t input(uint64_t host_value);
+
+    uint64_t length() const noexcept { return m_length; }
+    uint64_t position() const noexcept { return m_position; }
+};
+
+}  // namespace replay
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "executor.hpp"
+#include "hart.hpp"
+
+namespace sched {
+
+// Multiplexes many harts over a fixed pool of host threads: every worker takes the hart at
+// the head of the queue, runs one instruction slice and puts it back to the tail unless it
+// stopped for another reason than an exhausted budget.
+class Scheduler final {
+   public:
+    // called from a worker thread once the hart stopped, instructions are counted over all slices
+    using done_callback_t =
+        std::function<void(uint64_t id, hart::Hart &hart, const executor::RunResult &result)>;
+
+   private:
+    struct Task {
+        uint64_t id;
+        std::unique_ptr<hart::Hart> hart;
+        done_callback_t on_done;
+        uint64_t instructions = 0;
+        bool placed = false;  // memory moved to the NUMA node of the first worker
+    };
+
+    const uint64_t m_quantum;
+    const bool m_numa_local;
+
+    std::mutex m_mutex;
+    std::condition_variable m_task_ready;
+    std::condition_variable m_all_done;
+    std::deque<Task> m_queue;
+    uint64_t m_next_id = 0;
+    uint64_t m_pending = 0;
+    bool m_stop = false;
+
+    std::vector<std::thread> m_workers;
+
+    void worker_loop();
+
+   public:
+    // numa_local binds the memory of every hart to the node of the worker running it first
+    Scheduler(size_t threads, uint64_t quantum, bool numa_local = false);
+    ~Scheduler();
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    uint64_t submit(std::unique_ptr<hart::Hart> hart, done_callback_t on_done);
+
+    // blocks until every submitted hart has stopped
+    void wait();
+};
+
+}  // namespace sched
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace stats {
+
+// Live counters of a running simulation in a file under /dev/shm that monitors map read
+// only. The page is a Header followed by Header::hart_count HartSlots. Harts write their own
+// slot at block granularity with relaxed atomics, a publisher thread refreshes the header a
+// few times per second; nothing is ever locked and a reader can't slow the simulation down.
+constexpr std::string_view kShmDir = "/dev/shm";
+constexpr uint64_t kMagic = 0x4547'4150'5441'5453;  // "STATPAGE"
+constexpr uint32_t kVersion = 1;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared with other processes");
+
+enum class HartStatus : uint64_t { running, exited, trapped };
+
+// a cache line per hart, so harts on different host threads never write the same one
+struct alignas(64) HartSlot {
+    std::atomic<uint64_t> retired;
+    std::atomic<uint64_t> pc;     // after the last published block
+    std::atomic<uint64_t> traps;  // handed to the guest's trap handlers
+    std::atomic<uint64_t> status;
+
+    // only the hart's thread writes its slot, a load and a store do without a locked add
+    void retire(uint64_t count, uint64_t at) noexcept {
+        retired.store(retired.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        pc.store(at, std::memory_order_relaxed);
+    }
+
+    void count_trap() noexcept {
+        traps.store(traps.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void finish(HartStatus end) noexcept {
+        status.store(static_cast<uint64_t>(end), std::memory_order_relaxed);
+    }
+};
+
+// slots start right after it, on a cache line of their own
+struct alignas(64) Header {
+    uint64_t magic;  // written last, the page is complete once it matches
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t hart_count;
+    uint64_t pid;
+    uint64_t start_ns;  // CLOCK_MONOTONIC, comparable between processes of a host
+
+    // refreshed by the publisher
+    std::atomic<uint64_t> update_ns;
+    std::atomic<uint64_t> retired;     // over all harts
+    std::atomic<uint64_t> milli_mips;  // since the previous refresh
+    std::atomic<uint64_t> log_drops;   // records the async log dropped
+    std::atomic<uint64_t> finished;
+
+    char program[256];  // elf file, zero terminated
+};
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t now_ns();
+
+// creates /dev/shm/<name>, replacing an older page of that name; the file stays after the
+// simulation so that a monitor sees the final counters
+class Publisher final {
+   private:
+    std::string m_path;
+    size_t m_size = 0;
+    Header *m_header = nullptr;
+
+    std::chrono::milliseconds m_interval;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+    std::thread m_thread;
+
+    uint64_t m_last_ns = 0;
+    uint64_t m_last_retired = 0;
+
+    void refresh();
+    void publish_loop();
+
+   public:
+    Publisher(const std::string &name, size_t hart_count, std::string_view program,
+              std::chrono::milliseconds interval = std::chrono::milliseconds{250});
+    ~Publisher();
+
+    Publisher(const Publisher &) = delete;
+    Publisher &operator=(const Publisher &) = delete;
+
+    HartSlot &slot(size_t hart) noexcept {
+        return reinterpret_cast<HartSlot *>(m_header + 1)[hart];
+    }
+};
+
+// read only mapping of a page, throws if the file isn't one of this version
+class Reader final {
+   private:
+    size_t m_size = 0;
+    const Header *m_header = nullptr;
+
+   public:
+    explicit Reader(const std::string &path);
+    ~Reader();
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    const Header &header() const noexcept { return *m_header; }
+    const HartSlot &slot(size_t hart) const noexcept {
+        return reinterpret_cast<const HartSlot *>(m_header + 1)[hart];
+    }
+};
+
+}  // namespace stats
@@ -0,0 +1,545 @@
+#include "aot.hpp"
+
+#include <dlfcn.h>
+#include <fmt/format.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "decoder.hpp"
+#include "elfio/elfio.hpp"
+#include "hash.hpp"
+#include "instruction.hpp"
+#include "logger.hpp"
+
+namespace aot {
+
+namespace {
+
+using instruction::InstrId;
+
+constexpr uint64_t kInstrSize = sizeof(instruction::instr_t);
+
+struct TextSegment {
+    uint64_t begin;
+    std::vector<instruction::EncInstr> instrs;
+    std::vector<bool> leaders;
+};
+
+// repeats State and the memory access paths of the executor for the generated code
+constexpr const char *kPrelude = R"(#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+struct State;
+using block_fn_t = void (*)(State *state);
+
+struct State {
+    uint64_t *regs;
+    uint8_t *mem;
+    uint64_t mem_size;
+    uint64_t pc;
+    uint64_t retired;
+    uint64_t limit;
+    uint32_t fast_stores;
+    uint32_t code_changed;
+    block_fn_t next;
+    void *hart;
+    const void *module;
+    int (*load)(State *state, uint64_t addr, unsigned size, uint64_t *value);
+    int (*store)(State *state, uint64_t addr, unsigned size, uint64_t value);
+};
+
+struct BlockEntry {
+    uint64_t pc;
+    block_fn_t fn;
+};
+
+struct SegmentEntry {
+    uint64_t begin;
+    uint64_t size;
+};
+
+namespace {
+
+inline uint64_t sx32(uint64_t value) { return (uint64_t)(int64_t)(int32_t)(uint32_t)value; }
+
+bool in_text(uint64_t addr, uint64_t size);
+
+// sign or zero extends by the signedness of T; the callbacks count the index instructions of
+// the block in front of the access as retired
+template <typename T>
+inline bool load(State *st, uint64_t pc, uint64_t index, uint64_t addr, uint64_t &value) {
+    T raw;
+    if (__builtin_expect(!(addr & (sizeof(T) - 1)) && addr <= st->mem_size - sizeof(T), 1)) {
+        std::memcpy(&raw, st->mem + addr, sizeof(T));
+    } else {
+        uint64_t slow;
+        st->pc = pc;
+        st->retired += index;
+        int done = st->load(st, addr, sizeof(T), &slow);
+        st->retired -= index;
+        if (!done) {
+            return false;
+        }
+        raw = (T)slow;
+    }
+    value = (uint64_t)(int64_t)raw;
+    return true;
+}
+
+template <typename T>
+inline bool store(State *st, uint64_t pc, uint64_t index, uint64_t addr, uint64_t value) {
+    if (__builtin_expect(st->fast_stores && !(addr & (sizeof(T) - 1)) &&
+                             addr <= st->mem_size - sizeof(T) && !in_text(addr, sizeof(T)),
+                         1)) {
+        T raw = (T)value;
+        std::memcpy(st->mem + addr, &raw, sizeof(T));
+        return true;
+    }
+    st->pc = pc;
+    st->retired += index;
+    int done = st->store(st, addr, sizeof(T), value);
+    st->retired -= index;
+    return done;
+}
+
+)";
+
+bool is_direct(InstrId id) { return instruction::is_control_transfer(id) && id != InstrId::JALR; }
+
+// the rest is left to the interpreter, which also handles their traps and mode changes and
+// the reservations of lr and sc
+bool is_translated(InstrId id) {
+    return id != InstrId::ILLEGAL && !instruction::is_system(id) && !instruction::is_atomic(id);
+}
+
+std::vector<TextSegment> read_text(const std::string &elf_file, uint64_t &hash) {
+    ELFIO::elfio reader;
+    if (!reader.load(elf_file)) {
+        throw std::runtime_error{"Can't load elf file " + elf_file};
+    }
+    if (reader.get_class() != ELFIO::ELFCLASS64) {
+        throw std::runtime_error{"Elf file class doesn't match with ELFCLASS64"};
+    }
+
+    std::vector<TextSegment> text;
+    hash = hashing::mix64(kAbiVersion);
+    for (ELFIO::Elf_Half i = 0; i < reader.segments.size(); ++i) {
+        ELFIO::segment *segment = reader.segments[i];
+        if (segment->get_type() != ELFIO::PT_LOAD || !(segment->get_flags() & ELFIO::PF_X)) {
+            continue;
+        }
+
+        size_t count = segment->get_file_size() / kInstrSize;
+        const auto *data = reinterpret_cast<const uint8_t *>(segment->get_data());
+        hash = hashing::mix64(hash ^ segment->get_virtual_address()) ^
+               hashing::hash_bytes({data, count * kInstrSize});
+
+        TextSegment &text_segment = text.emplace_back(
+            TextSegment{segment->get_virtual_address(), std::vector<instruction::EncInstr>(count),
+                        std::vector<bool>(count)});
+        for (size_t j = 0; j < count; ++j) {
+            instruction::instr_t raw;
+            std::memcpy(&raw, data + j * kInstrSize, sizeof(raw));
+            decoder::Decoder::decode_instruction(raw, text_segment.instrs[j]);
+        }
+    }
+
+    auto mark_leader = [&](uint64_t pc) {
+        for (auto &segment : text) {
+            uint64_t offset = pc - segment.begin;
+            if (offset < segment.instrs.size() * kInstrSize && !(offset & (kInstrSize - 1))) {
+                segment.leaders[offset / kInstrSize] = true;
+            }
+        }
+    };
+
+    mark_leader(reader.get_entry());
+    for (auto &segment : text) {
+        if (!segment.instrs.empty()) {
+            segment.leaders[0] = true;
+        }
+        for (size_t j = 0; j < segment.instrs.size(); ++j) {
+            const auto &instr = segment.instrs[j];
+            uint64_t pc = segment.begin + j * kInstrSize;
+            if (instruction::is_control_transfer(instr.id) || !is_translated(instr.id)) {
+                mark_leader(pc + kInstrSize);
+            }
+            if (is_direct(instr.id)) {
+                mark_leader(pc + instr.imm);
+            }
+        }
+    }
+
+    return text;
+}
+
+std::string block_name(uint64_t pc) { return fmt::format("b_{:x}", pc); }
+
+std::string reg(uint8_t id) { return fmt::format("r[{}]", id); }
+
+std::string imm(uint64_t value) { return fmt::format("{:#x}ull", value); }
+
+// same results as the Executor::execute_* handlers, x0 is never written
+std::string alu_expression(const instruction::EncInstr &instr, uint64_t pc) {
+    std::string rs1 = reg(instr.rs1), rs2 = reg(instr.rs2), i = imm(instr.imm);
+    switch (instr.id) {
+        case InstrId::ADD: return fmt::format("{} + {}", rs1, rs2);
+        case InstrId::SUB: return fmt::format("{} - {}", rs1, rs2);
+        case InstrId::SLL: return fmt::format("{} << ({} & 63)", rs1, rs2);
+        case InstrId::SLT: return fmt::format("(uint64_t)((int64_t){} < (int64_t){})", rs1, rs2);
+        case InstrId::SLTU: return fmt::format("(uint64_t)({} < {})", rs1, rs2);
+        case InstrId::XOR: return fmt::format("{} ^ {}", rs1, rs2);
+        case InstrId::SRL: return fmt::format("{} >> ({} & 63)", rs1, rs2);
+        case InstrId::SRA: return fmt::format("(uint64_t)((int64_t){} >> ({} & 63))", rs1, rs2);
+        case InstrId::OR: return fmt::format("{} | {}", rs1, rs2);
+        case InstrId::AND: return fmt::format("{} & {}", rs1, rs2);
+        case InstrId::ADDW: return fmt::format("sx32({} + {})", rs1, rs2);
+        case InstrId::SLLW: return fmt::format("sx32({} << ({} & 31))", rs1, rs2);
+        case InstrId::SRLW: return fmt::format("sx32(({} & 0xffffffffull) >> ({} & 31))", rs1, rs2);
+        case InstrId::SUBW: return fmt::format("sx32({} - {})", rs1, rs2);
+        case InstrId::SRAW:
+            return fmt::format("sx32((uint64_t)((int64_t){} >> ({} & 31)))", rs1, rs2);
+
+        case InstrId::ADDI: return fmt::format("{} + {}", rs1, i);
+        case InstrId::SLTI: return fmt::format("(uint64_t)((int64_t){} < (int64_t){})", rs1, i);
+        case InstrId::SLTIU: return fmt::format("(uint64_t)({} < {})", rs1, i);
+        case InstrId::XORI: return fmt::format("{} ^ {}", rs1, i);
+        case InstrId::ORI: return fmt::format("{} | {}", rs1, i);
+        case InstrId::ANDI: return fmt::format("{} & {}", rs1, i);
+        case InstrId::SLLI: return fmt::format("{} << {}", rs1, instr.imm & 63);
+        case InstrId::SRLI: return fmt::format("{} >> {}", rs1, instr.imm & 63);
+        case InstrId::SRAI: return fmt::format("(uint64_t)((int64_t){} >> {})", rs1, instr.imm & 63);
+        case InstrId::ADDIW: return fmt::format("sx32({} + {})", rs1, i);
+        case InstrId::SLLIW: return fmt::format("sx32({} << {})", rs1, instr.imm & 31);
+        case InstrId::SRLIW: return fmt::format("sx32(({} & 0xffffffffull) >> {})", rs1, instr.imm & 31);
+        case InstrId::SRAIW:
+            return fmt::format("sx32((uint64_t)((int64_t){} >> {}))", rs1, instr.imm & 31);
+
+        case InstrId::LUI: return i;
+        case InstrId::AUIPC: return imm(pc + instr.imm);
+        default: return "";
+    }
+}
+
+const char *load_type(InstrId id) {
+    switch (id) {
+        case InstrId::LB: return "int8_t";
+        case InstrId::LH: return "int16_t";
+        case InstrId::LW: return "int32_t";
+        case InstrId::LD: return "uint64_t";
+        case InstrId::LBU: return "uint8_t";
+        case InstrId::LHU: return "uint16_t";
+        case InstrId::LWU: return "uint32_t";
+        default: return nullptr;
+    }
+}
+
+const char *store_type(InstrId id) {
+    switch (id) {
+        case InstrId::SB: return "uint8_t";
+        case InstrId::SH: return "uint16_t";
+        case InstrId::SW: return "uint32_t";
+        case InstrId::SD: return "uint64_t";
+        default: return nullptr;
+    }
+}
+
+const char *branch_condition(InstrId id) {
+    switch (id) {
+        case InstrId::BEQ: return "{} == {}";
+        case InstrId::BNE: return "{} != {}";
+        case InstrId::BLT: return "(int64_t){} < (int64_t){}";
+        case InstrId::BGE: return "(int64_t){} >= (int64_t){}";
+        case InstrId::BLTU: return "{} < {}";
+        case InstrId::BGEU: return "{} >= {}";
+        default: return nullptr;
+    }
+}
+
+class Generator final {
+   private:
+    const std::vector<TextSegment> &m_text;
+    std::ofstream &m_out;
+
+    bool is_block(uint64_t pc) const {
+        for (const auto &segment : m_text) {
+            uint64_t offset = pc - segment.begin;
+            if (offset < segment.instrs.size() * kInstrSize && !(offset & (kInstrSize - 1))) {
+                size_t index = offset / kInstrSize;
+                return segment.leaders[index] && is_translated(segment.instrs[index].id);
+            }
+        }
+        return false;
+    }
+
+    // continues with the block at pc, which the executor runs next if it was translated
+    void jump(uint64_t pc, size_t retired, const char *indent) {
+        m_out << fmt::format("{}st->retired += {};\n{}st->pc = {};\n", indent, retired, indent,
+                             imm(pc));
+        if (is_block(pc)) {
+            m_out << fmt::format("{}st->next = {};\n", indent, block_name(pc));
+        }
+        m_out << fmt::format("{}return;\n", indent);
+    }
+
+    void emit_instruction(const instruction::EncInstr &instr, uint64_t pc, size_t index) {
+        std::string fault =
+            fmt::format("{{ st->retired += {}; st->pc = {}; return; }}", index, imm(pc));
+        std::string addr = fmt::format("{} + {}", reg(instr.rs1), imm(instr.imm));
+
+        if (const char *type = load_type(instr.id)) {
+            m_out << fmt::format("    if (!load<{}>(st, {}, {}, {}, value)) {}\n", type, imm(pc),
+                                 index, addr, fault);
+            if (instr.rd != 0) {
+                m_out << fmt::format("    {} = value;\n", reg(instr.rd));
+            }
+        } else if (const char *type = store_type(instr.id)) {
+            m_out << fmt::format("    if (!store<{}>(st, {}, {}, {}, {})) {}\n", type, imm(pc),
+                                 index, addr, reg(instr.rs2), fault);
+            m_out << fmt::format(
+                "    if (st->code_changed) {{ st->retired += {}; st->pc = {}; return; }}\n",
+                index + 1, imm(pc + kInstrSize));
+        } else if (instr.rd != 0) {
+            m_out << fmt::format("    {} = {};\n", reg(instr.rd), alu_expression(instr, pc));
+        }
+    }
+
+    void emit_end(const instruction::EncInstr &instr, uint64_t pc, size_t len) {
+        // a misaligned target traps at the jump, the interpreter raises that
+        std::string misaligned =
+            fmt::format("{{ st->retired += {}; st->pc = {}; return; }}", len - 1, imm(pc));
+        uint64_t target = pc + instr.imm;
+
+        if (const char *condition = branch_condition(instr.id)) {
+            m_out << fmt::format("    if ({}) {{\n",
+                                 fmt::format(fmt::runtime(condition), reg(instr.rs1),
+                                             reg(instr.rs2)));
+            if (target % kInstrSize) {
+                m_out << fmt::format("        {}\n", misaligned);
+            } else {
+                jump(target, len, "        ");
+            }
+            m_out << "    }\n";
+            jump(pc + kInstrSize, len, "    ");
+        } else if (instr.id == InstrId::JAL) {
+            if (target % kInstrSize) {
+                m_out << fmt::format("    {}\n", misaligned);
+                return;
+            }
+            if (instr.rd != 0) {
+                m_out << fmt::format("    {} = {};\n", reg(instr.rd), imm(pc + kInstrSize));
+            }
+            jump(target, len, "    ");
+        } else {
+            // the target is taken before rd is written, rd may be rs1
+            m_out << fmt::format("    value = ({} + {}) & ~1ull;\n", reg(instr.rs1),
+                                 imm(instr.imm));
+            m_out << fmt::format("    if (value % {}) {}\n", kInstrSize, misaligned);
+            if (instr.rd != 0) {
+                m_out << fmt::format("    {} = {};\n", reg(instr.rd), imm(pc + kInstrSize));
+            }
+            m_out << fmt::format("    st->retired += {};\n    st->pc = value;\n", len);
+        }
+    }
+
+   public:
+    Generator(const std::vector<TextSegment> &text, std::ofstream &out)
+        : m_text(text), m_out(out) {}
+
+    void emit_block(const TextSegment &segment, size_t first) {
+        size_t end = first;
+        while (end < segment.instrs.size() && is_translated(segment.instrs[end].id) &&
+               (end == first || !segment.leaders[end])) {
+            if (instruction::is_control_transfer(segment.instrs[end++].id)) {
+                break;
+            }
+        }
+        size_t len = end - first;
+        uint64_t pc = segment.begin + first * kInstrSize;
+
+        m_out << fmt::format("void {}(State *st) {{\n", block_name(pc));
+        m_out << fmt::format("    if (st->retired + {} > st->limit) {{ st->pc = {}; return; }}\n",
+                             len, imm(pc));
+        m_out << "    uint64_t *r = st->regs;\n    uint64_t value;\n    (void)value;\n";
+
+        for (size_t i = 0; i < len; ++i) {
+            const auto &instr = segment.instrs[first + i];
+            uint64_t instr_pc = pc + i * kInstrSize;
+            if (i + 1 == len && instruction::is_control_transfer(instr.id)) {
+                emit_end(instr, instr_pc, len);
+            } else {
+                emit_instruction(instr, instr_pc, i);
+            }
+        }
+        if (!instruction::is_control_transfer(segment.instrs[end - 1].id)) {
+            jump(pc + len * kInstrSize, len, "    ");
+        }
+        m_out << "}\n\n";
+    }
+};
+
+void write_source(const std::string &source_file, const std::string &elf_file,
+                  const std::vector<TextSegment> &text, uint64_t hash) {
+    std::ofstream out{source_file};
+    if (!out) {
+        throw std::runtime_error{fmt::format("Can't open {}", source_file)};
+    }
+
+    out << fmt::format("// translation of {}, generated by sim --aot\n", elf_file) << kPrelude;
+
+    out << "bool in_text(uint64_t addr, uint64_t size) {\n    return false";
+    for (const auto &segment : text) {
+        out << fmt::format("\n        || (addr + size > {} && addr < {})", imm(segment.begin),
+                           imm(segment.begin + segment.instrs.size() * kInstrSize));
+    }
+    out << ";\n}\n\n";
+
+    auto for_each_block = [&](auto &&func) {
+        for (const auto &segment : text) {
+            for (size_t i = 0; i < segment.instrs.size(); ++i) {
+                if (segment.leaders[i] && is_translated(segment.instrs[i].id)) {
+                    func(segment, i);
+                }
+            }
+        }
+    };
+
+    for_each_block([&](const TextSegment &segment, size_t i) {
+        out << fmt::format("void {}(State *st);\n", block_name(segment.begin + i * kInstrSize));
+    });
+    out << "\n";
+
+    Generator generator{text, out};
+    for_each_block([&](const TextSegment &segment, size_t i) { generator.emit_block(segment, i); });
+
+    out << "}  // namespace\n\n";
+    out << fmt::format("extern \"C\" const uint32_t rv_aot_abi = {};\n", kAbiVersion);
+    out << fmt::format("extern \"C\" const uint64_t rv_aot_hash = {};\n\n", imm(hash));
+
+    size_t blocks = 0;
+    out << "extern \"C\" const BlockEntry rv_aot_blocks[] = {\n";
+    for_each_block([&](const TextSegment &segment, size_t i) {
+        uint64_t pc = segment.begin + i * kInstrSize;
+        out << fmt::format("    {{{}, {}}},\n", imm(pc), block_name(pc));
+        ++blocks;
+    });
+    out << "    {0, nullptr},\n};\n";
+    out << fmt::format("extern \"C\" const size_t rv_aot_block_count = {};\n\n", blocks);
+
+    out << "extern \"C\" const SegmentEntry rv_aot_segments[] = {\n";
+    for (const auto &segment : text) {
+        out << fmt::format("    {{{}, {}}},\n", imm(segment.begin),
+                           imm(segment.instrs.size() * kInstrSize));
+    }
+    out << "};\n";
+    out << fmt::format("extern \"C\" const size_t rv_aot_segment_count = {};\n", text.size());
+
+    if (!out) {
+        throw std::runtime_error{fmt::format("Can't write {}", source_file)};
+    }
+}
+
+std::string shell_quote(const std::string &text) {
+    std::string quoted = "'";
+    for (char c : text) {
+        quoted += c == '\'' ? std::string{"'\\''"} : std::string{c};
+    }
+    return quoted + "'";
+}
+
+struct SegmentEntry {
+    uint64_t begin;
+    uint64_t size;
+};
+
+}  // namespace
+
+std::unique_ptr<Module> Module::open(const std::string &so_file, uint64_t hash) {
+    void *handle = dlopen(so_file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        return nullptr;
+    }
+    std::unique_ptr<Module> module{new Module{handle}};
+
+    auto *abi = static_cast<const uint32_t *>(dlsym(handle, "rv_aot_abi"));
+    auto *module_hash = static_cast<const uint64_t *>(dlsym(handle, "rv_aot_hash"));
+    auto *blocks = static_cast<const BlockEntry *>(dlsym(handle, "rv_aot_blocks"));
+    auto *block_count = static_cast<const size_t *>(dlsym(handle, "rv_aot_block_count"));
+    auto *segments = static_cast<const SegmentEntry *>(dlsym(handle, "rv_aot_segments"));
+    auto *segment_count = static_cast<const size_t *>(dlsym(handle, "rv_aot_segment_count"));
+    if (!abi || !module_hash || !blocks || !block_count || !segments || !segment_count ||
+        *abi != kAbiVersion || *module_hash != hash) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < *segment_count; ++i) {
+        module->m_segments.push_back(
+            {segments[i].begin, segments[i].size,
+             std::vector<block_fn_t>(segments[i].size / kInstrSize)});
+    }
+    for (size_t i = 0; i < *block_count; ++i) {
+        for (auto &segment : module->m_segments) {
+            uint64_t offset = blocks[i].pc - segment.begin;
+            if (offset < segment.size) {
+                segment.blocks[offset / kInstrSize] = blocks[i].fn;
+            }
+        }
+    }
+    return module;
+}
+
+std::unique_ptr<Module> Module::load_or_build(const std::string &elf_file,
+                                              const std::string &compiler) {
+    Logger &myLogger = Logger::getInstance();
+    std::string so_file = elf_file + ".aot.so";
+
+    try {
+        uint64_t hash;
+        auto text = read_text(elf_file, hash);
+
+        if (auto module = open(so_file, hash)) {
+            myLogger.message(Logger::severity_level::standard, "Aot",
+                             fmt::format("loaded {}", so_file));
+            return module;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::string source_file = elf_file + ".aot.cpp";
+        write_source(source_file, elf_file, text, hash);
+
+        // compiled next to the final name first, a running sim may still have the old one open
+        std::string tmp_file = fmt::format("{}.{}.tmp", so_file, getpid());
+        std::string command = fmt::format("{} -std=c++17 -O2 -fPIC -shared -o {} {}", compiler,
+                                          shell_quote(tmp_file), shell_quote(source_file));
+        myLogger.message(Logger::severity_level::standard, "Aot", command);
+        if (std::system(command.c_str()) != 0) {
+            std::remove(tmp_file.c_str());
+            myLogger.message(Logger::severity_level::standard, "Aot",
+                             fmt::format("compiling {} failed, interpreting", source_file));
+            return nullptr;
+        }
+        std::rename(tmp_file.c_str(), so_file.c_str());
+
+        auto module = open(so_file, hash);
+        myLogger.message(
+            Logger::severity_level::standard, "Aot",
+            fmt::format("built {} in {:.1f} s", so_file,
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                            .count()));
+        return module;
+    } catch (const std::exception &e) {
+        myLogger.message(Logger::severity_level::standard, "Aot",
+                         fmt::format("{}, interpreting", e.what()));
+        return nullptr;
+    }
+}
+
+Module::~Module() { dlclose(m_handle); }
+
+}  // namespace aot
@@ -0,0 +1,200 @@
+#include "async_sink.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// identifies the sink a thread-local ring belongs to, addresses may be reused
+std::atomic<uint64_t> g_next_sink_id{1};
+
+thread_local struct {
+    uint64_t sink_id = 0;
+    std::shared_ptr<void> ring;
+} t_ring;
+
+}  // namespace
+
+AsyncSink::Ring::Ring(size_t capacity)
+    : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 64))),
+      m_data(std::make_unique<char[]>(m_capacity)) {}
+
+char *AsyncSink::Ring::try_reserve(size_t length) {
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    size_t offset = head & (m_capacity - 1);
+    size_t size = record_size(length);
+
+    // records never wrap around: the tail of the buffer is skipped instead
+    size_t padding = m_capacity - offset < size ? m_capacity - offset : 0;
+    uint64_t new_head = head + padding + size;
+
+    if (new_head - m_cached_tail > m_capacity) {
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        if (new_head - m_cached_tail > m_capacity) {
+            return nullptr;
+        }
+    }
+
+    if (padding != 0) {
+        std::memcpy(m_data.get() + offset, &kSkipMarker, sizeof(kSkipMarker));
+        offset = 0;
+    }
+
+    uint32_t header = length;
+    std::memcpy(m_data.get() + offset, &header, sizeof(header));
+    m_pending_head = new_head;
+    return m_data.get() + offset + sizeof(header);
+}
+
+void AsyncSink::Ring::commit() { m_head.store(m_pending_head, std::memory_order_release); }
+
+bool AsyncSink::Ring::drain(std::ostream &out) {
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    if (tail == head) {
+        return false;
+    }
+
+    while (tail != head) {
+        size_t offset = tail & (m_capacity - 1);
+        uint32_t length;
+        std::memcpy(&length, m_data.get() + offset, sizeof(length));
+
+        if (length == kSkipMarker) {
+            tail += m_capacity - offset;
+            continue;
+        }
+
+        out.write(m_data.get() + offset + sizeof(length), length);
+        tail += record_size(length);
+    }
+
+    m_tail.store(tail, std::memory_order_release);
+    return true;
+}
+
+AsyncSink::AsyncSink(const std::string &file_name, size_t ring_capacity, overflow_policy policy)
+    : m_id(g_next_sink_id.fetch_add(1, std::memory_order_relaxed)),
+      m_ring_capacity(ring_capacity),
+      m_policy(policy),
+      m_out(file_name) {
+    if (!m_out) {
+        throw std::runtime_error{fmt::format("Can't open log file {}", file_name)};
+    }
+    m_writer = std::thread{&AsyncSink::writer_loop, this};
+}
+
+AsyncSink::~AsyncSink() {
+    m_stop.store(true, std::memory_order_release);
+    m_writer.join();
+
+    if (m_policy == overflow_policy::count_drops) {
+        m_out << "AsyncSink: " << dropped() << " records dropped\n";
+    }
+    m_out.flush();
+}
+
+AsyncSink::Ring &AsyncSink::thread_ring() {
+    if (t_ring.sink_id != m_id) [[unlikely]] {
+        auto ring = std::make_shared<Ring>(m_ring_capacity);
+        {
+            std::lock_guard lock{m_rings_mutex};
+            m_rings.push_back(ring);
+        }
+        m_rings_version.fetch_add(1, std::memory_order_release);
+
+        t_ring.sink_id = m_id;
+        t_ring.ring = std::move(ring);
+    }
+    return *static_cast<Ring *>(t_ring.ring.get());
+}
+
+void AsyncSink::push(std::string_view module_name, std::string_view message) {
+    Ring &ring = thread_ring();
+
+    const std::string_view parts[] = {module_name, ": ", message};
+    size_t length = module_name.size() + 2 + message.size() + 1;  // trailing '\n'
+    length = std::min(length, ring.max_record_length());
+
+    char *record = ring.try_reserve(length);
+    while (record == nullptr) {
+        if (m_policy != overflow_policy::block) {
+            if (m_policy == overflow_policy::count_drops) {
+                ring.count_drop();
+            }
+            return;
+        }
+        std::this_thread::yield();
+        record = ring.try_reserve(length);
+    }
+
+    // oversized records are truncated to what fits into half of the ring
+    size_t pos = 0;
+    for (auto part : parts) {
+        size_t count = std::min(part.size(), length - 1 - pos);
+        std::memcpy(record + pos, part.data(), count);
+        pos += count;
+    }
+    record[pos] = '\n';
+
+    ring.commit();
+}
+
+void AsyncSink::collect_rings(std::vector<std::shared_ptr<Ring>> &rings) {
+    rings.clear();
+
+    std::lock_guard lock{m_rings_mutex};
+    // a ring referenced only from here belongs to an exited thread
+    std::erase_if(m_rings, [this](const std::shared_ptr<Ring> &ring) {
+        if (ring.use_count() != 1 || !ring->empty()) {
+            return false;
+        }
+        m_retired_drops += ring->drops();
+        return true;
+    });
+    rings = m_rings;
+}
+
+void AsyncSink::writer_loop() {
+    using namespace std::chrono_literals;
+
+    std::vector<std::shared_ptr<Ring>> rings;
+    uint64_t version = 0;
+
+    while (!m_stop.load(std::memory_order_acquire)) {
+        bool drained = false;
+        for (auto &ring : rings) {
+            drained |= ring->drain(m_out);
+        }
+
+        uint64_t current_version = m_rings_version.load(std::memory_order_acquire);
+        if (!drained || current_version != version) {
+            version = current_version;
+            collect_rings(rings);
+        }
+        if (!drained) {
+            m_out.flush();
+            std::this_thread::sleep_for(100us);
+        }
+    }
+
+    collect_rings(rings);
+    for (auto &ring : rings) {
+        ring->drain(m_out);
+    }
+}
+
+uint64_t AsyncSink::dropped() {
+    std::lock_guard lock{m_rings_mutex};
+
+    uint64_t drops = m_retired_drops;
+    for (const auto &ring : m_rings) {
+        drops += ring->drops();
+    }
+    return drops;
+}
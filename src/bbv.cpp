@@ -0,0 +1,58 @@
+#include "bbv.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace sampling {
+
+BbvCollector::BbvCollector(const std::string &bbv_file, uint64_t interval, hart::addr_t start_pc)
+    : m_out(bbv_file), m_interval(interval), m_block_start(start_pc) {
+    if (!m_out) {
+        throw std::runtime_error{fmt::format("Can't open bbv file {}", bbv_file)};
+    }
+    if (m_interval == 0) {
+        throw std::runtime_error{"Bbv interval must be positive"};
+    }
+}
+
+BbvCollector::~BbvCollector() { finish(); }
+
+void BbvCollector::end_block() {
+    if (m_block_len == 0) {
+        return;
+    }
+
+    // SimPoint block ids are 1-based and assigned in order of first execution
+    auto [it, inserted] = m_block_ids.try_emplace(m_block_start, m_block_ids.size() + 1);
+    m_counts[it->second] += m_block_len;
+    m_block_len = 0;
+}
+
+void BbvCollector::flush_interval() {
+    // a block crossing the interval boundary is split between both intervals
+    end_block();
+
+    std::vector<std::pair<uint32_t, uint64_t>> counts{m_counts.begin(), m_counts.end()};
+    std::sort(counts.begin(), counts.end());
+
+    m_out << 'T';
+    for (auto [id, count] : counts) {
+        m_out << ':' << id << ':' << count << ' ';
+    }
+    m_out << '\n';
+
+    m_counts.clear();
+    m_interval_len = 0;
+    ++m_intervals;
+}
+
+void BbvCollector::finish() {
+    if (m_interval_len != 0) {
+        flush_interval();
+    }
+    m_out.flush();
+}
+
+}  // namespace sampling
@@ -0,0 +1,442 @@
+#include "block_opt.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+
+#include "decoder.hpp"
+#include "logger.hpp"
+
+namespace blockopt {
+
+namespace {
+
+using instruction::EncInstr;
+using instruction::InstrId;
+
+constexpr size_t kRegNum = hart::g_regfile_size;
+constexpr uint32_t kAllRegs = ~uint32_t(0);
+
+bool is_load(InstrId id) {
+    switch (id) {
+        case InstrId::LB:
+        case InstrId::LH:
+        case InstrId::LW:
+        case InstrId::LBU:
+        case InstrId::LHU:
+        case InstrId::LWU:
+        case InstrId::LD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_store(InstrId id) { return id >= InstrId::SB && id <= InstrId::SD; }
+
+bool is_r_type(InstrId id) { return id <= InstrId::SRAW; }
+
+// instructions that only compute rd from registers, the immediate and the pc
+bool is_alu(InstrId id) {
+    return instruction::writes_rd(id) && !is_load(id) && id != InstrId::JAL &&
+           id != InstrId::JALR && !instruction::is_system(id) && !instruction::is_atomic(id);
+}
+
+unsigned access_size(InstrId id) {
+    switch (id) {
+        case InstrId::LB:
+        case InstrId::LBU:
+        case InstrId::SB:
+            return 1;
+        case InstrId::LH:
+        case InstrId::LHU:
+        case InstrId::SH:
+            return 2;
+        case InstrId::LW:
+        case InstrId::LWU:
+        case InstrId::SW:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+uint32_t reg_bit(uint8_t reg) { return uint32_t(1) << reg; }
+
+uint32_t sources(const EncInstr &instr) {
+    if (instr.id == InstrId::LUI || instr.id == InstrId::AUIPC || instr.id == InstrId::JAL ||
+        instr.id == InstrId::ILLEGAL) {
+        return 0;
+    }
+    bool reads_rs2 = is_r_type(instr.id) || is_store(instr.id) ||
+                     (instr.id >= InstrId::BEQ && instr.id <= InstrId::BGEU);
+    return reg_bit(instr.rs1) | (reads_rs2 ? reg_bit(instr.rs2) : 0);
+}
+
+// result of an alu instruction, same as its Executor::execute_* handler
+uint64_t fold(const EncInstr &instr, uint64_t a, uint64_t b, hart::addr_t pc) {
+    using decoder::bits;
+    using decoder::sext;
+    using hart::signed_reg_t;
+
+    uint64_t imm = instr.imm;
+    switch (instr.id) {
+        case InstrId::ADD: return a + b;
+        case InstrId::SUB: return a - b;
+        case InstrId::SLL: return a << bits<5, 0>(b);
+        case InstrId::SLT: return static_cast<signed_reg_t>(a) < static_cast<signed_reg_t>(b);
+        case InstrId::SLTU: return a < b;
+        case InstrId::XOR: return a ^ b;
+        case InstrId::SRL: return a >> bits<5, 0>(b);
+        case InstrId::SRA: return static_cast<signed_reg_t>(a) >> bits<5, 0>(b);
+        case InstrId::OR: return a | b;
+        case InstrId::AND: return a & b;
+        case InstrId::ADDW: return sext<31>(a + b);
+        case InstrId::SLLW: return sext<31>(a << bits<4, 0>(b));
+        case InstrId::SRLW: return sext<31>(bits<31, 0>(a) >> bits<4, 0>(b));
+        case InstrId::SUBW: return sext<31>(a - b);
+        case InstrId::SRAW: return sext<31>(static_cast<signed_reg_t>(a) >> bits<4, 0>(b));
+
+        case InstrId::ADDI: return a + imm;
+        case InstrId::SLTI: return static_cast<signed_reg_t>(a) < static_cast<signed_reg_t>(imm);
+        case InstrId::SLTIU: return a < imm;
+        case InstrId::XORI: return a ^ imm;
+        case InstrId::ORI: return a | imm;
+        case InstrId::ANDI: return a & imm;
+        case InstrId::SLLI: return a << bits<5, 0>(imm);
+        case InstrId::SRLI: return a >> bits<5, 0>(imm);
+        case InstrId::SRAI: return static_cast<signed_reg_t>(a) >> bits<5, 0>(imm);
+        case InstrId::ADDIW: return sext<31>(a + imm);
+        case InstrId::SLLIW: return sext<31>(a << bits<4, 0>(imm));
+        case InstrId::SRLIW: return sext<31>(bits<31, 0>(a) >> bits<4, 0>(imm));
+        case InstrId::SRAIW: return sext<31>(static_cast<signed_reg_t>(a) >> bits<4, 0>(imm));
+
+        case InstrId::LUI: return imm;
+        case InstrId::AUIPC: return pc + imm;
+        default: return 0;
+    }
+}
+
+// known value of a register: a constant, or base as of its version plus an offset
+struct Value {
+    bool constant;
+    uint64_t imm;
+    uint8_t base;
+    uint32_t version;
+};
+
+struct Stats {
+    uint64_t blocks = 0;
+    uint64_t folded = 0;
+    uint64_t combined = 0;
+    uint64_t removed = 0;
+};
+
+class BlockState final {
+   private:
+    std::array<Value, kRegNum> m_values;
+    std::array<uint32_t, kRegNum> m_versions{};
+
+    Value own(uint8_t reg) const { return {false, 0, reg, m_versions[reg]}; }
+
+   public:
+    BlockState() {
+        for (uint8_t reg = 0; reg < kRegNum; ++reg) {
+            m_values[reg] = own(reg);
+        }
+        m_values[0] = {true, 0, 0, 0};
+    }
+
+    // a base overwritten since is forgotten, the register then only holds its own value
+    Value get(uint8_t reg) const {
+        const Value &value = m_values[reg];
+        if (!value.constant && m_versions[value.base] != value.version) {
+            return own(reg);
+        }
+        return value;
+    }
+
+    void set(uint8_t reg, Value value) {
+        if (reg == 0) {
+            return;
+        }
+        ++m_versions[reg];
+        m_values[reg] = !value.constant && value.base == reg ? own(reg) : value;
+    }
+
+    void set_unknown(uint8_t reg) {
+        if (reg != 0) {
+            ++m_versions[reg];
+            m_values[reg] = own(reg);
+        }
+    }
+};
+
+EncInstr make_li(uint8_t rd, uint64_t value) {
+    EncInstr li{InstrId::ADDI, rd, 0, 0};
+    li.imm = value;
+    return li;
+}
+
+EncInstr make_addi(uint8_t rd, uint8_t rs1, uint64_t imm) {
+    EncInstr addi{InstrId::ADDI, rd, rs1, 0};
+    addi.imm = imm;
+    return addi;
+}
+
+bool same_operands(const EncInstr &lhs, const EncInstr &rhs) {
+    return lhs.id == rhs.id && lhs.rd == rhs.rd && lhs.rs1 == rhs.rs1 && lhs.rs2 == rhs.rs2 &&
+           lhs.imm == rhs.imm;
+}
+
+// forward pass: constants and base + offset values
+void propagate(std::span<EncInstr> block, hart::addr_t pc, Stats &stats) {
+    BlockState state;
+    for (size_t i = 0; i < block.size(); ++i, pc += sizeof(instruction::instr_t)) {
+        EncInstr &instr = block[i];
+        const EncInstr original = instr;
+
+        if (is_load(instr.id) || is_store(instr.id)) {
+            Value base = state.get(instr.rs1);
+            instr.rs1 = base.constant ? 0 : base.base;
+            instr.imm += base.imm;
+            if (!same_operands(instr, original)) {
+                ++stats.combined;
+            }
+            if (is_load(instr.id)) {
+                state.set_unknown(instr.rd);
+            }
+        } else if (instr.id == InstrId::JAL || instr.id == InstrId::JALR) {
+            state.set(instr.rd, {true, pc + sizeof(instruction::instr_t), 0, 0});
+        } else if (instruction::is_system(instr.id) || instruction::is_atomic(instr.id)) {
+            state.set_unknown(instr.rd);
+        } else if (is_alu(instr.id)) {
+            Value a = state.get(instr.rs1);
+            Value b = state.get(instr.rs2);
+            bool r_type = is_r_type(instr.id);
+            bool constant = instr.id == InstrId::LUI || instr.id == InstrId::AUIPC ||
+                            (a.constant && (!r_type || b.constant));
+
+            if (constant) {
+                uint64_t value = fold(instr, a.imm, b.imm, pc);
+                instr = make_li(instr.rd, value);
+                if (!same_operands(instr, original) && original.id != InstrId::LUI) {
+                    ++stats.folded;
+                }
+                state.set(instr.rd, {true, value, 0, 0});
+                continue;
+            }
+
+            // rd = base + offset, either operand of an add may be the constant one
+            std::optional<Value> sum;
+            if (instr.id == InstrId::ADDI) {
+                sum = Value{false, a.imm + instr.imm, a.base, a.version};
+            } else if (instr.id == InstrId::ADD && (a.constant || b.constant)) {
+                const Value &base = a.constant ? b : a;
+                sum = Value{false, base.imm + (a.constant ? a.imm : b.imm), base.base,
+                            base.version};
+            }
+
+            if (sum) {
+                instr = make_addi(instr.rd, sum->base, sum->imm);
+                if (!same_operands(instr, original)) {
+                    ++stats.combined;
+                }
+                state.set(instr.rd, *sum);
+            } else {
+                state.set_unknown(instr.rd);
+            }
+        }
+    }
+}
+
+// backward pass: everything is live at the block exit and in front of anything that may trap
+void remove_dead_writes(std::span<EncInstr> block, Stats &stats) {
+    uint32_t live = kAllRegs;
+    for (size_t i = block.size(); i-- > 0;) {
+        EncInstr &instr = block[i];
+        // jumps trap on a misaligned target, which only jalr's isn't known up front
+        bool jump_may_trap = instr.id == InstrId::JALR ||
+                             (instruction::is_control_transfer(instr.id) &&
+                              instr.imm % sizeof(instruction::instr_t));
+        if (is_load(instr.id) || is_store(instr.id) || instruction::is_system(instr.id) ||
+            instruction::is_atomic(instr.id) || instr.id == InstrId::ILLEGAL || jump_may_trap) {
+            live = kAllRegs;
+            continue;
+        }
+        if (is_alu(instr.id) && instr.rd != 0 && !(live & reg_bit(instr.rd))) {
+            instr.variant = instruction::Variant::discard;
+            ++stats.removed;
+            continue;
+        }
+        if (instruction::writes_rd(instr.id) && instr.rd != 0) {
+            live &= ~reg_bit(instr.rd);
+        }
+        live |= sources(instr);
+    }
+}
+
+}  // namespace
+
+std::vector<EncInstr> optimize(const codecache::DecodedCode &decoded) {
+    std::vector<EncInstr> optimized = decoded.instrs;
+    Stats stats;
+
+    size_t start = 0;
+    while (start < optimized.size()) {
+        size_t len = decoded.block_len[start];
+        std::span<EncInstr> block{optimized.data() + start, len};
+
+        propagate(block, decoded.base + start * sizeof(instruction::instr_t), stats);
+        for (auto &instr : block) {
+            decoder::Decoder::select_variant(instr);
+        }
+        remove_dead_writes(block, stats);
+
+        ++stats.blocks;
+        start += len;
+    }
+
+    Logger::getInstance().message(
+        Logger::severity_level::standard, "BlockOpt",
+        fmt::format("{} blocks at {:#x}: {} constants folded, {} address computations combined, "
+                    "{} dead writes removed",
+                    stats.blocks, decoded.base, stats.folded, stats.combined, stats.removed));
+    return optimized;
+}
+
+Outcome evaluate(const EncInstr *block, size_t len, const hart::Hart &hart) {
+    Outcome outcome{hart.get_pc(), hart.get_pc(), 0, false, false, {}, {}};
+    auto regs = hart.get_regs();
+    std::copy(regs.begin(), regs.end(), outcome.regs.begin());
+
+    auto write = [&](uint8_t rd, uint64_t value) {
+        if (rd != 0) {
+            outcome.regs[rd] = value;
+        }
+    };
+
+    hart::addr_t pc = hart.get_pc();
+    for (size_t i = 0; i < len; ++i, ++outcome.retired) {
+        const EncInstr &instr = block[i];
+        const auto &r = outcome.regs;
+        hart::addr_t next_pc = pc + sizeof(instruction::instr_t);
+
+        if (is_alu(instr.id)) {
+            if (instr.variant != instruction::Variant::discard) {
+                write(instr.rd, fold(instr, r[instr.rs1], r[instr.rs2], pc));
+            }
+        } else if (is_load(instr.id) || is_store(instr.id)) {
+            hart::addr_t addr = r[instr.rs1] + instr.imm;
+            unsigned size = access_size(instr.id);
+            if (addr & (size - 1)) {
+                outcome.trapped = true;
+                break;
+            }
+            if (addr > hart.memory_size() - size || hart.translates_data()) {
+                // traps unless a device answers, or goes through the page tables, neither of
+                // which is repeated here
+                outcome.unchecked = true;
+                break;
+            }
+
+            if (is_store(instr.id)) {
+                for (unsigned byte = 0; byte < size; ++byte) {
+                    outcome.stored[addr + byte] = r[instr.rs2] >> (8 * byte);
+                }
+            } else {
+                uint8_t bytes[8];
+                hart.read_memory(addr, bytes, size);
+                for (unsigned byte = 0; byte < size; ++byte) {
+                    if (auto it = outcome.stored.find(addr + byte); it != outcome.stored.end()) {
+                        bytes[byte] = it->second;
+                    }
+                }
+                uint64_t value = 0;
+                std::memcpy(&value, bytes, size);
+                switch (instr.id) {
+                    case InstrId::LB: value = decoder::sext<7>(value); break;
+                    case InstrId::LH: value = decoder::sext<15>(value); break;
+                    case InstrId::LW: value = decoder::sext<31>(value); break;
+                    default: break;
+                }
+                write(instr.rd, value);
+            }
+        } else if (instr.id >= InstrId::BEQ && instr.id <= InstrId::BGEU) {
+            uint64_t a = r[instr.rs1], b = r[instr.rs2];
+            auto sa = static_cast<hart::signed_reg_t>(a), sb = static_cast<hart::signed_reg_t>(b);
+            bool taken = instr.id == InstrId::BEQ    ? a == b
+                         : instr.id == InstrId::BNE  ? a != b
+                         : instr.id == InstrId::BLT  ? sa < sb
+                         : instr.id == InstrId::BGE  ? sa >= sb
+                         : instr.id == InstrId::BLTU ? a < b
+                                                     : a >= b;
+            if (taken) {
+                if ((pc + instr.imm) % sizeof(instruction::instr_t)) {
+                    outcome.trapped = true;
+                    break;
+                }
+                next_pc = pc + instr.imm;
+            }
+        } else if (instr.id == InstrId::JAL || instr.id == InstrId::JALR) {
+            // a misaligned target traps before rd is written, like the interpreter
+            hart::addr_t target = instr.id == InstrId::JAL
+                                      ? pc + instr.imm
+                                      : (r[instr.rs1] + instr.imm) & ~uint64_t(1);
+            if (target % sizeof(instruction::instr_t)) {
+                outcome.trapped = true;
+                break;
+            }
+            write(instr.rd, next_pc);
+            next_pc = target;
+        } else if (instruction::is_system(instr.id) || instruction::is_atomic(instr.id)) {
+            outcome.unchecked = true;
+            break;
+        } else {
+            outcome.trapped = true;
+            break;
+        }
+        pc = next_pc;
+    }
+
+    outcome.next_pc = pc;
+    return outcome;
+}
+
+void check(const Outcome &optimized, const hart::Hart &hart, uint64_t retired, bool trapped) {
+    auto fail = [&](const std::string &what) {
+        throw std::runtime_error{fmt::format(
+            "Optimized block at {:#x} diverges from the decoded one: {}", optimized.pc, what)};
+    };
+
+    if (optimized.unchecked) {
+        return;
+    }
+    if (optimized.trapped != trapped || optimized.retired != retired) {
+        fail(fmt::format("{} after {} instructions instead of {} after {}",
+                         optimized.trapped ? "trapped" : "completed", optimized.retired,
+                         trapped ? "trapping" : "completing", retired));
+    }
+    for (size_t reg = 0; reg < kRegNum; ++reg) {
+        if (optimized.regs[reg] != hart.get_reg(reg)) {
+            fail(fmt::format("{} is {:#x} instead of {:#x}", hart::g_reg_names[reg],
+                             optimized.regs[reg], hart.get_reg(reg)));
+        }
+    }
+    if (optimized.next_pc != hart.get_pc()) {
+        fail(fmt::format("pc is {:#x} instead of {:#x}", optimized.next_pc, hart.get_pc()));
+    }
+    for (const auto &[addr, value] : optimized.stored) {
+        uint8_t actual;
+        hart.read_memory(addr, &actual, 1);
+        if (actual != value) {
+            fail(fmt::format("byte at {:#x} is {:#x} instead of {:#x}", addr, value, actual));
+        }
+    }
+}
+
+}  // namespace blockopt
@@ -0,0 +1,208 @@
+#include "code_cache.hpp"
+
+#include <fmt/format.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "block_opt.hpp"
+#include "decoder.hpp"
+#include "hash.hpp"
+#include "logger.hpp"
+
+namespace codecache {
+
+namespace {
+
+constexpr char kMagic[4] = {'R', 'V', 'D', 'C'};
+constexpr uint32_t kVersion = 3;
+
+// below this many instructions per thread starting threads costs more than decoding
+constexpr size_t kMinChunkInstrs = 0x4000;
+
+#pragma pack(push, 1)
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint64_t base;
+    uint64_t count;
+};
+
+struct FileRecord {
+    uint8_t id;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint64_t imm;
+};
+#pragma pack(pop)
+
+bool read_file(const std::string &file, DecodedCode &decoded, size_t count) {
+    std::ifstream in{file, std::ios::binary};
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.hash != decoded.hash || header.base != decoded.base || header.count != count) {
+        return false;
+    }
+
+    std::vector<FileRecord> records(count);
+    if (!in.read(reinterpret_cast<char *>(records.data()), count * sizeof(FileRecord))) {
+        return false;
+    }
+
+    decoded.instrs.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (records[i].id > instruction::InstrId::ILLEGAL) {
+            return false;
+        }
+        auto &instr = decoded.instrs[i];
+        instr.id = static_cast<instruction::InstrId>(records[i].id);
+        instr.rd = records[i].rd;
+        instr.rs1 = records[i].rs1;
+        instr.rs2 = records[i].rs2;
+        instr.imm = records[i].imm;
+        // not stored, the file stays valid when variants are added
+        decoder::Decoder::select_variant(instr);
+    }
+    return true;
+}
+
+// written next to the final name first, so concurrent readers never see a partial file
+void write_file(const std::string &file, const DecodedCode &decoded) {
+    std::string tmp_file = fmt::format("{}.{}.tmp", file, static_cast<const void *>(&decoded));
+    {
+        std::ofstream out{tmp_file, std::ios::binary};
+        FileHeader header{{}, kVersion, decoded.hash, decoded.base, decoded.instrs.size()};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        for (const auto &instr : decoded.instrs) {
+            FileRecord record{static_cast<uint8_t>(instr.id), instr.rd, instr.rs1, instr.rs2,
+                              instr.imm};
+            out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+        }
+        if (!out) {
+            std::remove(tmp_file.c_str());
+            return;
+        }
+    }
+    std::rename(tmp_file.c_str(), file.c_str());
+}
+
+}  // namespace
+
+CodeStore &CodeStore::getInstance() {
+    static CodeStore instance;
+    return instance;
+}
+
+void CodeStore::split_blocks(DecodedCode &decoded) {
+    size_t count = decoded.instrs.size();
+    decoded.block_len.resize(count);
+
+    for (size_t i = count; i-- > 0;) {
+        auto id = decoded.instrs[i].id;
+        bool ends_block = instruction::is_control_transfer(id) || instruction::is_system(id) ||
+                          id == instruction::InstrId::ILLEGAL || i + 1 == count;
+        decoded.block_len[i] = ends_block ? 1 : decoded.block_len[i + 1] + 1;
+    }
+}
+
+// every chunk is decoded by its own thread into its own slice of instrs, data words in the
+// text decode to ILLEGAL and only trap if they are ever run
+void CodeStore::decode(std::span<const uint8_t> code, DecodedCode &decoded, bool parallel) const {
+    size_t count = code.size() / sizeof(instruction::instr_t);
+    decoded.instrs.resize(count);
+
+    auto decode_chunk = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            instruction::instr_t raw;
+            std::memcpy(&raw, code.data() + i * sizeof(raw), sizeof(raw));
+            decoder::Decoder::decode_instruction(raw, decoded.instrs[i]);
+        }
+    };
+
+    size_t threads = parallel ? m_decode_threads.load() : 1;
+    size_t chunk = std::max(kMinChunkInstrs, (count + threads - 1) / threads);
+    if (chunk >= count) {
+        decode_chunk(0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        workers.emplace_back(decode_chunk, begin, std::min(count, begin + chunk));
+    }
+    decode_chunk(0, chunk);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+std::unique_ptr<DecodedCode> CodeStore::build(std::span<const uint8_t> code, uint64_t base,
+                                              uint64_t hash,
+                                              const std::string &persist_file,
+                                              bool parallel) const {
+    auto decoded = std::make_unique<DecodedCode>(DecodedCode{.hash = hash, .base = base});
+    size_t count = code.size() / sizeof(instruction::instr_t);
+
+    bool persistent = m_persistent && !persist_file.empty();
+    if (!persistent || !read_file(persist_file, *decoded, count)) {
+        decode(code, *decoded, parallel);
+        if (persistent) {
+            write_file(persist_file, *decoded);
+        }
+    }
+    split_blocks(*decoded);
+
+    // cheap next to decoding, so the optimized blocks aren't persisted
+    BlockOpt block_opt = m_block_opt;
+    if (block_opt != BlockOpt::off) {
+        decoded->optimized = blockopt::optimize(*decoded);
+        decoded->verify_optimized = block_opt == BlockOpt::verify;
+    }
+    return decoded;
+}
+
+const DecodedCode *CodeStore::get(std::span<const uint8_t> code, uint64_t base,
+                                  const std::string &persist_file, bool parallel) {
+    uint64_t hash = hashing::hash_bytes(code);
+    size_t count = code.size() / sizeof(instruction::instr_t);
+
+    auto matches = [&](const DecodedCode *decoded) {
+        return decoded->hash == hash && decoded->base == base && decoded->instrs.size() == count;
+    };
+
+    std::unique_ptr<DecodedCode> built;
+    size_t first_slot = (hash ^ (base * 0x9e3779b97f4a7c15)) % kSlots;
+    for (size_t probe = 0; probe < kSlots; ++probe) {
+        auto &slot = m_slots[(first_slot + probe) % kSlots];
+
+        const DecodedCode *published = slot.load(std::memory_order_acquire);
+        if (!published) {
+            if (!built) {
+                built = build(code, base, hash, persist_file, parallel);
+            }
+            // on failure another hart published first, published is reloaded with its code
+            if (slot.compare_exchange_strong(published, built.get(), std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                Logger::getInstance().message(
+                    Logger::severity_level::standard, "CodeStore",
+                    fmt::format("decoded {} instructions at {:#x}", count, base));
+                return built.release();
+            }
+        }
+
+        if (matches(published)) {
+            return published;
+        }
+    }
+
+    return nullptr;
+}
+
+}  // namespace codecache
@@ -1,31 +1,26 @@
 #include "decoder.hpp"
 
-#include <fmt/format.h>
-
 #include <array>
-#include <iostream>
-#include <sstream>
-#include <stdexcept>
 
 #include "instruction.hpp"
-#include "logger.hpp"
 
 namespace decoder {
 
 const std::array<instruction::instr_t, kOpcodeNum> Decoder::m_mask{{
     [0b0000011] = 0x707f,  // LOAD
-    // [0b0001111] = 0x707f,      // MISC-MEM
+    [0b0001111] = 0x707f,      // MISC-MEM
     [0b0010011] = 0x707f,      // OP-IMM
     [0b0011011] = 0x707f,      // OP-IMM-32
     [0b0010111] = 0x7f,        // AUIPC
     [0b0100011] = 0x707f,      // STORE
+    [0b0101111] = 0xf800707f,  // AMO
     [0b0110011] = 0xfe00707f,  // OP
     [0b0110111] = 0x7f,        // LUI
     [0b0111011] = 0xfe00707f,  // OP-32
     [0b1100011] = 0x707f,      // BRANCH
     [0b1100111] = 0x707f,      // JALR
     [0b1101111] = 0x7f,        // JAL
-    // [0b1110011] = 0x707f,      // SYSTEM
+    [0b1110011] = 0x707f,      // SYSTEM
 }};
 
 enum class Decoder::Match : instruction::instr_t {  // MATCH
@@ -93,13 +88,42 @@ enum class Decoder::Match : instruction::instr_t {  // MATCH
     SUB = 0x40000033,
     SRA = 0x40005033,
 
+    // AMO, the aq and rl bits are masked out
+    LR_W = 0x1000202f,
+    SC_W = 0x1800202f,
+    AMOSWAP_W = 0x800202f,
+    AMOADD_W = 0x202f,
+    AMOXOR_W = 0x2000202f,
+    AMOAND_W = 0x6000202f,
+    AMOOR_W = 0x4000202f,
+    AMOMIN_W = 0x8000202f,
+    AMOMAX_W = 0xa000202f,
+    AMOMINU_W = 0xc000202f,
+    AMOMAXU_W = 0xe000202f,
+    LR_D = 0x1000302f,
+    SC_D = 0x1800302f,
+    AMOSWAP_D = 0x800302f,
+    AMOADD_D = 0x302f,
+    AMOXOR_D = 0x2000302f,
+    AMOAND_D = 0x6000302f,
+    AMOOR_D = 0x4000302f,
+    AMOMIN_D = 0x8000302f,
+    AMOMAX_D = 0xa000302f,
+    AMOMINU_D = 0xc000302f,
+    AMOMAXU_D = 0xe000302f,
+
     // MISC-MEM
-    // FENCE = 0xf,
-    // FENCE_I = 0x100f,
+    FENCE = 0xf,
+    FENCE_I = 0x100f,
 
     // SYSTEM
-    // ECALL = 0x73,
-    // EBREAK = 0x100073,
+    PRIV = 0x73,  // ECALL, EBREAK, MRET, SRET, WFI and SFENCE.VMA, told apart by decode_priv
+    CSRRW = 0x1073,
+    CSRRS = 0x2073,
+    CSRRC = 0x3073,
+    CSRRWI = 0x5073,
+    CSRRSI = 0x6073,
+    CSRRCI = 0x7073,
 
     // OP-32
     ADDW = 0x3b,
@@ -145,8 +169,46 @@ void Decoder::decode_j_type(instruction::instr_t raw_instr, instruction::EncInst
     enc_instr.rd = bits<11, 7>(raw_instr);
 }
 
+void Decoder::decode_csr(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr) {
+    enc_instr.imm = bits<31, 20>(raw_instr);
+    enc_instr.rs1 = bits<19, 15>(raw_instr);
+    enc_instr.rd = bits<11, 7>(raw_instr);
+}
+
+void Decoder::decode_priv(instruction::instr_t raw_instr, instruction::EncInstr &enc_instr) {
+    constexpr instruction::instr_t kSfenceVmaMask = 0xfe007fff;
+    constexpr instruction::instr_t kSfenceVma = 0x12000073;
+
+    switch (raw_instr) {
+        case 0x00000073:
+            enc_instr.id = instruction::InstrId::ECALL;
+            return;
+        case 0x00100073:
+            enc_instr.id = instruction::InstrId::EBREAK;
+            return;
+        case 0x10200073:
+            enc_instr.id = instruction::InstrId::SRET;
+            return;
+        case 0x30200073:
+            enc_instr.id = instruction::InstrId::MRET;
+            return;
+        case 0x10500073:
+            enc_instr.id = instruction::InstrId::WFI;
+            return;
+        default:
+            break;
+    }
+    if ((raw_instr & kSfenceVmaMask) == kSfenceVma) {
+        enc_instr.id = instruction::InstrId::SFENCE_VMA;
+        decode_r_type(raw_instr, enc_instr);
+        return;
+    }
+    enc_instr.id = instruction::InstrId::ILLEGAL;
+    enc_instr.imm = raw_instr;
+}
+
 void Decoder::decode_instruction(instruction::instr_t raw_instr,
-                                 instruction::EncInstr &enc_instr) try {
+                                 instruction::EncInstr &enc_instr) {
     auto opcode = bits<6, 0>(raw_instr);
 
     instruction::instr_t match = raw_instr & m_mask[opcode];
@@ -407,24 +469,258 @@ void Decoder::decode_instruction(instruction::instr_t raw_instr,
             decode_j_type(raw_instr, enc_instr);
             break;
         }
-            // case Match::ECALL:
-            // case Match::EBREAK:
-            // case Match::FENCE:
-            // case Match::FENCE_I:
+
+        // AMO, lr has no rs2 field
+        case Match::LR_W: {
+            enc_instr.id = instruction::InstrId::LR_W;
+            decode_r_type(raw_instr, enc_instr);
+            if (enc_instr.rs2 != 0) {
+                enc_instr.id = instruction::InstrId::ILLEGAL;
+                enc_instr.imm = raw_instr;
+            }
+            break;
+        }
+        case Match::SC_W: {
+            enc_instr.id = instruction::InstrId::SC_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOSWAP_W: {
+            enc_instr.id = instruction::InstrId::AMOSWAP_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOADD_W: {
+            enc_instr.id = instruction::InstrId::AMOADD_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOXOR_W: {
+            enc_instr.id = instruction::InstrId::AMOXOR_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOAND_W: {
+            enc_instr.id = instruction::InstrId::AMOAND_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOOR_W: {
+            enc_instr.id = instruction::InstrId::AMOOR_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMIN_W: {
+            enc_instr.id = instruction::InstrId::AMOMIN_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMAX_W: {
+            enc_instr.id = instruction::InstrId::AMOMAX_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMINU_W: {
+            enc_instr.id = instruction::InstrId::AMOMINU_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMAXU_W: {
+            enc_instr.id = instruction::InstrId::AMOMAXU_W;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::LR_D: {
+            enc_instr.id = instruction::InstrId::LR_D;
+            decode_r_type(raw_instr, enc_instr);
+            if (enc_instr.rs2 != 0) {
+                enc_instr.id = instruction::InstrId::ILLEGAL;
+                enc_instr.imm = raw_instr;
+            }
+            break;
+        }
+        case Match::SC_D: {
+            enc_instr.id = instruction::InstrId::SC_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOSWAP_D: {
+            enc_instr.id = instruction::InstrId::AMOSWAP_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOADD_D: {
+            enc_instr.id = instruction::InstrId::AMOADD_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOXOR_D: {
+            enc_instr.id = instruction::InstrId::AMOXOR_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOAND_D: {
+            enc_instr.id = instruction::InstrId::AMOAND_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOOR_D: {
+            enc_instr.id = instruction::InstrId::AMOOR_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMIN_D: {
+            enc_instr.id = instruction::InstrId::AMOMIN_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMAX_D: {
+            enc_instr.id = instruction::InstrId::AMOMAX_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMINU_D: {
+            enc_instr.id = instruction::InstrId::AMOMINU_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+        case Match::AMOMAXU_D: {
+            enc_instr.id = instruction::InstrId::AMOMAXU_D;
+            decode_r_type(raw_instr, enc_instr);
+            break;
+        }
+
+        // MISC-MEM, harts see their own stores in order and stores into the text are caught
+        // when they happen, so both fences are nops
+        case Match::FENCE:
+        case Match::FENCE_I: {
+            enc_instr.id = instruction::InstrId::FENCE;
+            break;
+        }
+
+        // SYSTEM
+        case Match::PRIV: {
+            decode_priv(raw_instr, enc_instr);
+            break;
+        }
+        case Match::CSRRW: {
+            enc_instr.id = instruction::InstrId::CSRRW;
+            decode_csr(raw_instr, enc_instr);
+            break;
+        }
+        case Match::CSRRS: {
+            enc_instr.id = instruction::InstrId::CSRRS;
+            decode_csr(raw_instr, enc_instr);
+            break;
+        }
+        case Match::CSRRC: {
+            enc_instr.id = instruction::InstrId::CSRRC;
+            decode_csr(raw_instr, enc_instr);
+            break;
+        }
+        case Match::CSRRWI: {
+            enc_instr.id = instruction::InstrId::CSRRWI;
+            decode_csr(raw_instr, enc_instr);
+            break;
+        }
+        case Match::CSRRSI: {
+            enc_instr.id = instruction::InstrId::CSRRSI;
+            decode_csr(raw_instr, enc_instr);
+            break;
+        }
+        case Match::CSRRCI: {
+            enc_instr.id = instruction::InstrId::CSRRCI;
+            decode_csr(raw_instr, enc_instr);
+            break;
+        }
+
         default: {
-            std::ostringstream oss{};
-            oss << std::hex << std::to_string(match);
-            throw std::runtime_error("Match with unknown instruction : " + oss.str());
+            enc_instr.id = instruction::InstrId::ILLEGAL;
+            enc_instr.imm = raw_instr;
+            break;
         }
     }
 
-    Logger &myLogger = Logger::getInstance();
-    myLogger.message(
-        Logger::severity_level::standard, "Decoder",
-        fmt::format("Match {} {:#08x}", instruction::InstrName[enc_instr.id], raw_instr));
+    select_variant(enc_instr);
+}
+
+void Decoder::select_variant(instruction::EncInstr &enc_instr) {
+    using instruction::InstrId;
+    using instruction::Variant;
+
+    enc_instr.variant = Variant::generic;
+    if (!instruction::writes_rd(enc_instr.id) || instruction::is_system(enc_instr.id) ||
+        instruction::is_atomic(enc_instr.id)) {
+        return;
+    }
+    if (enc_instr.rd == 0) {
+        enc_instr.variant = Variant::discard;
+        return;
+    }
+
+    bool rs1_zero = enc_instr.rs1 == 0;
+    bool rs2_zero = enc_instr.rs2 == 0;
+    bool same = enc_instr.rs1 == enc_instr.rs2;
+    auto pick = [&](bool condition, Variant variant) {
+        if (condition && enc_instr.variant == Variant::generic) {
+            enc_instr.variant = variant;
+        }
+    };
+
+    switch (enc_instr.id) {
+        case InstrId::ADD:
+            pick(rs2_zero, Variant::move);
+            break;
+        case InstrId::SUB:
+        case InstrId::XOR:
+            pick(same, Variant::zero);
+            pick(rs2_zero, Variant::move);
+            break;
+        case InstrId::OR:
+            pick(same || rs2_zero, Variant::move);
+            break;
+        case InstrId::AND:
+            pick(rs1_zero || rs2_zero, Variant::zero);
+            pick(same, Variant::move);
+            break;
+        case InstrId::SLT:
+        case InstrId::SLTU:
+        case InstrId::SUBW:
+            pick(same, Variant::zero);
+            break;
+        case InstrId::SLL:
+        case InstrId::SRL:
+        case InstrId::SRA:
+            pick(rs1_zero, Variant::zero);
+            pick(rs2_zero, Variant::move);
+            break;
 
-} catch (const std::invalid_argument &e) {
-    std::cerr << e.what() << std::endl;
+        case InstrId::ADDI:
+        case InstrId::ORI:
+        case InstrId::XORI:
+            pick(rs1_zero, Variant::load_imm);
+            pick(enc_instr.imm == 0, Variant::move);
+            break;
+        case InstrId::ADDIW:
+            // the 12 bit immediate is already sign extended from bit 31 on
+            pick(rs1_zero, Variant::load_imm);
+            break;
+        case InstrId::ANDI:
+            pick(rs1_zero || enc_instr.imm == 0, Variant::zero);
+            break;
+        case InstrId::SLLI:
+        case InstrId::SRLI:
+        case InstrId::SRAI:
+            pick(rs1_zero, Variant::zero);
+            pick(bits<5, 0>(enc_instr.imm) == 0, Variant::move);
+            break;
+        case InstrId::LUI:
+            enc_instr.variant = Variant::load_imm;
+            break;
+
+        default:
+            break;
+    }
 }
 
 }  // namespace decoder
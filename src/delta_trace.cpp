@@ -0,0 +1,204 @@
+#include "delta_trace.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace trace {
+
+// header: magic, version, keyframe interval
+// footer: (index, offset) per keyframe, instructions, keyframes count, keyframes offset, magic
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+constexpr size_t kFooterTailSize = 3 * sizeof(uint64_t) + sizeof(uint32_t);
+
+DeltaTrace::DeltaTrace(const std::string &trace_file, uint64_t keyframe_interval)
+    : m_out(trace_file, std::ios::binary), m_keyframe_interval(keyframe_interval) {
+    if (!m_out) {
+        throw std::runtime_error{fmt::format("Can't open trace file {}", trace_file)};
+    }
+    if (m_keyframe_interval == 0) {
+        throw std::runtime_error{"Trace keyframe interval must be positive"};
+    }
+
+    m_buffer.reserve(kFlushThreshold + 4096);
+    put(kMagic);
+    put(kVersion);
+    put(m_keyframe_interval);
+}
+
+DeltaTrace::~DeltaTrace() { finish(); }
+
+void DeltaTrace::flush() {
+    m_out.write(reinterpret_cast<const char *>(m_buffer.data()), m_buffer.size());
+    m_offset += m_buffer.size();
+    m_buffer.clear();
+}
+
+void DeltaTrace::begin_instruction(uint64_t pc, std::span<const uint64_t, kRegNum> regs) {
+    if (m_index % m_keyframe_interval == 0) {
+        m_keyframes.emplace_back(m_index, m_offset + m_buffer.size());
+        put(Tag::keyframe);
+        put(pc);
+        for (auto reg : regs) {
+            put(reg);
+        }
+    } else {
+        put(Tag::step);
+        put(pc);
+    }
+    ++m_index;
+
+    if (m_buffer.size() >= kFlushThreshold) {
+        flush();
+    }
+}
+
+void DeltaTrace::finish() {
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    put(Tag::end);
+    uint64_t keyframes_offset = m_offset + m_buffer.size();
+    for (auto [index, offset] : m_keyframes) {
+        put(index);
+        put(offset);
+    }
+    put(m_index);
+    put(static_cast<uint64_t>(m_keyframes.size()));
+    put(keyframes_offset);
+    put(kMagic);
+
+    flush();
+    m_out.flush();
+}
+
+DeltaTraceReader::DeltaTraceReader(const std::string &trace_file) {
+    std::ifstream in(trace_file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error{fmt::format("Can't open trace file {}", trace_file)};
+    }
+    m_data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    if (m_data.size() < kHeaderSize + sizeof(Tag) + kFooterTailSize) {
+        throw std::runtime_error{fmt::format("Trace file {} is truncated", trace_file)};
+    }
+
+    uint64_t pos = 0;
+    if (get<uint32_t>(pos) != kMagic || get<uint32_t>(pos) != kVersion) {
+        throw std::runtime_error{fmt::format("{} is not a delta trace", trace_file)};
+    }
+    m_keyframe_interval = get<uint64_t>(pos);
+
+    pos = m_data.size() - kFooterTailSize;
+    m_instructions = get<uint64_t>(pos);
+    uint64_t keyframes = get<uint64_t>(pos);
+    uint64_t keyframes_offset = get<uint64_t>(pos);
+    // the keyframe table sits right in front of the footer tail
+    uint64_t table_end = m_data.size() - kFooterTailSize;
+    if (get<uint32_t>(pos) != kMagic || keyframes_offset < kHeaderSize ||
+        keyframes_offset > table_end ||
+        (table_end - keyframes_offset) / (2 * sizeof(uint64_t)) != keyframes ||
+        (table_end - keyframes_offset) % (2 * sizeof(uint64_t)) != 0) {
+        throw std::runtime_error{fmt::format("Trace file {} has no valid footer", trace_file)};
+    }
+
+    m_records_end = keyframes_offset;
+    pos = keyframes_offset;
+    for (uint64_t i = 0; i < keyframes; ++i) {
+        uint64_t index = get<uint64_t>(pos);
+        uint64_t offset = get<uint64_t>(pos);
+        // seeking relies on the first keyframe at instruction 0 and on ascending entries
+        bool ordered = m_keyframes.empty() ? index == 0
+                                           : index > m_keyframes.back().first &&
+                                                 offset > m_keyframes.back().second;
+        if (!ordered || offset < kHeaderSize || offset >= m_records_end) {
+            throw std::runtime_error{
+                fmt::format("Trace file {} has an invalid keyframe {}", trace_file, i)};
+        }
+        m_keyframes.emplace_back(index, offset);
+    }
+    if (m_instructions != 0 && m_keyframes.empty()) {
+        throw std::runtime_error{fmt::format("Trace file {} has no keyframes", trace_file)};
+    }
+}
+
+TraceState DeltaTraceReader::state_at(uint64_t index, InstrChanges *changes) const {
+    if (index >= m_instructions) {
+        throw std::out_of_range{
+            fmt::format("Instruction {} is out of trace with {} instructions", index,
+                        m_instructions)};
+    }
+
+    auto keyframe = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), index,
+                                     [](uint64_t value, const auto &entry) {
+                                         return value < entry.first;
+                                     }) -
+                    1;
+
+    TraceState state{};
+    state.index = index;
+
+    uint64_t pos = keyframe->second;
+    uint64_t next = keyframe->first;  // index of the instruction whose record comes next
+
+    while (pos < m_records_end) {
+        uint64_t record = pos;
+        auto tag = get<Tag>(pos);
+
+        switch (tag) {
+            case Tag::step:
+            case Tag::keyframe: {
+                uint64_t current = next++;
+                if (current > index) {
+                    return state;
+                }
+
+                state.pc = get<uint64_t>(pos);
+                if (tag == Tag::keyframe) {
+                    for (auto &reg : state.regs) {
+                        reg = get<uint64_t>(pos);
+                    }
+                }
+                if (current == index && changes == nullptr) {
+                    return state;
+                }
+                break;
+            }
+            case Tag::reg: {
+                auto reg_id = get<uint8_t>(pos);
+                auto value = get<uint64_t>(pos);
+                if (reg_id >= kRegNum) {
+                    throw std::runtime_error{
+                        fmt::format("Corrupted trace record at {}", record)};
+                }
+                if (next - 1 < index) {
+                    state.regs[reg_id] = value;
+                } else {
+                    changes->regs.push_back({reg_id, value});
+                }
+                break;
+            }
+            case Tag::mem: {
+                auto size = get<uint8_t>(pos);
+                auto addr = get<uint64_t>(pos);
+                auto value = get<uint64_t>(pos);
+                if (next - 1 == index) {
+                    changes->mem.push_back({addr, size, value});
+                }
+                break;
+            }
+            case Tag::end:
+                return state;
+            default:
+                throw std::runtime_error{fmt::format("Corrupted trace record at {}", record)};
+        }
+    }
+
+    return state;
+}
+
+}  // namespace trace
@@ -0,0 +1,184 @@
+#include "disasm.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+
+#include "csr.hpp"
+
+namespace disasm {
+
+namespace {
+
+std::string_view reg(uint8_t reg_id) { return hart::g_reg_names[reg_id]; }
+
+int64_t signed_imm(uint64_t imm) { return static_cast<int64_t>(imm); }
+
+std::string csr_name(uint64_t csr) {
+    std::string_view name = csr::name(csr);
+    return name.empty() ? fmt::format("{:#x}", csr) : std::string{name};
+}
+
+}  // namespace
+
+std::string mnemonic(instruction::InstrId id) {
+    std::string name{instruction::InstrName[id]};
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return name;
+}
+
+std::string format_target(hart::addr_t addr, const SymbolTable &symbols) {
+    auto it = symbols.upper_bound(addr);
+    if (it == symbols.begin()) {
+        return fmt::format("{:#x}", addr);
+    }
+    --it;
+    if (it->first == addr) {
+        return fmt::format("{:#x} <{}>", addr, it->second);
+    }
+    return fmt::format("{:#x} <{}+{:#x}>", addr, it->second, addr - it->first);
+}
+
+std::string format_instruction(const instruction::EncInstr &instr, hart::addr_t pc,
+                               const SymbolTable &symbols) {
+    using instruction::InstrId;
+
+    auto name = mnemonic(instr.id);
+
+    switch (instr.id) {
+        // R - type
+        case InstrId::ADD:
+        case InstrId::SUB:
+        case InstrId::SLL:
+        case InstrId::SLT:
+        case InstrId::SLTU:
+        case InstrId::XOR:
+        case InstrId::SRL:
+        case InstrId::SRA:
+        case InstrId::OR:
+        case InstrId::AND:
+        case InstrId::ADDW:
+        case InstrId::SLLW:
+        case InstrId::SRLW:
+        case InstrId::SUBW:
+        case InstrId::SRAW:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rd), reg(instr.rs1),
+                               reg(instr.rs2));
+
+        // I - type
+        case InstrId::JALR:
+        case InstrId::LB:
+        case InstrId::LH:
+        case InstrId::LW:
+        case InstrId::LBU:
+        case InstrId::LHU:
+        case InstrId::LWU:
+        case InstrId::LD:
+            return fmt::format("{} {}, {}({})", name, reg(instr.rd), signed_imm(instr.imm),
+                               reg(instr.rs1));
+        case InstrId::ADDI:
+        case InstrId::SLTI:
+        case InstrId::SLTIU:
+        case InstrId::XORI:
+        case InstrId::ORI:
+        case InstrId::ANDI:
+        case InstrId::ADDIW:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rd), reg(instr.rs1),
+                               signed_imm(instr.imm));
+        case InstrId::SLLI:
+        case InstrId::SRLI:
+        case InstrId::SRAI:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rd), reg(instr.rs1),
+                               instr.imm & 0x3f);
+        case InstrId::SLLIW:
+        case InstrId::SRLIW:
+        case InstrId::SRAIW:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rd), reg(instr.rs1),
+                               instr.imm & 0x1f);
+
+        // S - type
+        case InstrId::SB:
+        case InstrId::SH:
+        case InstrId::SW:
+        case InstrId::SD:
+            return fmt::format("{} {}, {}({})", name, reg(instr.rs2), signed_imm(instr.imm),
+                               reg(instr.rs1));
+
+        // B - type
+        case InstrId::BEQ:
+        case InstrId::BNE:
+        case InstrId::BLT:
+        case InstrId::BGE:
+        case InstrId::BLTU:
+        case InstrId::BGEU:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rs1), reg(instr.rs2),
+                               format_target(pc + instr.imm, symbols));
+
+        // U - type
+        case InstrId::LUI:
+        case InstrId::AUIPC:
+            return fmt::format("{} {}, {:#x}", name, reg(instr.rd), (instr.imm >> 12) & 0xfffff);
+
+        // J - type
+        case InstrId::JAL:
+            return fmt::format("{} {}, {}", name, reg(instr.rd),
+                               format_target(pc + instr.imm, symbols));
+
+        // A - extension
+        case InstrId::LR_W:
+        case InstrId::LR_D:
+            return fmt::format("{} {}, ({})", name, reg(instr.rd), reg(instr.rs1));
+        case InstrId::SC_W:
+        case InstrId::AMOSWAP_W:
+        case InstrId::AMOADD_W:
+        case InstrId::AMOXOR_W:
+        case InstrId::AMOAND_W:
+        case InstrId::AMOOR_W:
+        case InstrId::AMOMIN_W:
+        case InstrId::AMOMAX_W:
+        case InstrId::AMOMINU_W:
+        case InstrId::AMOMAXU_W:
+        case InstrId::SC_D:
+        case InstrId::AMOSWAP_D:
+        case InstrId::AMOADD_D:
+        case InstrId::AMOXOR_D:
+        case InstrId::AMOAND_D:
+        case InstrId::AMOOR_D:
+        case InstrId::AMOMIN_D:
+        case InstrId::AMOMAX_D:
+        case InstrId::AMOMINU_D:
+        case InstrId::AMOMAXU_D:
+            return fmt::format("{} {}, {}, ({})", name, reg(instr.rd), reg(instr.rs2),
+                               reg(instr.rs1));
+
+        // system
+        case InstrId::FENCE:
+        case InstrId::ECALL:
+        case InstrId::EBREAK:
+        case InstrId::MRET:
+        case InstrId::SRET:
+        case InstrId::WFI:
+            return name;
+        case InstrId::SFENCE_VMA:
+            return fmt::format("{} {}, {}", name, reg(instr.rs1), reg(instr.rs2));
+        case InstrId::CSRRW:
+        case InstrId::CSRRS:
+        case InstrId::CSRRC:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rd), csr_name(instr.imm),
+                               reg(instr.rs1));
+        case InstrId::CSRRWI:
+        case InstrId::CSRRSI:
+        case InstrId::CSRRCI:
+            return fmt::format("{} {}, {}, {}", name, reg(instr.rd), csr_name(instr.imm),
+                               instr.rs1);
+
+        case InstrId::ILLEGAL:
+            break;
+    }
+
+    return fmt::format(".word {:#010x}", instr.imm);
+}
+
+}  // namespace disasm
@@ -0,0 +1,63 @@
+#include "embed.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+
+namespace embed {
+
+Instance::Instance(hart::Hart &&hart) : m_hart(std::move(hart)) {
+    // resets only copy back what the guest or the host wrote since the last one
+    m_hart.track_dirty_pages();
+    m_initial = m_hart.snapshot();
+}
+
+memory::Memory Instance::make_memory(const Options &options) {
+    if (options.host_memory) {
+        return memory::Memory{options.host_memory, options.memory_size};
+    }
+    return memory::Memory{options.memory_size, options.backing};
+}
+
+Instance Instance::from_elf(std::span<const std::byte> elf_image, const Options &options) {
+    return Instance{hart::Hart{elf_image, make_memory(options)}};
+}
+
+Instance Instance::from_code(std::span<const std::byte> code, hart::addr_t load_addr,
+                             const Options &options) {
+    return Instance{hart::Hart{code, load_addr, make_memory(options)}};
+}
+
+executor::RunResult Instance::run(uint64_t max_instructions) {
+    return executor::Executor::run(m_hart, max_instructions);
+}
+
+executor::RunResult Instance::run_until(hart::addr_t pc, uint64_t max_instructions) {
+    bool user_breakpoint = m_hart.is_breakpoint(pc);
+    m_hart.add_breakpoint(pc);
+
+    auto result = executor::Executor::run(m_hart, max_instructions);
+
+    if (!user_breakpoint) {
+        m_hart.remove_breakpoint(pc);
+    }
+    return result;
+}
+
+void Instance::reset() { m_hart.restore_dirty(m_initial); }
+
+void Instance::set_pc(hart::addr_t pc) noexcept {
+    m_hart.set_pc(pc);
+    m_hart.set_next_pc(pc + 4);
+}
+
+std::span<uint8_t> Instance::guest_memory(hart::addr_t addr, size_t size) {
+    uint8_t *host = m_hart.host_pointer(addr, size);
+    if (!host) {
+        throw std::out_of_range{
+            fmt::format("Guest range {:#x} + {:#x} is out of memory", addr, size)};
+    }
+    return {host, size};
+}
+
+}  // namespace embed
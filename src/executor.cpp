@@ -1,249 +1,513 @@
 #include "executor.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <type_traits>
 
+#include "aot.hpp"
+#include "bbv.hpp"
+#include "block_opt.hpp"
 #include "decoder.hpp"
 // #include "fmt/format.h"
 #include <format>
 
 #include "hart.hpp"
 #include "logger.hpp"
+#include "stats_page.hpp"
 
 namespace executor {
 
-const std::array<Executor::executor_func_t, 49> Executor::functions{{
-    [instruction::InstrId::ADD] = execute_add,
-    [instruction::InstrId::SUB] = execute_sub,
-    [instruction::InstrId::SLL] = execute_sll,
-    [instruction::InstrId::SLT] = execute_slt,
-    [instruction::InstrId::SLTU] = execute_sltu,
-    [instruction::InstrId::XOR] = execute_xor,
-    [instruction::InstrId::SRL] = execute_srl,
-    [instruction::InstrId::SRA] = execute_sra,
-    [instruction::InstrId::OR] = execute_or,
-    [instruction::InstrId::AND] = execute_and,
-    [instruction::InstrId::ADDW] = execute_addw,
-    [instruction::InstrId::SLLW] = execute_sllw,
-    [instruction::InstrId::SRLW] = execute_srlw,
-    [instruction::InstrId::SUBW] = execute_subw,
-    [instruction::InstrId::SRAW] = execute_sraw,
-
-    // I - type
-    [instruction::InstrId::JALR] = execute_jalr,
-    [instruction::InstrId::LB] = execute_lb,
-    [instruction::InstrId::LH] = execute_lh,
-    [instruction::InstrId::LW] = execute_lw,
-    [instruction::InstrId::LBU] = execute_lbu,
-    [instruction::InstrId::LHU] = execute_lhu,
-    [instruction::InstrId::ADDI] = execute_addi,
-    [instruction::InstrId::SLTI] = execute_slti,
-    [instruction::InstrId::SLTIU] = execute_sltiu,
-    [instruction::InstrId::XORI] = execute_xori,
-    [instruction::InstrId::ORI] = execute_ori,
-    [instruction::InstrId::ANDI] = execute_andi,
-    [instruction::InstrId::LWU] = execute_lwu,
-    [instruction::InstrId::LD] = execute_ld,
-    [instruction::InstrId::SLLI] = execute_slli,
-    [instruction::InstrId::SRLI] = execute_srli,
-    [instruction::InstrId::SRAI] = execute_srai,
-    [instruction::InstrId::ADDIW] = execute_addiw,
-    [instruction::InstrId::SLLIW] = execute_slliw,
-    [instruction::InstrId::SRLIW] = execute_srliw,
-    [instruction::InstrId::SRAIW] = execute_sraiw,
-
-    // S - type
-    [instruction::InstrId::SB] = execute_sb,
-    [instruction::InstrId::SH] = execute_sh,
-    [instruction::InstrId::SW] = execute_sw,
-    [instruction::InstrId::SD] = execute_sd,
-
-    // B - type
-    [instruction::InstrId::BEQ] = execute_beq,
-    [instruction::InstrId::BNE] = execute_bne,
-    [instruction::InstrId::BLT] = execute_blt,
-    [instruction::InstrId::BGE] = execute_bge,
-    [instruction::InstrId::BLTU] = execute_bltu,
-    [instruction::InstrId::BGEU] = execute_bgeu,
-
-    // U - type
-    [instruction::InstrId::LUI] = execute_lui,
-    [instruction::InstrId::AUIPC] = execute_auipc,
-
-    // J - type
-    [instruction::InstrId::JAL] = execute_jal,
-}};
+namespace {
+
+// a taken branch that would leave pc misaligned traps instead
+void branch(hart::Hart &hart, const instruction::EncInstr &instr, bool taken) {
+    if (taken && !hart.jump(hart.get_pc() + instr.imm)) [[unlikely]] {
+        return;
+    }
+    hart.cover_edge(hart.get_pc_next());
+}
+
+// slow paths of translated loads and stores: misaligned, out of memory or watched
+template <typename ValType>
+int aot_access(aot::State *state, uint64_t addr, uint64_t *value, bool write) {
+    auto &hart = *static_cast<hart::Hart *>(state->hart);
+    hart.set_pc(state->pc);
+    hart.set_next_pc(state->pc + 4);
+
+    // the executor only takes retired over once the blocks return, instret and time have to
+    // include it already
+    uint64_t running;
+    const uint64_t *counter = hart.swap_run_counter(&running);
+    running = *counter + state->retired;
+    bool done = write ? hart.store<ValType>(addr, *value) : hart.load<ValType>(addr, *value);
+    hart.swap_run_counter(counter);
+
+    if (done && write &&
+        static_cast<const aot::Module *>(state->module)->covers(addr, sizeof(ValType))) {
+        state->code_changed = 1;
+    }
+    return done;
+}
+
+int aot_access(aot::State *state, uint64_t addr, unsigned size, uint64_t *value, bool write) {
+    switch (size) {
+        case 1: return aot_access<uint8_t>(state, addr, value, write);
+        case 2: return aot_access<uint16_t>(state, addr, value, write);
+        case 4: return aot_access<uint32_t>(state, addr, value, write);
+        default: return aot_access<uint64_t>(state, addr, value, write);
+    }
+}
+
+int aot_load(aot::State *state, uint64_t addr, unsigned size, uint64_t *value) {
+    return aot_access(state, addr, size, value, false);
+}
+
+int aot_store(aot::State *state, uint64_t addr, unsigned size, uint64_t value) {
+    return aot_access(state, addr, size, &value, true);
+}
+
+enum class CsrOp { write, set, clear };
+
+// csrrw with rd x0 doesn't read and set/clear with a zero rs1 field don't write, so neither
+// needs the permission for it; a forbidden access leaves rd and the csr unchanged
+void csr_instruction(hart::Hart &hart, const instruction::EncInstr &instr, CsrOp op,
+                     uint64_t operand) {
+    auto csr = static_cast<uint16_t>(instr.imm);
+    bool read = op != CsrOp::write || instr.rd != 0;
+    bool write = op == CsrOp::write || instr.rs1 != 0;
+
+    uint64_t old_value = 0;
+    if (read && !hart.read_csr(csr, old_value)) {
+        hart.raise_trap(hart::TrapCause::illegal_instruction, 0);
+        return;
+    }
+    if (write) {
+        uint64_t new_value = op == CsrOp::write ? operand
+                             : op == CsrOp::set ? old_value | operand
+                                                : old_value & ~operand;
+        if (!hart.write_csr(csr, new_value)) {
+            hart.raise_trap(hart::TrapCause::illegal_instruction, 0);
+            return;
+        }
+    }
+    if (instr.rd != 0) {
+        hart.set_rd(instr.rd, old_value);
+    }
+}
+
+// the loaded word is sign extended like lw does
+template <typename ValType>
+uint64_t extend(uint64_t value) {
+    return static_cast<int64_t>(static_cast<std::make_signed_t<ValType>>(value));
+}
+
+template <typename ValType>
+void lr_instruction(hart::Hart &hart, const instruction::EncInstr &instr) {
+    uint64_t value;
+    if (!hart.load_reserved<ValType>(hart.get_reg(instr.rs1), value)) [[unlikely]] {
+        return;
+    }
+    if (instr.rd != 0) {
+        hart.set_rd(instr.rd, extend<ValType>(value));
+    }
+}
+
+// rd is 0 on success and 1 on failure
+template <typename ValType>
+void sc_instruction(hart::Hart &hart, const instruction::EncInstr &instr) {
+    bool success;
+    if (!hart.store_conditional<ValType>(hart.get_reg(instr.rs1), hart.get_reg(instr.rs2),
+                                         success)) [[unlikely]] {
+        return;
+    }
+    if (instr.rd != 0) {
+        hart.set_rd(instr.rd, success ? 0 : 1);
+    }
+}
+
+template <typename ValType>
+void amo_instruction(hart::Hart &hart, const instruction::EncInstr &instr, memory::Amo op) {
+    uint64_t old;
+    if (!hart.amo<ValType>(hart.get_reg(instr.rs1), op, hart.get_reg(instr.rs2), old))
+        [[unlikely]] {
+        return;
+    }
+    if (instr.rd != 0) {
+        hart.set_rd(instr.rd, extend<ValType>(old));
+    }
+}
+
+// Retired instruction accounting of a run loop: the hart reads the loop's counter for its
+// cycle and instret csrs while the loop runs and adds it to them when the loop returns. The
+// count is also published into the hart's stats slot whenever publish is called, from stepping
+// loops at most every kStatsPeriod instructions, and once more at the end.
+class RunScope final {
+   private:
+    stats::HartSlot *m_slot;
+    hart::Hart &m_hart;
+    const uint64_t &m_executed;
+    uint64_t m_published = 0;
+
+   public:
+    static constexpr uint64_t kStatsPeriod = 4096;
+
+    RunScope(hart::Hart &hart, const uint64_t &executed)
+        : m_slot(hart.get_stats()), m_hart(hart), m_executed(executed) {
+        hart.begin_run(&executed);
+    }
+    ~RunScope() {
+        publish();
+        m_hart.end_run();
+    }
+
+    RunScope(const RunScope &) = delete;
+    RunScope &operator=(const RunScope &) = delete;
+
+    void publish() noexcept {
+        if (m_slot) [[unlikely]] {
+            m_slot->retire(m_executed - m_published, m_hart.get_pc());
+            m_published = m_executed;
+        }
+    }
+
+    void publish_periodic() noexcept {
+        if (m_executed - m_published >= kStatsPeriod) [[unlikely]] {
+            publish();
+        }
+    }
+};
+
+}  // namespace
+
+// the general handler of every instruction and the variants the decoder can pick for it
+constexpr Executor::function_table_t Executor::make_functions() {
+    using instruction::InstrId;
+    using instruction::Variant;
+
+    constexpr std::array<executor_func_t, instruction::InstrName.size()> generic{{
+        [instruction::InstrId::ADD] = execute_add,
+        [instruction::InstrId::SUB] = execute_sub,
+        [instruction::InstrId::SLL] = execute_sll,
+        [instruction::InstrId::SLT] = execute_slt,
+        [instruction::InstrId::SLTU] = execute_sltu,
+        [instruction::InstrId::XOR] = execute_xor,
+        [instruction::InstrId::SRL] = execute_srl,
+        [instruction::InstrId::SRA] = execute_sra,
+        [instruction::InstrId::OR] = execute_or,
+        [instruction::InstrId::AND] = execute_and,
+        [instruction::InstrId::ADDW] = execute_addw,
+        [instruction::InstrId::SLLW] = execute_sllw,
+        [instruction::InstrId::SRLW] = execute_srlw,
+        [instruction::InstrId::SUBW] = execute_subw,
+        [instruction::InstrId::SRAW] = execute_sraw,
+
+        // I - type
+        [instruction::InstrId::JALR] = execute_jalr,
+        [instruction::InstrId::LB] = execute_lb,
+        [instruction::InstrId::LH] = execute_lh,
+        [instruction::InstrId::LW] = execute_lw,
+        [instruction::InstrId::LBU] = execute_lbu,
+        [instruction::InstrId::LHU] = execute_lhu,
+        [instruction::InstrId::ADDI] = execute_addi,
+        [instruction::InstrId::SLTI] = execute_slti,
+        [instruction::InstrId::SLTIU] = execute_sltiu,
+        [instruction::InstrId::XORI] = execute_xori,
+        [instruction::InstrId::ORI] = execute_ori,
+        [instruction::InstrId::ANDI] = execute_andi,
+        [instruction::InstrId::LWU] = execute_lwu,
+        [instruction::InstrId::LD] = execute_ld,
+        [instruction::InstrId::SLLI] = execute_slli,
+        [instruction::InstrId::SRLI] = execute_srli,
+        [instruction::InstrId::SRAI] = execute_srai,
+        [instruction::InstrId::ADDIW] = execute_addiw,
+        [instruction::InstrId::SLLIW] = execute_slliw,
+        [instruction::InstrId::SRLIW] = execute_srliw,
+        [instruction::InstrId::SRAIW] = execute_sraiw,
+
+        // S - type
+        [instruction::InstrId::SB] = execute_sb,
+        [instruction::InstrId::SH] = execute_sh,
+        [instruction::InstrId::SW] = execute_sw,
+        [instruction::InstrId::SD] = execute_sd,
+
+        // B - type
+        [instruction::InstrId::BEQ] = execute_beq,
+        [instruction::InstrId::BNE] = execute_bne,
+        [instruction::InstrId::BLT] = execute_blt,
+        [instruction::InstrId::BGE] = execute_bge,
+        [instruction::InstrId::BLTU] = execute_bltu,
+        [instruction::InstrId::BGEU] = execute_bgeu,
+
+        // U - type
+        [instruction::InstrId::LUI] = execute_lui,
+        [instruction::InstrId::AUIPC] = execute_auipc,
+
+        // J - type
+        [instruction::InstrId::JAL] = execute_jal,
+
+        // A - extension
+        [instruction::InstrId::LR_W] = execute_lr_w,
+        [instruction::InstrId::SC_W] = execute_sc_w,
+        [instruction::InstrId::AMOSWAP_W] = execute_amoswap_w,
+        [instruction::InstrId::AMOADD_W] = execute_amoadd_w,
+        [instruction::InstrId::AMOXOR_W] = execute_amoxor_w,
+        [instruction::InstrId::AMOAND_W] = execute_amoand_w,
+        [instruction::InstrId::AMOOR_W] = execute_amoor_w,
+        [instruction::InstrId::AMOMIN_W] = execute_amomin_w,
+        [instruction::InstrId::AMOMAX_W] = execute_amomax_w,
+        [instruction::InstrId::AMOMINU_W] = execute_amominu_w,
+        [instruction::InstrId::AMOMAXU_W] = execute_amomaxu_w,
+        [instruction::InstrId::LR_D] = execute_lr_d,
+        [instruction::InstrId::SC_D] = execute_sc_d,
+        [instruction::InstrId::AMOSWAP_D] = execute_amoswap_d,
+        [instruction::InstrId::AMOADD_D] = execute_amoadd_d,
+        [instruction::InstrId::AMOXOR_D] = execute_amoxor_d,
+        [instruction::InstrId::AMOAND_D] = execute_amoand_d,
+        [instruction::InstrId::AMOOR_D] = execute_amoor_d,
+        [instruction::InstrId::AMOMIN_D] = execute_amomin_d,
+        [instruction::InstrId::AMOMAX_D] = execute_amomax_d,
+        [instruction::InstrId::AMOMINU_D] = execute_amominu_d,
+        [instruction::InstrId::AMOMAXU_D] = execute_amomaxu_d,
+
+        // system
+        [instruction::InstrId::FENCE] = execute_fence,
+        [instruction::InstrId::ECALL] = execute_ecall,
+        [instruction::InstrId::EBREAK] = execute_ebreak,
+        [instruction::InstrId::MRET] = execute_mret,
+        [instruction::InstrId::SRET] = execute_sret,
+        [instruction::InstrId::WFI] = execute_wfi,
+        [instruction::InstrId::SFENCE_VMA] = execute_sfence_vma,
+        [instruction::InstrId::CSRRW] = execute_csrrw,
+        [instruction::InstrId::CSRRS] = execute_csrrs,
+        [instruction::InstrId::CSRRC] = execute_csrrc,
+        [instruction::InstrId::CSRRWI] = execute_csrrwi,
+        [instruction::InstrId::CSRRSI] = execute_csrrsi,
+        [instruction::InstrId::CSRRCI] = execute_csrrci,
+
+        [instruction::InstrId::ILLEGAL] = execute_illegal,
+    }};
+
+    auto variant = [](Variant variant) { return static_cast<size_t>(variant); };
+
+    function_table_t table{};
+    for (size_t id = 0; id < table.size(); ++id) {
+        table[id].fill(generic[id]);
+        auto instr_id = static_cast<InstrId>(id);
+        if (instruction::writes_rd(instr_id) && !instruction::is_system(instr_id) &&
+            !instruction::is_atomic(instr_id)) {
+            table[id][variant(Variant::discard)] = execute_nop;
+            table[id][variant(Variant::move)] = execute_mv;
+            table[id][variant(Variant::load_imm)] = execute_li;
+            table[id][variant(Variant::zero)] = execute_zero;
+        }
+    }
+
+    // without a destination these still trap or jump
+    table[InstrId::LB][variant(Variant::discard)] = execute_load_discard<uint8_t>;
+    table[InstrId::LBU][variant(Variant::discard)] = execute_load_discard<uint8_t>;
+    table[InstrId::LH][variant(Variant::discard)] = execute_load_discard<uint16_t>;
+    table[InstrId::LHU][variant(Variant::discard)] = execute_load_discard<uint16_t>;
+    table[InstrId::LW][variant(Variant::discard)] = execute_load_discard<uint32_t>;
+    table[InstrId::LWU][variant(Variant::discard)] = execute_load_discard<uint32_t>;
+    table[InstrId::LD][variant(Variant::discard)] = execute_load_discard<uint64_t>;
+    table[InstrId::JAL][variant(Variant::discard)] = execute_j;
+    table[InstrId::JALR][variant(Variant::discard)] = execute_jr;
+    return table;
+}
+
+const Executor::function_table_t Executor::functions = make_functions();
 
 // R - type
 void Executor::execute_add(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) + hart.get_reg(instr.rs2));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) + hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_sub(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) - hart.get_reg(instr.rs2));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) - hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_slt(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, (static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) <
+    hart.set_rd(instr.rd, (static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) <
                             static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs2))));
 }
 
 void Executor::execute_sltu(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) < hart.get_reg(instr.rs2));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) < hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_xor(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) ^ hart.get_reg(instr.rs2));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) ^ hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_sll(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) << decoder::bits<5, 0>(hart.get_reg(instr.rs2)));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) << decoder::bits<5, 0>(hart.get_reg(instr.rs2)));
 }
 
 void Executor::execute_srl(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) >> decoder::bits<5, 0>(hart.get_reg(instr.rs2)));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) >> decoder::bits<5, 0>(hart.get_reg(instr.rs2)));
 }
 
 void Executor::execute_sra(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, static_cast<hart::reg_t>(
+    hart.set_rd(instr.rd, static_cast<hart::reg_t>(
                                static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) >>
                                decoder::bits<5, 0>(hart.get_reg(instr.rs2))));
 }
 
 void Executor::execute_or(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) | hart.get_reg(instr.rs2));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) | hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_and(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) & hart.get_reg(instr.rs2));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) & hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_addw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1) + hart.get_reg(instr.rs2)));
+    hart.set_rd(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1) + hart.get_reg(instr.rs2)));
 }
 
 void Executor::execute_sllw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1)
+    hart.set_rd(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1)
                                              << decoder::bits<4, 0>(hart.get_reg(instr.rs2))));
 }
 
 void Executor::execute_srlw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(decoder::bits<31, 0>(hart.get_reg(instr.rs1)) >>
+    hart.set_rd(instr.rd, decoder::sext<31>(decoder::bits<31, 0>(hart.get_reg(instr.rs1)) >>
                                              decoder::bits<4, 0>(hart.get_reg(instr.rs2))));
 }
 
 void Executor::execute_subw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1) - hart.get_reg(instr.rs2)));
+    hart.set_rd(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1) - hart.get_reg(instr.rs2)));
 }
 
 void Executor::execute_sraw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(static_cast<hart::reg_t>(
+    hart.set_rd(instr.rd, decoder::sext<31>(static_cast<hart::reg_t>(
                                static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) >>
                                decoder::bits<4, 0>(hart.get_reg(instr.rs2)))));
 }
 
 // I - type
 void Executor::execute_jalr(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_pc_next());
-    hart.set_next_pc((hart.get_reg(instr.rs1) + instr.imm) & ~uint64_t(1));
+    hart::addr_t link = hart.get_pc_next();
+    if (!hart.jump((hart.get_reg(instr.rs1) + instr.imm) & ~uint64_t(1))) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, link);
+    hart.cover_edge(hart.get_pc_next());
 }
 
 void Executor::execute_ld(hart::Hart &hart, const instruction::EncInstr &instr) {
     uint64_t value;
-    hart.load<uint64_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, value);
+    if (!hart.load<uint64_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, value);
 }
 
 void Executor::execute_lb(hart::Hart &hart, const instruction::EncInstr &instr) {  // CHECK
     uint64_t value;
-    hart.load<uint8_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, decoder::sext<7>(value));
+    if (!hart.load<uint8_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, decoder::sext<7>(value));
 }
 
 void Executor::execute_lbu(hart::Hart &hart, const instruction::EncInstr &instr) {
     uint64_t value;
-    hart.load<uint8_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, value);
+    if (!hart.load<uint8_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, value);
 }
 
 void Executor::execute_lh(hart::Hart &hart, const instruction::EncInstr &instr) {
     uint64_t value;
-    hart.load<uint16_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, decoder::sext<15>(value));
+    if (!hart.load<uint16_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, decoder::sext<15>(value));
 }
 
 void Executor::execute_lhu(hart::Hart &hart, const instruction::EncInstr &instr) {
     uint64_t value;
-    hart.load<uint16_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, value);
+    if (!hart.load<uint16_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, value);
 }
 
 void Executor::execute_lw(hart::Hart &hart, const instruction::EncInstr &instr) {
     uint64_t value;
-    hart.load<uint32_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, decoder::sext<31>(value));
+    if (!hart.load<uint32_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, decoder::sext<31>(value));
 }
 
 void Executor::execute_lwu(hart::Hart &hart, const instruction::EncInstr &instr) {
     uint64_t value;
-    hart.load<uint32_t>(hart.get_reg(instr.rs1) + instr.imm, value);
-    hart.set_reg(instr.rd, value);
+    if (!hart.load<uint32_t>(hart.get_reg(instr.rs1) + instr.imm, value)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, value);
 }
 
 void Executor::execute_addi(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) + static_cast<hart::signed_reg_t>(instr.imm));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) + static_cast<hart::signed_reg_t>(instr.imm));
 }
 
 void Executor::execute_slti(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) <
+    hart.set_rd(instr.rd, static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) <
                                static_cast<hart::signed_reg_t>(instr.imm));
 }
 
 void Executor::execute_sltiu(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) < instr.imm);
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) < instr.imm);
 }
 
 void Executor::execute_andi(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) & instr.imm);
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) & instr.imm);
 }
 
 void Executor::execute_ori(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) | instr.imm);
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) | instr.imm);
 }
 
 void Executor::execute_xori(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) ^ instr.imm);
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) ^ instr.imm);
 }
 
 void Executor::execute_slli(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) << decoder::bits<5, 0>(instr.imm));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) << decoder::bits<5, 0>(instr.imm));
 }
 
 void Executor::execute_srli(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_reg(instr.rs1) >> decoder::bits<5, 0>(instr.imm));
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1) >> decoder::bits<5, 0>(instr.imm));
 }
 
 void Executor::execute_srai(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, static_cast<hart::reg_t>(
+    hart.set_rd(instr.rd, static_cast<hart::reg_t>(
                                static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) >>
                                decoder::bits<5, 0>(instr.imm)));
 }
 
 void Executor::execute_addiw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1) + instr.imm));
+    hart.set_rd(instr.rd, decoder::sext<31>(hart.get_reg(instr.rs1) + instr.imm));
 }
 
 void Executor::execute_slliw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd,
+    hart.set_rd(instr.rd,
                  decoder::sext<31>(hart.get_reg(instr.rs1) << decoder::bits<4, 0>(instr.imm)));
 }
 
 void Executor::execute_srliw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(decoder::bits<31, 0>(hart.get_reg(instr.rs1)) >>
+    hart.set_rd(instr.rd, decoder::sext<31>(decoder::bits<31, 0>(hart.get_reg(instr.rs1)) >>
                                              decoder::bits<4, 0>(instr.imm)));
 }
 
 void Executor::execute_sraiw(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, decoder::sext<31>(static_cast<hart::reg_t>(
+    hart.set_rd(instr.rd, decoder::sext<31>(static_cast<hart::reg_t>(
                                static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) >>
                                decoder::bits<4, 0>(instr.imm))));
 }
@@ -272,78 +536,635 @@ void Executor::execute_sd(hart::Hart &hart, const instruction::EncInstr &instr)
 
 // B - type
 void Executor::execute_beq(hart::Hart &hart, const instruction::EncInstr &instr) {
-    if (hart.get_reg(instr.rs1) == hart.get_reg(instr.rs2)) {
-        hart.set_next_pc(hart.get_pc() + instr.imm);
-    }
+    branch(hart, instr, hart.get_reg(instr.rs1) == hart.get_reg(instr.rs2));
 }
 
 void Executor::execute_bne(hart::Hart &hart, const instruction::EncInstr &instr) {
-    if (hart.get_reg(instr.rs1) != hart.get_reg(instr.rs2)) {
-        hart.set_next_pc(hart.get_pc() + instr.imm);
-    }
+    branch(hart, instr, hart.get_reg(instr.rs1) != hart.get_reg(instr.rs2));
 }
 void Executor::execute_blt(hart::Hart &hart, const instruction::EncInstr &instr) {
-    if (static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) <
-        static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs2))) {
-        hart.set_next_pc(hart.get_pc() + instr.imm);
-    }
+    branch(hart, instr,
+           static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) <
+               static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs2)));
 }
 
 void Executor::execute_bltu(hart::Hart &hart, const instruction::EncInstr &instr) {
-    if (hart.get_reg(instr.rs1) < hart.get_reg(instr.rs2)) {
-        hart.set_next_pc(hart.get_pc() + instr.imm);
-    }
+    branch(hart, instr, hart.get_reg(instr.rs1) < hart.get_reg(instr.rs2));
 }
 void Executor::execute_bge(hart::Hart &hart, const instruction::EncInstr &instr) {
-    if (static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) >=
-        static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs2))) {
-        hart.set_next_pc(hart.get_pc() + instr.imm);
-    }
+    branch(hart, instr,
+           static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs1)) >=
+               static_cast<hart::signed_reg_t>(hart.get_reg(instr.rs2)));
 }
 void Executor::execute_bgeu(hart::Hart &hart, const instruction::EncInstr &instr) {
-    if (hart.get_reg(instr.rs1) >= hart.get_reg(instr.rs2)) {
-        hart.set_next_pc(hart.get_pc() + instr.imm);
-    }
+    branch(hart, instr, hart.get_reg(instr.rs1) >= hart.get_reg(instr.rs2));
 }
 
 // U - type
 void Executor::execute_lui(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, instr.imm);
+    hart.set_rd(instr.rd, instr.imm);
 }
 
 void Executor::execute_auipc(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_pc() + instr.imm);
+    hart.set_rd(instr.rd, hart.get_pc() + instr.imm);
 }
 
 // J - type
 void Executor::execute_jal(hart::Hart &hart, const instruction::EncInstr &instr) {
-    hart.set_reg(instr.rd, hart.get_pc_next());
-    hart.set_next_pc(hart.get_pc() + instr.imm);
+    hart::addr_t link = hart.get_pc_next();
+    if (!hart.jump(hart.get_pc() + instr.imm)) [[unlikely]] {
+        return;
+    }
+    hart.set_rd(instr.rd, link);
+    hart.cover_edge(hart.get_pc_next());
 }
 
-bool Executor::run(hart::Hart &hart) {
-    uint64_t instr;
-    instruction::EncInstr enc_instr;
+// A - extension
+void Executor::execute_lr_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    lr_instruction<uint32_t>(hart, instr);
+}
 
-    Logger &myLogger = Logger::getInstance();
+void Executor::execute_sc_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    sc_instruction<uint32_t>(hart, instr);
+}
 
-    while (hart.get_pc_next() != 0) {  // TODO: while(true) + break on exit instruction in code
+void Executor::execute_amoswap_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::swap);
+}
+
+void Executor::execute_amoadd_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::add);
+}
+
+void Executor::execute_amoxor_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::bit_xor);
+}
+
+void Executor::execute_amoand_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::bit_and);
+}
+
+void Executor::execute_amoor_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::bit_or);
+}
+
+void Executor::execute_amomin_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::min);
+}
+
+void Executor::execute_amomax_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::max);
+}
+
+void Executor::execute_amominu_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::minu);
+}
+
+void Executor::execute_amomaxu_w(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint32_t>(hart, instr, memory::Amo::maxu);
+}
+
+void Executor::execute_lr_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    lr_instruction<uint64_t>(hart, instr);
+}
+
+void Executor::execute_sc_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    sc_instruction<uint64_t>(hart, instr);
+}
+
+void Executor::execute_amoswap_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::swap);
+}
+
+void Executor::execute_amoadd_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::add);
+}
+
+void Executor::execute_amoxor_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::bit_xor);
+}
+
+void Executor::execute_amoand_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::bit_and);
+}
+
+void Executor::execute_amoor_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::bit_or);
+}
+
+void Executor::execute_amomin_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::min);
+}
+
+void Executor::execute_amomax_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::max);
+}
+
+void Executor::execute_amominu_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::minu);
+}
+
+void Executor::execute_amomaxu_d(hart::Hart &hart, const instruction::EncInstr &instr) {
+    amo_instruction<uint64_t>(hart, instr, memory::Amo::maxu);
+}
+
+// system
+void Executor::execute_fence(hart::Hart &, const instruction::EncInstr &) {}
+
+void Executor::execute_ecall(hart::Hart &hart, const instruction::EncInstr &) {
+    // the cause is 8 plus the privilege it was raised in
+    hart.raise_trap(static_cast<hart::TrapCause>(
+                        static_cast<uint64_t>(hart::TrapCause::user_ecall) +
+                        static_cast<uint64_t>(hart.privilege())),
+                    0);
+}
+
+void Executor::execute_ebreak(hart::Hart &hart, const instruction::EncInstr &) {
+    hart.raise_trap(hart::TrapCause::breakpoint, hart.get_pc());
+}
+
+void Executor::execute_mret(hart::Hart &hart, const instruction::EncInstr &) {
+    if (!hart.trap_return(csr::Privilege::machine)) {
+        hart.raise_trap(hart::TrapCause::illegal_instruction, 0);
+    }
+}
+
+void Executor::execute_sret(hart::Hart &hart, const instruction::EncInstr &) {
+    if (!hart.trap_return(csr::Privilege::supervisor)) {
+        hart.raise_trap(hart::TrapCause::illegal_instruction, 0);
+    }
+}
+
+// no interrupts are delivered, so there is nothing to wait for
+void Executor::execute_wfi(hart::Hart &hart, const instruction::EncInstr &) {
+    if (hart.privilege() == csr::Privilege::user) {
+        hart.raise_trap(hart::TrapCause::illegal_instruction, 0);
+    }
+}
+
+void Executor::execute_sfence_vma(hart::Hart &hart, const instruction::EncInstr &instr) {
+    if (hart.privilege() == csr::Privilege::user) {
+        hart.raise_trap(hart::TrapCause::illegal_instruction, 0);
+        return;
+    }
+    std::optional<hart::addr_t> addr;
+    std::optional<uint16_t> asid;
+    if (instr.rs1 != 0) {
+        addr = hart.get_reg(instr.rs1);
+    }
+    if (instr.rs2 != 0) {
+        asid = hart.get_reg(instr.rs2) & csr::kSatpAsidMask;
+    }
+    hart.fence_vma(addr, asid);
+}
+
+void Executor::execute_csrrw(hart::Hart &hart, const instruction::EncInstr &instr) {
+    csr_instruction(hart, instr, CsrOp::write, hart.get_reg(instr.rs1));
+}
+
+void Executor::execute_csrrs(hart::Hart &hart, const instruction::EncInstr &instr) {
+    csr_instruction(hart, instr, CsrOp::set, hart.get_reg(instr.rs1));
+}
 
-        hart.load<uint32_t>(hart.get_pc(), instr);
+void Executor::execute_csrrc(hart::Hart &hart, const instruction::EncInstr &instr) {
+    csr_instruction(hart, instr, CsrOp::clear, hart.get_reg(instr.rs1));
+}
+
+void Executor::execute_csrrwi(hart::Hart &hart, const instruction::EncInstr &instr) {
+    csr_instruction(hart, instr, CsrOp::write, instr.rs1);
+}
+
+void Executor::execute_csrrsi(hart::Hart &hart, const instruction::EncInstr &instr) {
+    csr_instruction(hart, instr, CsrOp::set, instr.rs1);
+}
+
+void Executor::execute_csrrci(hart::Hart &hart, const instruction::EncInstr &instr) {
+    csr_instruction(hart, instr, CsrOp::clear, instr.rs1);
+}
+
+void Executor::execute_illegal(hart::Hart &hart, const instruction::EncInstr &instr) {
+    hart.raise_trap(hart::TrapCause::illegal_instruction, instr.imm);
+}
+
+void Executor::execute_nop(hart::Hart &, const instruction::EncInstr &) {}
+
+void Executor::execute_mv(hart::Hart &hart, const instruction::EncInstr &instr) {
+    hart.set_rd(instr.rd, hart.get_reg(instr.rs1));
+}
+
+void Executor::execute_li(hart::Hart &hart, const instruction::EncInstr &instr) {
+    hart.set_rd(instr.rd, instr.imm);
+}
+
+void Executor::execute_zero(hart::Hart &hart, const instruction::EncInstr &instr) {
+    hart.set_rd(instr.rd, 0);
+}
+
+void Executor::execute_j(hart::Hart &hart, const instruction::EncInstr &instr) {
+    if (!hart.jump(hart.get_pc() + instr.imm)) [[unlikely]] {
+        return;
+    }
+    hart.cover_edge(hart.get_pc_next());
+}
+
+void Executor::execute_jr(hart::Hart &hart, const instruction::EncInstr &instr) {
+    if (!hart.jump((hart.get_reg(instr.rs1) + instr.imm) & ~uint64_t(1))) [[unlikely]] {
+        return;
+    }
+    hart.cover_edge(hart.get_pc_next());
+}
+
+template <typename ValType>
+void Executor::execute_load_discard(hart::Hart &hart, const instruction::EncInstr &instr) {
+    uint64_t value;
+    hart.load<ValType>(hart.get_reg(instr.rs1) + instr.imm, value);
+}
+
+void Executor::log_trap(const hart::Hart &hart) {
+    const auto &trap = hart.get_trap();
+    Logger::getInstance().message(
+        Logger::severity_level::standard, "Executor",
+        fmt::format("trap: {} epc: {:#x} tval: {:#x}", hart::trap_cause_name(trap.cause),
+                    trap.epc, trap.tval));
+}
+
+template <bool kDetailed>
+bool Executor::step(hart::Hart &hart, instruction::EncInstr &enc_instr) {
+    uint64_t instr = 0;
+
+    // detailed runs decode again to log the raw instruction
+    const instruction::EncInstr *decoded = nullptr;
+    if constexpr (!kDetailed) {
+        decoded = hart.decoded(hart.get_pc());
+    }
+
+    if (decoded) [[likely]] {
+        enc_instr = *decoded;
+    } else {
+        // a failed fetch leaves a trap pending
+        if (!hart.fetch(hart.get_pc(), instr)) [[unlikely]] {
+            hart.take_trap();
+            return hart.enter_trap();
+        }
         decoder::Decoder::decode_instruction(instr, enc_instr);
+    }
+
+    if constexpr (kDetailed) {
+        Logger &myLogger = Logger::getInstance();
 
+        myLogger.message(
+            Logger::severity_level::standard, "Decoder",
+            fmt::format("Match {} {:#08x}", instruction::InstrName[enc_instr.id], instr));
         myLogger.message(Logger::severity_level::standard, "Executor", enc_instr.format());
         myLogger.message(
             Logger::severity_level::standard, "Executor",
             fmt::format("pc: {:#x} pc_next: {:#x}", hart.get_pc(), hart.get_pc_next()));
-        myLogger.message(Logger::severity_level::verbose, "Executor", hart.format_registers());
+        if (!hart.get_trace()) {
+            myLogger.message(Logger::severity_level::verbose, "Executor",
+                             hart.format_registers());
+        }
+    }
+
+    if (auto *trace = hart.get_trace()) [[unlikely]] {
+        trace->begin_instruction(hart.get_pc(), hart.get_regs());
+    }
 
-        functions[enc_instr.id](hart, enc_instr);
-        hart.set_pc(hart.get_pc_next());
-        hart.set_next_pc(hart.get_pc_next() + 4);
+    execute(hart, enc_instr);
+    if (hart.take_trap()) [[unlikely]] {
+        return hart.enter_trap();
     }
 
+    hart.set_pc(hart.get_pc_next());
+    hart.set_next_pc(hart.get_pc_next() + 4);
     return true;
 }
 
+template <bool kDetailed>
+RunResult Executor::run_phase(hart::Hart &hart, uint64_t max_instructions,
+                              sampling::BbvCollector *bbv) {
+    instruction::EncInstr enc_instr;
+    uint64_t executed = 0;
+    RunScope scope{hart, executed};
+
+    for (; executed != max_instructions && hart.get_pc_next() != 0; ++executed) {
+        scope.publish_periodic();
+        if (!step<kDetailed>(hart, enc_instr)) [[unlikely]] {
+            return {StopReason::fault, executed};
+        }
+        if (bbv) {
+            bbv->retire(enc_instr, hart.get_pc());
+        }
+    }
+
+    return {hart.get_pc_next() == 0 ? StopReason::exit : StopReason::budget, executed};
+}
+
+bool Executor::run(hart::Hart &hart) {
+    instruction::EncInstr enc_instr;
+    uint64_t executed = 0;
+    RunScope scope{hart, executed};
+
+    while (hart.get_pc_next() != 0) {  // TODO: while(true) + break on exit instruction in code
+        scope.publish_periodic();
+        if (!step<true>(hart, enc_instr)) {
+            log_trap(hart);
+            return false;
+        }
+        ++executed;
+    }
+
+    return true;
+}
+
+RunResult Executor::run_slice(hart::Hart &hart, uint64_t max_instructions) {
+    instruction::EncInstr enc_instr;
+    uint64_t executed = 0;
+    RunScope scope{hart, executed};
+
+    while (executed != max_instructions) {
+        scope.publish_periodic();
+        if (hart.get_pc_next() == 0) {
+            return {StopReason::exit, executed};
+        }
+
+        if (!step<false>(hart, enc_instr)) [[unlikely]] {
+            return {StopReason::fault, executed};
+        }
+        ++executed;
+
+        if (hart.is_breakpoint(hart.get_pc())) {
+            return {StopReason::breakpoint, executed};
+        }
+    }
+
+    return {hart.get_pc_next() == 0 ? StopReason::exit : StopReason::budget, executed};
+}
+
+RunResult Executor::run_blocks(hart::Hart &hart, uint64_t max_instructions) {
+    using instruction::InstrId;
+
+    auto &predictor = hart.get_predictor();
+    instruction::EncInstr enc_instr;
+    uint64_t executed = 0;
+
+    // verified prediction for the block at the current pc
+    const instruction::EncInstr *predicted = nullptr;
+
+    RunScope scope{hart, executed};
+    while (executed != max_instructions) {
+        scope.publish();
+        if (hart.get_pc_next() == 0) {
+            return {StopReason::exit, executed};
+        }
+
+        // predictions made before text went stale may point at stale pages
+        const instruction::EncInstr *block = predicted && !hart.has_stale_code()
+                                                 ? predicted
+                                                 : hart.decoded(hart.get_pc());
+        predicted = nullptr;
+        if (!block) {
+            // outside of the predecoded segments or on a page the guest wrote into
+            if (!step<false>(hart, enc_instr)) [[unlikely]] {
+                return {StopReason::fault, executed};
+            }
+            ++executed;
+            continue;
+        }
+
+        uint64_t len = std::min<uint64_t>(hart.block_len(block), max_instructions - executed);
+        if (hart.translates_fetch() || hart.has_stale_code()) {
+            // the next virtual page may map anywhere, or the next page may be stale
+            len = std::min<uint64_t>(len, (mmu::kPageSize - (hart.get_pc() & mmu::kPageOffsetMask)) /
+                                              sizeof(instruction::instr_t));
+        }
+
+        // the optimized copy drops register writes, so it only runs whole and untraced, and it
+        // folds auipc from the physical base, so only while fetch isn't translated
+        std::optional<blockopt::Outcome> expected;
+        if (len == hart.block_len(block) && !hart.get_trace() && !hart.translates_fetch()) {
+            if (const auto *optimized = hart.optimized_block(block)) {
+                if (hart.verifies_optimized(block)) {
+                    expected = blockopt::evaluate(optimized, len, hart);
+                } else {
+                    block = optimized;
+                }
+            }
+        }
+
+        uint64_t code_writes = hart.code_writes();
+        for (uint64_t i = 0; i < len; ++i) {
+            const auto &instr = block[i];
+            if (auto *trace = hart.get_trace()) [[unlikely]] {
+                trace->begin_instruction(hart.get_pc(), hart.get_regs());
+            }
+
+            execute(hart, instr);
+            if (hart.take_trap()) [[unlikely]] {
+                if (expected) {
+                    blockopt::check(*expected, hart, i, true);
+                    expected.reset();
+                }
+                if (!hart.enter_trap()) {
+                    return {StopReason::fault, executed};
+                }
+                // a step of the budget, the hart leaves it out of instret
+                ++executed;
+                break;
+            }
+            ++executed;
+
+            // predictions hold physical code, they are only made while fetch isn't translated
+            if (i + 1 == len && instruction::is_control_transfer(instr.id) &&
+                !hart.translates_fetch()) {
+                hart::addr_t site = hart.get_pc();
+                hart::addr_t target = hart.get_pc_next();
+
+                if ((instr.id == InstrId::JAL || instr.id == InstrId::JALR) &&
+                    predictor::BranchPredictor::is_link(instr.rd)) {
+                    predictor.push_return({site + 4, hart.decoded(site + 4)});
+                }
+
+                if (instr.id == InstrId::JALR) {
+                    if (instr.rd == 0 && predictor::BranchPredictor::is_link(instr.rs1)) {
+                        predicted = predictor.pop_return(target);
+                    } else if (!(predicted = predictor.predict_indirect(site, target))) {
+                        predictor.update_indirect(site, {target, hart.decoded(target)});
+                    }
+                }
+            }
+
+            hart.set_pc(hart.get_pc_next());
+            hart.set_next_pc(hart.get_pc_next() + 4);
+
+            // a store or atomic into predecoded text may make the rest of the block stale
+            if (hart.code_writes() != code_writes) [[unlikely]] {
+                predicted = nullptr;
+                expected.reset();
+                break;
+            }
+        }
+        if (expected) {
+            blockopt::check(*expected, hart, len, false);
+        }
+    }
+
+    return {hart.get_pc_next() == 0 ? StopReason::exit : StopReason::budget, executed};
+}
+
+RunResult Executor::run_native(hart::Hart &hart, uint64_t max_instructions) {
+    const aot::Module *module = hart.get_aot();
+    instruction::EncInstr enc_instr;
+    uint64_t executed = 0;
+
+    aot::State state{};
+    state.regs = hart.regfile();
+    state.mem = hart.memory_base();
+    state.mem_size = hart.memory_size();
+    state.hart = &hart;
+    state.module = module;
+    state.load = aot_load;
+    state.store = aot_store;
+
+    RunScope scope{hart, executed};
+    while (executed != max_instructions) {
+        scope.publish();
+        if (hart.get_pc_next() == 0) {
+            return {StopReason::exit, executed};
+        }
+        if (!hart.get_aot()) [[unlikely]] {
+            // an interpreted store or atomic rewrote the translated text
+            return {StopReason::budget, executed};
+        }
+        if (hart.translates_fetch() || hart.translates_data()) [[unlikely]] {
+            // the translated code accesses physical memory directly
+            return {StopReason::budget, executed};
+        }
+
+        aot::block_fn_t block = module->block(hart.get_pc());
+        uint64_t chain_start = executed;
+        if (block) {
+            state.pc = hart.get_pc();
+            state.fast_stores = !hart.watches_writes();
+            state.retired = 0;
+            state.limit = max_instructions - executed;
+            // a block ending in a direct jump to another one returns it instead of calling it
+            for (aot::block_fn_t next = block; next;) {
+                state.next = nullptr;
+                next(&state);
+                next = state.next;
+                if (state.retired >= RunScope::kStatsPeriod) [[unlikely]] {
+                    // long chains publish as they go
+                    executed += state.retired;
+                    state.limit -= state.retired;
+                    state.retired = 0;
+                    hart.set_pc(state.pc);
+                    scope.publish();
+                }
+            }
+
+            executed += state.retired;
+            hart.set_pc(state.pc);
+            hart.set_next_pc(state.pc + 4);
+            if (hart.take_trap()) [[unlikely]] {
+                if (!hart.enter_trap()) {
+                    return {StopReason::fault, executed};
+                }
+                // a step of the budget, the hart leaves it out of instret
+                ++executed;
+                continue;
+            }
+        }
+        if (!block || executed == chain_start) {
+            // untranslated code, or the block doesn't fit into the rest of the budget
+            if (!step<false>(hart, enc_instr)) [[unlikely]] {
+                return {StopReason::fault, executed};
+            }
+            ++executed;
+            continue;
+        }
+        if (state.code_changed) [[unlikely]] {
+            // the guest rewrote its text, the interpreter takes over for good
+            hart.attach_aot(nullptr);
+            return {StopReason::budget, executed};
+        }
+    }
+
+    return {hart.get_pc_next() == 0 ? StopReason::exit : StopReason::budget, executed};
+}
+
+RunResult Executor::run(hart::Hart &hart, uint64_t max_instructions) {
+    if (hart.has_breakpoints()) {
+        return run_slice(hart, max_instructions);
+    }
+    if (hart.get_aot() && !hart.is_instrumented()) {
+        RunResult result = run_native(hart, max_instructions);
+        if (result.reason != StopReason::budget || result.instructions == max_instructions) {
+            return result;
+        }
+        auto rest = run_blocks(hart, max_instructions - result.instructions);
+        return {rest.reason, result.instructions + rest.instructions};
+    }
+    return run_blocks(hart, max_instructions);
+}
+
+bool Executor::run_sampled(hart::Hart &hart, const SamplingConfig &config) {
+    std::optional<sampling::BbvCollector> bbv;
+    if (!config.bbv_file.empty()) {
+        bbv.emplace(config.bbv_file, config.bbv_interval, hart.get_pc());
+    }
+    sampling::BbvCollector *bbv_ptr = bbv ? &*bbv : nullptr;
+
+    // without detailed windows the whole run is a single fast-forward phase
+    const uint64_t fast_forward = config.detail_window == 0 || config.fast_forward == 0
+                                      ? std::numeric_limits<uint64_t>::max()
+                                      : config.fast_forward;
+
+    Logger &myLogger = Logger::getInstance();
+
+    uint64_t fast_count = 0;
+    uint64_t detailed_count = 0;
+    uint64_t windows = 0;
+    bool trapped = false;
+
+    if (config.fast_forward == 0 && config.detail_window != 0) {
+        auto phase = run_phase<true>(hart, std::numeric_limits<uint64_t>::max(), bbv_ptr);
+        detailed_count += phase.instructions;
+        trapped = phase.reason == StopReason::fault;
+    }
+
+    while (!trapped && hart.get_pc_next() != 0) {
+        auto phase = run_phase<false>(hart, fast_forward, bbv_ptr);
+        fast_count += phase.instructions;
+        trapped = phase.reason == StopReason::fault;
+        if (trapped || config.detail_window == 0 || hart.get_pc_next() == 0) {
+            continue;
+        }
+
+        myLogger.message(Logger::severity_level::standard, "Executor",
+                         fmt::format("detailed window {} at instruction {}", windows,
+                                     fast_count + detailed_count));
+        phase = run_phase<true>(hart, config.detail_window, bbv_ptr);
+        detailed_count += phase.instructions;
+        trapped = phase.reason == StopReason::fault;
+        ++windows;
+    }
+
+    if (trapped) {
+        log_trap(hart);
+    }
+
+    if (bbv) {
+        bbv->finish();
+    }
+
+    myLogger.message(
+        Logger::severity_level::standard, "Executor",
+        fmt::format("sampling: {} instructions, {} fast-forwarded, {} detailed in {} windows, "
+                    "{} bbv intervals",
+                    fast_count + detailed_count, fast_count, detailed_count, windows,
+                    bbv ? bbv->intervals() : 0));
+
+    return !trapped;
+}
+
 }  // namespace executor
@@ -0,0 +1,87 @@
+#include <fmt/format.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "CLI/CLI.hpp"
+#include "fuzzer.hpp"
+#include "logger.hpp"
+
+int main(int argc, char **argv) {
+    CLI::App app{"RISV RV64_I guest fuzzer"};
+    fuzz::FuzzConfig config{};
+    app.add_option("-f,--file", config.elf_file, "Required RISC-V elf file")
+        ->required()
+        ->check(CLI::ExistingFile);
+
+    // addresses are accepted in any base strtoull understands
+    std::string harness_entry, input_addr;
+    app.add_option("--entry", harness_entry,
+                   "Harness entry the snapshot is taken at, called with a0 = input, a1 = length")
+        ->required();
+    app.add_option("--input_addr", input_addr, "Guest address the input is written to")
+        ->required();
+
+    app.add_option("--max_len", config.max_input_size, "Maximum input length")
+        ->default_val(config.max_input_size)
+        ->check(CLI::PositiveNumber);
+    app.add_option("--budget", config.budget, "Instructions per execution before it is a hang")
+        ->default_val(config.budget)
+        ->check(CLI::PositiveNumber);
+
+    config.workers = std::max(1u, std::thread::hardware_concurrency());
+    app.add_option("-j,--workers", config.workers, "Fuzzing threads")
+        ->default_val(config.workers)
+        ->check(CLI::PositiveNumber);
+
+    app.add_option("--runs", config.max_executions, "Executions to run, 0 - unlimited");
+    uint64_t seconds = 0;
+    app.add_option("--seconds", seconds, "Stops fuzzing after the given time, 0 - unlimited");
+    app.add_option("--seed", config.seed, "Mutation random seed");
+
+    app.add_option("--corpus", config.corpus_dir,
+                   "Directory with seed inputs, inputs with new coverage are added to it");
+    app.add_option("--crashes", config.crash_dir, "Directory for inputs that trap");
+
+    CLI11_PARSE(app, argc, argv);
+
+    config.harness_entry = std::stoull(harness_entry, nullptr, 0);
+    config.input_addr = std::stoull(input_addr, nullptr, 0);
+
+    Logger::getInstance().init(Logger::severity_level::standard);
+
+    fuzz::Fuzzer fuzzer{config};
+
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+
+    std::thread timer;
+    if (seconds != 0) {
+        timer = std::thread{[&] {
+            std::unique_lock lock{mutex};
+            if (!done_cv.wait_for(lock, std::chrono::seconds{seconds}, [&] { return done; })) {
+                fuzzer.stop();
+            }
+        }};
+    }
+
+    fuzzer.run();
+
+    if (timer.joinable()) {
+        {
+            std::lock_guard lock{mutex};
+            done = true;
+        }
+        done_cv.notify_one();
+        timer.join();
+    }
+
+    auto stats = fuzzer.stats();
+    fmt::print("executions: {} corpus: {} edges: {} crashes: {} hangs: {}\n", stats.executions,
+               stats.corpus_size, stats.edges, stats.crashes, stats.hangs);
+    return stats.crashes != 0;
+}
@@ -0,0 +1,358 @@
+#include "fuzzer.hpp"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "executor.hpp"
+#include "logger.hpp"
+
+namespace fuzz {
+
+namespace {
+
+// jumping here sets pc_next to 0, which ends the program
+constexpr hart::addr_t kExitAddr = -4;
+
+constexpr hart::reg_id_t kRaReg = 1;
+constexpr hart::reg_id_t kA0Reg = 10;
+constexpr hart::reg_id_t kA1Reg = 11;
+
+// AFL hit count classes, one bit per class
+constexpr std::array<uint8_t, 256> kHitBuckets = [] {
+    std::array<uint8_t, 256> buckets{};
+    for (size_t hits = 1; hits < buckets.size(); ++hits) {
+        buckets[hits] = hits == 1    ? 1
+                        : hits == 2  ? 2
+                        : hits == 3  ? 4
+                        : hits < 8   ? 8
+                        : hits < 16  ? 16
+                        : hits < 32  ? 32
+                        : hits < 128 ? 64
+                                     : 128;
+    }
+    return buckets;
+}();
+
+constexpr std::array<uint8_t, 9> kInterestingBytes{0, 1, 0x7f, 0x80, 0xff, 16, 32, 64, 100};
+constexpr std::array<uint32_t, 8> kInterestingWords{0,          1,          0x7fff, 0x8000,
+                                                    0xffff,     0x7fffffff, 0x80000000,
+                                                    0xffffffff};
+
+class Rng {
+   private:
+    uint64_t m_state;
+
+   public:
+    explicit Rng(uint64_t seed) : m_state(seed ? seed : 0x853c49e6748fea9b) {}
+
+    uint64_t next() noexcept {  // xorshift64*
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 0x2545f4914f6cdd1d;
+    }
+
+    // [0, bound)
+    size_t below(size_t bound) noexcept { return next() % bound; }
+};
+
+void mutate(std::vector<uint8_t> &input, Rng &rng, size_t max_size,
+            const std::vector<std::vector<uint8_t>> &corpus) {
+    if (input.empty()) {
+        input.push_back(0);
+    }
+
+    size_t stacked = size_t(1) << (1 + rng.below(4));
+    for (size_t i = 0; i < stacked; ++i) {
+        size_t pos = rng.below(input.size());
+
+        switch (rng.below(9)) {
+            case 0:
+                input[pos] ^= uint8_t(1) << rng.below(8);
+                break;
+            case 1:
+                input[pos] = kInterestingBytes[rng.below(kInterestingBytes.size())];
+                break;
+            case 2:
+                input[pos] = rng.next();
+                break;
+            case 3:
+                input[pos] += rng.below(2) ? 1 + rng.below(35) : -1 - rng.below(35);
+                break;
+            case 4: {
+                uint32_t word = kInterestingWords[rng.below(kInterestingWords.size())];
+                size_t size = std::min<size_t>(rng.below(2) ? 2 : 4, input.size() - pos);
+                std::memcpy(input.data() + pos, &word, size);
+                break;
+            }
+            case 5: {  // delete a block
+                if (input.size() > 1) {
+                    size_t size = 1 + rng.below(std::min<size_t>(input.size() - pos, 32));
+                    size = std::min(size, input.size() - 1);
+                    input.erase(input.begin() + pos, input.begin() + pos + size);
+                }
+                break;
+            }
+            case 6: {  // duplicate a block
+                size_t size = 1 + rng.below(std::min<size_t>(input.size() - pos, 32));
+                size = std::min(size, max_size - std::min(max_size, input.size()));
+                std::vector<uint8_t> block{input.begin() + pos, input.begin() + pos + size};
+                input.insert(input.begin() + rng.below(input.size() + 1), block.begin(),
+                             block.end());
+                break;
+            }
+            case 7: {  // overwrite with another part of the input
+                size_t from = rng.below(input.size());
+                size_t size = 1 + rng.below(input.size() - std::max(pos, from));
+                std::memmove(input.data() + pos, input.data() + from, size);
+                break;
+            }
+            case 8: {  // splice with another corpus entry
+                const auto &other = corpus[rng.below(corpus.size())];
+                if (!other.empty()) {
+                    size_t cut = rng.below(std::min(input.size(), other.size()) + 1);
+                    input.resize(cut);
+                    input.insert(input.end(), other.begin() + cut, other.end());
+                }
+                break;
+            }
+        }
+
+        if (input.empty()) {
+            input.push_back(0);
+        }
+    }
+
+    if (input.size() > max_size) {
+        input.resize(max_size);
+    }
+}
+
+}  // namespace
+
+Fuzzer::Fuzzer(const FuzzConfig &config) : m_config(config), m_virgin(hart::g_coverage_map_size) {
+    if (m_config.workers == 0 || m_config.budget == 0 || m_config.max_input_size == 0) {
+        throw std::runtime_error{"Fuzzer needs workers, an instruction budget and an input size"};
+    }
+
+    hart::Hart hart{m_config.elf_file};
+    hart.set_virtual_time(true);
+    if (!hart.host_pointer(m_config.input_addr, m_config.max_input_size)) {
+        throw std::runtime_error{fmt::format("Input buffer {:#x} + {:#x} is out of memory",
+                                             m_config.input_addr, m_config.max_input_size)};
+    }
+
+    if (hart.get_pc() != m_config.harness_entry) {
+        hart.add_breakpoint(m_config.harness_entry);
+        auto result = executor::Executor::run(hart, std::numeric_limits<uint64_t>::max());
+        if (result.reason != executor::StopReason::breakpoint) {
+            throw std::runtime_error{fmt::format("Program doesn't reach harness entry {:#x}",
+                                                 m_config.harness_entry)};
+        }
+        hart.remove_breakpoint(m_config.harness_entry);
+    }
+
+    hart.set_reg(kRaReg, kExitAddr);
+    m_snapshot = hart.snapshot();
+
+    load_corpus();
+}
+
+void Fuzzer::load_corpus() {
+    if (!m_config.corpus_dir.empty()) {
+        std::filesystem::create_directories(m_config.corpus_dir);
+        for (const auto &entry : std::filesystem::directory_iterator{m_config.corpus_dir}) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+            std::ifstream file{entry.path(), std::ios::binary};
+            std::vector<uint8_t> input{std::istreambuf_iterator<char>{file}, {}};
+            if (input.size() > m_config.max_input_size) {
+                input.resize(m_config.max_input_size);
+            }
+            m_corpus.push_back(std::move(input));
+        }
+    }
+    if (!m_config.crash_dir.empty()) {
+        std::filesystem::create_directories(m_config.crash_dir);
+    }
+
+    if (m_corpus.empty()) {
+        m_corpus.emplace_back(std::min<size_t>(m_config.max_input_size, 16), 0);
+    }
+    m_corpus_size = m_corpus.size();
+
+    Logger::getInstance().message(Logger::severity_level::standard, "Fuzzer",
+                                  fmt::format("{} seed inputs", m_corpus.size()));
+}
+
+bool Fuzzer::merge_coverage(uint8_t *trace) {
+    bool new_coverage = false;
+
+    for (size_t i = 0; i < hart::g_coverage_map_size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, trace + i, sizeof(word));
+        if (word == 0) {
+            continue;
+        }
+
+        for (size_t edge = i; edge < i + sizeof(uint64_t); ++edge) {
+            uint8_t bucket = kHitBuckets[trace[edge]];
+            if (bucket == 0 || (m_virgin[edge].load(std::memory_order_relaxed) & bucket)) {
+                continue;
+            }
+
+            uint8_t seen = m_virgin[edge].fetch_or(bucket, std::memory_order_relaxed);
+            if (!(seen & bucket)) {
+                new_coverage = true;
+                if (seen == 0) {
+                    m_edges.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+        std::memset(trace + i, 0, sizeof(uint64_t));
+    }
+
+    return new_coverage;
+}
+
+void Fuzzer::add_to_corpus(const std::vector<uint8_t> &input) {
+    size_t id;
+    {
+        std::lock_guard lock{m_mutex};
+        id = m_corpus.size();
+        m_corpus.push_back(input);
+        m_corpus_size.store(m_corpus.size(), std::memory_order_release);
+    }
+
+    if (!m_config.corpus_dir.empty()) {
+        std::ofstream file{fmt::format("{}/id-{:06}", m_config.corpus_dir, id), std::ios::binary};
+        file.write(reinterpret_cast<const char *>(input.data()), input.size());
+    }
+}
+
+void Fuzzer::report_crash(const hart::Trap &trap, const std::vector<uint8_t> &input) {
+    {
+        std::lock_guard lock{m_mutex};
+        if (!m_crashes.emplace(trap.cause, trap.epc).second) {
+            return;
+        }
+    }
+
+    Logger::getInstance().message(
+        Logger::severity_level::standard, "Fuzzer",
+        fmt::format("crash: {} epc: {:#x} tval: {:#x}", hart::trap_cause_name(trap.cause),
+                    trap.epc, trap.tval));
+
+    if (!m_config.crash_dir.empty()) {
+        std::ofstream file{fmt::format("{}/crash-{}-{:x}", m_config.crash_dir,
+                                       static_cast<uint64_t>(trap.cause), trap.epc),
+                           std::ios::binary};
+        file.write(reinterpret_cast<const char *>(input.data()), input.size());
+    }
+}
+
+void Fuzzer::worker(size_t worker_id) {
+    hart::Hart hart{m_config.elf_file};
+    hart.restore(m_snapshot);
+    hart.track_dirty_pages();
+    // an input has to behave the same on every run
+    hart.set_virtual_time(true);
+
+    std::vector<uint8_t> trace(hart::g_coverage_map_size);
+    hart.set_coverage_map(trace.data());
+
+    Rng rng{m_config.seed + (worker_id + 1) * 0x9e3779b97f4a7c15};
+
+    // the shared corpus only grows, new entries are copied over when they show up
+    std::vector<std::vector<uint8_t>> corpus;
+    std::vector<uint8_t> input;
+
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        uint64_t execution = m_executions.fetch_add(1, std::memory_order_relaxed);
+        if (m_config.max_executions != 0 && execution >= m_config.max_executions) {
+            m_executions.fetch_sub(1, std::memory_order_relaxed);
+            break;
+        }
+
+        if (corpus.size() != m_corpus_size.load(std::memory_order_acquire)) {
+            std::lock_guard lock{m_mutex};
+            corpus.insert(corpus.end(), m_corpus.begin() + corpus.size(), m_corpus.end());
+        }
+        input = corpus[rng.below(corpus.size())];
+        mutate(input, rng, m_config.max_input_size, corpus);
+
+        hart.restore_dirty(m_snapshot);
+        hart.write_memory(m_config.input_addr, input.data(), input.size());
+        hart.set_reg(kA0Reg, m_config.input_addr);
+        hart.set_reg(kA1Reg, input.size());
+
+        auto result = executor::Executor::run(hart, m_config.budget);
+        if (result.reason == executor::StopReason::fault) {
+            report_crash(hart.get_trap(), input);
+        } else if (result.reason == executor::StopReason::budget) {
+            m_hangs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (merge_coverage(trace.data())) {
+            add_to_corpus(input);
+        }
+    }
+}
+
+void Fuzzer::run() {
+    Logger &myLogger = Logger::getInstance();
+    auto start = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> active = m_config.workers;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < m_config.workers; ++i) {
+        workers.emplace_back([this, i, &active] {
+            worker(i);
+            --active;
+        });
+    }
+
+    auto log_stats = [&] {
+        auto stats = this->stats();
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        myLogger.message(Logger::severity_level::standard, "Fuzzer",
+                         fmt::format("execs: {} ({:.0f}/s) corpus: {} edges: {} crashes: {} "
+                                     "hangs: {}",
+                                     stats.executions, stats.executions / seconds,
+                                     stats.corpus_size, stats.edges, stats.crashes, stats.hangs));
+    };
+
+    auto next_report = start + std::chrono::seconds{1};
+    while (active != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        if (std::chrono::steady_clock::now() >= next_report) {
+            log_stats();
+            next_report += std::chrono::seconds{1};
+        }
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    log_stats();
+}
+
+FuzzStats Fuzzer::stats() {
+    std::lock_guard lock{m_mutex};
+    return {m_executions.load(std::memory_order_relaxed), m_corpus.size(),
+            m_edges.load(std::memory_order_relaxed), m_crashes.size(),
+            m_hangs.load(std::memory_order_relaxed)};
+}
+
+}  // namespace fuzz
@@ -0,0 +1,508 @@
+#include "gdb_server.hpp"
+
+#include <arpa/inet.h>
+#include <fmt/format.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "executor.hpp"
+#include "logger.hpp"
+
+namespace gdb {
+
+namespace {
+
+constexpr size_t kPcRegNum = hart::g_regfile_size;
+
+constexpr std::string_view kHexDigits = "0123456789abcdef";
+
+// advertised in qSupported, a memory read reply holds two hex digits per byte
+constexpr size_t kPacketSize = 0x4000;
+constexpr size_t kMaxReadLength = kPacketSize / 2;
+
+void append_hex(std::string &out, const uint8_t *data, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        out += kHexDigits[data[i] >> 4];
+        out += kHexDigits[data[i] & 0xf];
+    }
+}
+
+// registers are transferred in target (little-endian) byte order
+void append_reg(std::string &out, uint64_t value) {
+    uint8_t bytes[sizeof(value)];
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        bytes[i] = value >> (8 * i);
+    }
+    append_hex(out, bytes, sizeof(bytes));
+}
+
+bool parse_hex(std::string_view hex, uint64_t &value) {
+    auto [ptr, ec] = std::from_chars(hex.data(), hex.data() + hex.size(), value, 16);
+    return ec == std::errc{} && ptr == hex.data() + hex.size();
+}
+
+bool parse_hex_bytes(std::string_view hex, std::vector<uint8_t> &bytes) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    bytes.resize(hex.size() / 2);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        uint64_t byte;
+        if (!parse_hex(hex.substr(2 * i, 2), byte)) {
+            return false;
+        }
+        bytes[i] = byte;
+    }
+    return true;
+}
+
+bool parse_reg(std::string_view hex, uint64_t &value) {
+    std::vector<uint8_t> bytes;
+    if (hex.size() != 2 * sizeof(value) || !parse_hex_bytes(hex, bytes)) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        value |= uint64_t(bytes[i]) << (8 * i);
+    }
+    return true;
+}
+
+// "addr,length" as used by memory and breakpoint packets
+bool parse_addr_length(std::string_view args, uint64_t &addr, uint64_t &length) {
+    auto comma = args.find(',');
+    return comma != std::string_view::npos && parse_hex(args.substr(0, comma), addr) &&
+           parse_hex(args.substr(comma + 1), length);
+}
+
+// stop reply for a trap with the signal a native process would get
+const char *trap_signal(hart::TrapCause cause) {
+    switch (cause) {
+        case hart::TrapCause::illegal_instruction:
+            return "S04";  // SIGILL
+        case hart::TrapCause::instruction_address_misaligned:
+        case hart::TrapCause::load_address_misaligned:
+        case hart::TrapCause::store_address_misaligned:
+            return "S07";  // SIGBUS
+        default:
+            return "S0b";  // SIGSEGV
+    }
+}
+
+const std::string &target_xml() {
+    static const std::string xml = [] {
+        std::string xml =
+            "<?xml version=\"1.0\"?>"
+            "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+            "<target version=\"1.0\">"
+            "<architecture>riscv:rv64</architecture>"
+            "<feature name=\"org.gnu.gdb.riscv.cpu\">";
+        for (size_t i = 0; i < hart::g_reg_names.size(); ++i) {
+            xml += fmt::format("<reg name=\"{}\" bitsize=\"64\" type=\"int\" regnum=\"{}\"/>",
+                               hart::g_reg_names[i], i);
+        }
+        xml += fmt::format("<reg name=\"pc\" bitsize=\"64\" type=\"code_ptr\" regnum=\"{}\"/>",
+                           kPcRegNum);
+        xml += "</feature></target>";
+        return xml;
+    }();
+    return xml;
+}
+
+}  // namespace
+
+GdbServer::GdbServer(hart::Hart &hart, uint16_t port) : m_hart(hart) {
+    errno = 0;
+    m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd < 0) {
+        throw std::runtime_error{
+            fmt::format("Can't create gdb socket with errno: {}", std::strerror(errno))};
+    }
+
+    int reuse = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(m_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        listen(m_listen_fd, 1) < 0) {
+        close(m_listen_fd);
+        throw std::runtime_error{fmt::format("Can't listen on gdb port {} with errno: {}", port,
+                                             std::strerror(errno))};
+    }
+}
+
+GdbServer::~GdbServer() {
+    if (m_conn_fd >= 0) {
+        close(m_conn_fd);
+    }
+    close(m_listen_fd);
+}
+
+std::optional<char> GdbServer::read_byte() {
+    char byte;
+    ssize_t count;
+    do {
+        count = recv(m_conn_fd, &byte, 1, 0);
+    } while (count < 0 && errno == EINTR);
+
+    if (count != 1) {
+        return std::nullopt;
+    }
+    return byte;
+}
+
+std::optional<std::string> GdbServer::read_packet() {
+    while (true) {
+        auto byte = read_byte();
+        if (!byte) {
+            return std::nullopt;
+        }
+        if (*byte == '\x03') {
+            return std::string{*byte};
+        }
+        if (*byte != '$') {
+            continue;  // acks and noise between packets
+        }
+
+        std::string payload;
+        uint8_t checksum = 0;
+        while ((byte = read_byte()) && *byte != '#') {
+            payload += *byte;
+            checksum += *byte;
+        }
+
+        char sum_hex[2];
+        for (auto &digit : sum_hex) {
+            if (!(byte = read_byte())) {
+                return std::nullopt;
+            }
+            digit = *byte;
+        }
+
+        uint64_t expected;
+        if (!parse_hex({sum_hex, 2}, expected) || expected != checksum) {
+            if (!m_no_ack) {
+                send(m_conn_fd, "-", 1, MSG_NOSIGNAL);
+            }
+            continue;
+        }
+
+        if (!m_no_ack) {
+            send(m_conn_fd, "+", 1, MSG_NOSIGNAL);
+        }
+        return payload;
+    }
+}
+
+void GdbServer::write_packet(std::string_view payload) {
+    uint8_t checksum = 0;
+    for (char c : payload) {
+        checksum += c;
+    }
+
+    std::string packet = fmt::format("${}#{:02x}", payload, checksum);
+    for (size_t sent = 0; sent < packet.size();) {
+        ssize_t count = send(m_conn_fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        sent += count;
+    }
+}
+
+bool GdbServer::interrupt_requested() {
+    pollfd fd{.fd = m_conn_fd, .events = POLLIN, .revents = 0};
+    while (poll(&fd, 1, 0) > 0 && (fd.revents & POLLIN)) {
+        auto byte = read_byte();
+        if (!byte || *byte == '\x03') {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string GdbServer::handle_query(std::string_view packet) {
+    if (packet.starts_with("qSupported")) {
+        return fmt::format("PacketSize={:x};qXfer:features:read+;QStartNoAckMode+", kPacketSize);
+    }
+    if (packet == "QStartNoAckMode") {
+        return "OK";
+    }
+    if (packet == "qAttached") {
+        return "1";
+    }
+    if (packet == "qC") {
+        return "QC1";
+    }
+    if (packet == "qfThreadInfo") {
+        return "m1";
+    }
+    if (packet == "qsThreadInfo") {
+        return "l";
+    }
+
+    constexpr std::string_view kTargetXml = "qXfer:features:read:target.xml:";
+    if (packet.starts_with(kTargetXml)) {
+        uint64_t offset, length;
+        if (!parse_addr_length(packet.substr(kTargetXml.size()), offset, length)) {
+            return "E01";
+        }
+        const auto &xml = target_xml();
+        if (offset >= xml.size()) {
+            return "l";
+        }
+        auto chunk = xml.substr(offset, length);
+        return (offset + chunk.size() == xml.size() ? "l" : "m") + chunk;
+    }
+
+    return "";
+}
+
+std::string GdbServer::read_registers() const {
+    std::string out;
+    for (hart::reg_id_t i = 0; i < hart::g_regfile_size; ++i) {
+        append_reg(out, m_hart.get_reg(i));
+    }
+    append_reg(out, m_hart.get_pc());
+    return out;
+}
+
+std::string GdbServer::write_registers(std::string_view hex) {
+    constexpr size_t kRegHexSize = 2 * sizeof(hart::reg_t);
+    if (hex.size() < (kPcRegNum + 1) * kRegHexSize) {
+        return "E01";
+    }
+
+    for (size_t i = 0; i <= kPcRegNum; ++i) {
+        uint64_t value;
+        if (!parse_reg(hex.substr(i * kRegHexSize, kRegHexSize), value)) {
+            return "E01";
+        }
+        if (i == kPcRegNum) {
+            m_hart.set_pc(value);
+            m_hart.set_next_pc(value + 4);
+        } else {
+            m_hart.set_reg(i, value);
+        }
+    }
+    return "OK";
+}
+
+std::string GdbServer::read_register(std::string_view packet) const {
+    uint64_t reg_num;
+    if (!parse_hex(packet, reg_num) || reg_num > kPcRegNum) {
+        return "E01";
+    }
+
+    std::string out;
+    append_reg(out, reg_num == kPcRegNum ? m_hart.get_pc() : m_hart.get_reg(reg_num));
+    return out;
+}
+
+std::string GdbServer::write_register(std::string_view packet) {
+    auto eq = packet.find('=');
+    uint64_t reg_num, value;
+    if (eq == std::string_view::npos || !parse_hex(packet.substr(0, eq), reg_num) ||
+        reg_num > kPcRegNum || !parse_reg(packet.substr(eq + 1), value)) {
+        return "E01";
+    }
+
+    if (reg_num == kPcRegNum) {
+        m_hart.set_pc(value);
+        m_hart.set_next_pc(value + 4);
+    } else {
+        m_hart.set_reg(reg_num, value);
+    }
+    return "OK";
+}
+
+std::string GdbServer::read_memory(std::string_view packet) const {
+    uint64_t addr, length;
+    // checked before allocating, the length comes straight from the remote side
+    if (!parse_addr_length(packet, addr, length) || length > kMaxReadLength) {
+        return "E01";
+    }
+
+    // the hart checks the range
+    std::vector<uint8_t> bytes(length);
+    if (!m_hart.read_memory(addr, bytes.data(), bytes.size())) {
+        return "E14";  // EFAULT
+    }
+
+    std::string out;
+    append_hex(out, bytes.data(), bytes.size());
+    return out;
+}
+
+std::string GdbServer::write_memory(std::string_view packet) {
+    auto colon = packet.find(':');
+    uint64_t addr, length;
+    std::vector<uint8_t> bytes;
+    if (colon == std::string_view::npos || !parse_addr_length(packet.substr(0, colon), addr, length) ||
+        !parse_hex_bytes(packet.substr(colon + 1), bytes) || bytes.size() != length) {
+        return "E01";
+    }
+
+    if (!m_hart.write_memory(addr, bytes.data(), bytes.size())) {
+        return "E14";  // EFAULT
+    }
+    return "OK";
+}
+
+std::string GdbServer::handle_breakpoint(std::string_view packet, bool insert) {
+    // software and hardware breakpoints are both served from the hart's breakpoint set
+    if (packet.size() < 2 || (packet[0] != '0' && packet[0] != '1') || packet[1] != ',') {
+        return "";
+    }
+
+    uint64_t addr, kind;
+    if (!parse_addr_length(packet.substr(2), addr, kind)) {
+        return "E01";
+    }
+
+    if (insert) {
+        m_hart.add_breakpoint(addr);
+    } else {
+        m_hart.remove_breakpoint(addr);
+    }
+    return "OK";
+}
+
+std::string GdbServer::resume(bool single_step) {
+    while (true) {
+        auto result =
+            executor::Executor::run(m_hart, single_step ? 1 : kInterruptPollInterval);
+
+        switch (result.reason) {
+            case executor::StopReason::exit:
+                return "W00";
+            case executor::StopReason::fault:
+                return trap_signal(m_hart.get_trap().cause);
+            case executor::StopReason::breakpoint:
+                return "S05";
+            case executor::StopReason::budget:
+                if (single_step) {
+                    return "S05";
+                }
+                if (interrupt_requested()) {
+                    return "S02";
+                }
+                break;
+        }
+    }
+}
+
+bool GdbServer::serve() {
+    Logger &myLogger = Logger::getInstance();
+
+    sockaddr_in peer{};
+    socklen_t peer_len = sizeof(peer);
+    do {
+        m_conn_fd = accept(m_listen_fd, reinterpret_cast<sockaddr *>(&peer), &peer_len);
+    } while (m_conn_fd < 0 && errno == EINTR);
+
+    if (m_conn_fd < 0) {
+        throw std::runtime_error{
+            fmt::format("Can't accept gdb connection with errno: {}", std::strerror(errno))};
+    }
+
+    int nodelay = 1;
+    setsockopt(m_conn_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    myLogger.message(Logger::severity_level::standard, "Gdb", "debugger connected");
+
+    while (auto packet = read_packet()) {
+        std::string_view request = *packet;
+        myLogger.message(Logger::severity_level::verbose, "Gdb", request);
+
+        if (request.empty()) {
+            write_packet("");
+            continue;
+        }
+
+        std::string reply;
+        switch (request[0]) {
+            case '\x03':
+                reply = "S02";
+                break;
+            case '?':
+                reply = "S05";
+                break;
+            case 'q':
+            case 'Q':
+                reply = handle_query(request);
+                break;
+            case 'g':
+                reply = read_registers();
+                break;
+            case 'G':
+                reply = write_registers(request.substr(1));
+                break;
+            case 'p':
+                reply = read_register(request.substr(1));
+                break;
+            case 'P':
+                reply = write_register(request.substr(1));
+                break;
+            case 'm':
+                reply = read_memory(request.substr(1));
+                break;
+            case 'M':
+                reply = write_memory(request.substr(1));
+                break;
+            case 'H':
+                reply = "OK";
+                break;
+            case 'Z':
+                reply = handle_breakpoint(request.substr(1), true);
+                break;
+            case 'z':
+                reply = handle_breakpoint(request.substr(1), false);
+                break;
+            case 'c':
+            case 's': {
+                uint64_t addr;
+                if (request.size() > 1 && parse_hex(request.substr(1), addr)) {
+                    m_hart.set_pc(addr);
+                    m_hart.set_next_pc(addr + 4);
+                }
+                reply = resume(request[0] == 's');
+                break;
+            }
+            case 'D':
+                write_packet("OK");
+                myLogger.message(Logger::severity_level::standard, "Gdb", "debugger detached");
+                return true;
+            case 'k':
+                myLogger.message(Logger::severity_level::standard, "Gdb", "killed by debugger");
+                return false;
+            default:
+                break;  // an empty reply marks the packet as unsupported
+        }
+
+        write_packet(reply);
+        if (request == "QStartNoAckMode") {
+            m_no_ack = true;
+        }
+    }
+
+    myLogger.message(Logger::severity_level::standard, "Gdb", "debugger disconnected");
+    return false;
+}
+
+}  // namespace gdb
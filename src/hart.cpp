@@ -1,10 +1,18 @@
 #include "hart.hpp"
 
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstring>
 #include <exception>
 #include <ranges>
 #include <sstream>
 
+#include "aot.hpp"
 #include "elfio/elfio.hpp"
+#include "hash.hpp"
+#include "replay.hpp"
+#include "stats_page.hpp"
 
 namespace hart {
 
@@ -16,10 +24,26 @@ std::string Hart::format_registers() {
     return oss.str();
 }
 
-void Hart::load_elf_file(std::string &elf_file) {
+void Hart::load_elf_file(const std::string &elf_file) {
+    ELFIO::elfio reader;
+    if (!reader.load(elf_file)) {
+        throw std::runtime_error{"Can't load elf file " + elf_file};
+    }
+    load_elf(reader, elf_file);
+}
+
+void Hart::load_elf_image(std::span<const std::byte> elf_image) {
+    std::istringstream stream{
+        std::string{reinterpret_cast<const char *>(elf_image.data()), elf_image.size()}};
+
     ELFIO::elfio reader;
-    reader.load(elf_file);
+    if (!reader.load(stream)) {
+        throw std::runtime_error{"Can't load elf image from memory"};
+    }
+    load_elf(reader);
+}
 
+void Hart::load_elf(ELFIO::elfio &reader, const std::string &elf_file) {
     if (reader.get_class() != ELFIO::ELFCLASS64) {
         throw std::runtime_error{"Elf file class doesn't match with ELFCLASS64"};
     }
@@ -28,9 +52,29 @@ void Hart::load_elf_file(std::string &elf_file) {
         return segment->get_type() == ELFIO::PT_LOAD;
     };
 
+    // memory starts zeroed, so the bss part past the file data needs no copy
     for (auto &segment : reader.segments | std::views::filter(is_segment_loadable)) {
-        m_mem.store(segment->get_virtual_address(), segment->get_data(),
-                    segment->get_memory_size());
+        addr_t addr = segment->get_virtual_address();
+        if (addr > m_mem.size() || segment->get_memory_size() > m_mem.size() - addr) {
+            throw std::runtime_error{
+                fmt::format("Segment at {:#x} of {:#x} bytes doesn't fit into memory", addr,
+                            segment->get_memory_size())};
+        }
+        m_mem.store(addr, segment->get_data(), segment->get_file_size());
+    }
+
+    // executable segments are predecoded, each one after the first persists into a file named
+    // after its address
+    for (auto &segment : reader.segments | std::views::filter(is_segment_loadable)) {
+        if (segment->get_flags() & ELFIO::PF_X) {
+            addr_t addr = segment->get_virtual_address();
+            std::string persist_file;
+            if (!elf_file.empty()) {
+                persist_file = m_code.empty() ? elf_file + ".decoded"
+                                              : fmt::format("{}.{:x}.decoded", elf_file, addr);
+            }
+            attach_code(addr, segment->get_file_size(), persist_file);
+        }
     }
 
     auto start_pc = reader.get_entry();
@@ -40,19 +84,493 @@ void Hart::load_elf_file(std::string &elf_file) {
     set_reg(2, 0x90000);
 }
 
+void Hart::load_code(std::span<const std::byte> code, addr_t load_addr) {
+    if (!write_memory(load_addr, code.data(), code.size())) {
+        throw std::runtime_error{"Code blob doesn't fit into memory"};
+    }
+
+    attach_code(load_addr, code.size(), "");
+
+    m_pc = load_addr;
+    m_pc_next = load_addr + 4;
+
+    set_reg(2, 0x90000);
+}
+
+void Hart::attach_code(addr_t addr, size_t size, const std::string &persist_file) {
+    if (addr > m_mem.size() || size > m_mem.size() - addr || size == 0) {
+        return;
+    }
+
+    predecode(m_code.emplace_back(CodeSegment{addr, size, persist_file}), true);
+}
+
+void Hart::predecode(CodeSegment &segment, bool parallel) {
+    segment.code = codecache::CodeStore::getInstance().get(
+        {m_mem.data() + segment.begin, segment.length}, segment.begin, segment.persist_file, parallel);
+    segment.size = segment.code ? segment.code->size_bytes() : 0;
+    segment.stale_pages.assign(
+        (segment.size + memory::Memory::page_size - 1) / memory::Memory::page_size, false);
+    segment.stale = false;
+}
+
+void Hart::reattach_code() {
+    // rewritten text is decoded while the other harts run, spawning threads for it doesn't pay
+    for (auto &segment : m_code) {
+        predecode(segment, false);
+    }
+    m_predictor.forget_targets();
+}
+
+void Hart::stale_code(CodeSegment &segment, addr_t addr, size_t count) noexcept {
+    addr_t first = std::max(addr, segment.begin) - segment.begin;
+    addr_t last = std::min(addr + count, segment.begin + segment.size) - 1 - segment.begin;
+    for (addr_t page = first / memory::Memory::page_size;
+         page <= last / memory::Memory::page_size; ++page) {
+        segment.stale_pages[page] = true;
+    }
+    segment.stale = true;
+    ++m_code_writes;
+}
+
+void Hart::forget_aot_on_write(addr_t addr, size_t count) noexcept {
+    if (m_aot->covers(addr, count)) {
+        m_aot = nullptr;
+    }
+}
+
 uint64_t Hart::get_pc() const noexcept { return m_pc; }
 
 uint64_t Hart::get_pc_next() const noexcept { return m_pc_next; }
 
-reg_t Hart::get_reg(reg_id_t reg_id) const { return m_regfile[reg_id]; }
-
 void Hart::set_pc(addr_t pc) noexcept { m_pc = pc; }
 
 void Hart::set_next_pc(addr_t pc_next) noexcept { m_pc_next = pc_next; }
 
 void Hart::set_reg(reg_id_t reg_id, reg_t value) {
-    m_regfile[reg_id] = value;
-    m_regfile[0] = 0;
+    if (reg_id != 0) {
+        set_rd(reg_id, value);
+    }
 };
 
+Snapshot Hart::snapshot(bool with_memory) const {
+    Snapshot snapshot{m_pc, m_pc_next, m_regfile, m_csrs, m_reservation, {},
+                      m_mem.save_device_states()};
+    if (with_memory) {
+        snapshot.memory.resize(m_mem.size());
+        m_mem.load(0, snapshot.memory.data(), snapshot.memory.size());
+    }
+    return snapshot;
+}
+
+void Hart::restore_state(const Snapshot &snapshot) {
+    m_pc = snapshot.pc;
+    m_pc_next = snapshot.pc_next;
+    m_regfile = snapshot.regfile;
+    set_csrs(snapshot.csrs);
+    m_reservation = snapshot.reservation;
+    m_trap_pending = false;
+    m_prev_location = 0;
+    m_mem.restore_device_states(snapshot.devices);
+}
+
+void Hart::restore(const Snapshot &snapshot) {
+    if (snapshot.memory.size() != m_mem.size()) {
+        throw std::runtime_error{"Snapshot memory size doesn't match with hart memory size"};
+    }
+
+    restore_state(snapshot);
+    m_mem.store(0, snapshot.memory.data(), snapshot.memory.size());
+    m_mem.clear_dirty_pages();
+    reattach_code();
+}
+
+void Hart::track_dirty_pages() { m_mem.track_dirty_pages(); }
+
+void Hart::restore_dirty(const Snapshot &snapshot) {
+    if (snapshot.memory.size() != m_mem.size()) {
+        throw std::runtime_error{"Snapshot memory size doesn't match with hart memory size"};
+    }
+    if (!m_mem.tracks_dirty_pages()) {
+        restore(snapshot);
+        return;
+    }
+
+    restore_state(snapshot);
+    m_mem.for_each_dirty_page([&](size_t offset) {
+        m_mem.store(offset, snapshot.memory.data() + offset,
+                    std::min(memory::Memory::page_size, m_mem.size() - offset));
+    });
+    m_mem.clear_dirty_pages();
+    // text that wasn't written is what it was attached from
+    if (has_stale_code()) {
+        reattach_code();
+    }
+}
+
+std::vector<PageCopy> Hart::take_dirty_pages() {
+    std::vector<PageCopy> pages;
+    m_mem.for_each_dirty_page([&](size_t offset) {
+        size_t size = std::min(memory::Memory::page_size, m_mem.size() - offset);
+        PageCopy &page = pages.emplace_back(PageCopy{offset, std::vector<uint8_t>(size)});
+        m_mem.load(offset, page.bytes.data(), page.bytes.size());
+    });
+    m_mem.clear_dirty_pages();
+    return pages;
+}
+
+void Hart::write_pages(std::span<const PageCopy> pages) {
+    for (const PageCopy &page : pages) {
+        if (page.addr > m_mem.size() || page.bytes.size() > m_mem.size() - page.addr) {
+            throw std::runtime_error{
+                fmt::format("Page at {:#x} doesn't fit into memory", page.addr)};
+        }
+        stale_code_on_write(page.addr, page.bytes.size());
+        m_mem.store(page.addr, page.bytes.data(), page.bytes.size());
+    }
+}
+
+uint64_t Hart::state_digest() {
+    uint64_t digest = m_mem.digest();
+    for (uint64_t reg : m_regfile) {
+        digest = hashing::mix64(digest ^ reg);
+    }
+    digest = hashing::mix64(digest ^ m_pc);
+    digest = hashing::mix64(digest ^ m_pc_next);
+    digest = hashing::mix64(digest ^ hashing::hash_bytes({reinterpret_cast<const uint8_t *>(&m_csrs),
+                                                          sizeof(m_csrs)}));
+    return hashing::mix64(digest ^
+                          hashing::hash_bytes({reinterpret_cast<const uint8_t *>(&m_reservation),
+                                               sizeof(m_reservation)}));
+}
+
+void Hart::raise_trap(TrapCause cause, uint64_t tval) noexcept {
+    m_trap_pending = true;
+    m_trap = {cause, tval, m_pc};
+}
+
+bool Hart::enter_trap() {
+    auto cause = static_cast<uint64_t>(m_trap.cause);
+    csr::Privilege from = m_csrs.privilege;
+    uint64_t &status = m_csrs.mstatus;
+
+    addr_t vector;
+    if (from != csr::Privilege::machine && ((m_csrs.medeleg >> cause) & 1)) {
+        vector = m_csrs.stvec & ~uint64_t(3);
+        if (vector == 0) {
+            return false;
+        }
+        m_csrs.sepc = m_trap.epc;
+        m_csrs.scause = cause;
+        m_csrs.stval = m_trap.tval;
+        status = (status & ~(csr::kStatusSpie | csr::kStatusSpp | csr::kStatusSie)) |
+                 ((status & csr::kStatusSie) ? csr::kStatusSpie : 0) |
+                 (from == csr::Privilege::supervisor ? csr::kStatusSpp : 0);
+        m_csrs.privilege = csr::Privilege::supervisor;
+    } else {
+        // vectored mode only differs for interrupts
+        vector = m_csrs.mtvec & ~uint64_t(3);
+        if (vector == 0) {
+            return false;
+        }
+        m_csrs.mepc = m_trap.epc;
+        m_csrs.mcause = cause;
+        m_csrs.mtval = m_trap.tval;
+        status = (status & ~(csr::kStatusMpie | csr::kStatusMpp | csr::kStatusMie)) |
+                 ((status & csr::kStatusMie) ? csr::kStatusMpie : 0) |
+                 (static_cast<uint64_t>(from) << csr::kStatusMppShift);
+        m_csrs.privilege = csr::Privilege::machine;
+    }
+
+    // the handler may run code that pairs with an earlier lr, e.g. after a context switch
+    m_reservation = {};
+    m_pc = vector;
+    m_pc_next = vector + 4;
+    update_translation();
+    if (m_run_retired) {
+        ++m_run_traps;
+    }
+    if (m_stats) {
+        m_stats->count_trap();
+    }
+    return true;
+}
+
+bool Hart::trap_return(csr::Privilege level) {
+    if (m_csrs.privilege < level) {
+        return false;
+    }
+
+    uint64_t &status = m_csrs.mstatus;
+    csr::Privilege to;
+    if (level == csr::Privilege::machine) {
+        to = static_cast<csr::Privilege>((status & csr::kStatusMpp) >> csr::kStatusMppShift);
+        status = (status & ~(csr::kStatusMie | csr::kStatusMpp)) |
+                 ((status & csr::kStatusMpie) ? csr::kStatusMie : 0) | csr::kStatusMpie;
+        m_pc_next = m_csrs.mepc;
+    } else {
+        to = (status & csr::kStatusSpp) ? csr::Privilege::supervisor : csr::Privilege::user;
+        status = (status & ~(csr::kStatusSie | csr::kStatusSpp)) |
+                 ((status & csr::kStatusSpie) ? csr::kStatusSie : 0) | csr::kStatusSpie;
+        m_pc_next = m_csrs.sepc;
+    }
+    if (to != csr::Privilege::machine) {
+        status &= ~csr::kStatusMprv;
+    }
+
+    m_csrs.privilege = to;
+    update_translation();
+    return true;
+}
+
+bool Hart::counter_enabled(uint16_t csr) const noexcept {
+    uint64_t bit = uint64_t(1) << (csr - csr::kCycle);
+    switch (m_csrs.privilege) {
+        case csr::Privilege::machine: return true;
+        case csr::Privilege::supervisor: return m_csrs.mcounteren & bit;
+        default: return m_csrs.mcounteren & m_csrs.scounteren & bit;
+    }
+}
+
+bool Hart::read_csr(uint16_t csr, uint64_t &value) {
+    if (m_csrs.privilege < csr::min_privilege(csr)) {
+        return false;
+    }
+
+    switch (csr) {
+        case csr::kCycle:
+        case csr::kTime:
+        case csr::kInstret:
+            if (!counter_enabled(csr)) {
+                return false;
+            }
+            value = csr == csr::kCycle  ? m_csrs.mcycle + running_retired()
+                    : csr == csr::kTime ? time()
+                                        : instret();
+            break;
+        case csr::kSstatus: value = m_csrs.mstatus & csr::kSstatusMask; break;
+        case csr::kSie: value = m_csrs.mie & m_csrs.mideleg; break;
+        case csr::kStvec: value = m_csrs.stvec; break;
+        case csr::kScounteren: value = m_csrs.scounteren; break;
+        case csr::kSscratch: value = m_csrs.sscratch; break;
+        case csr::kSepc: value = m_csrs.sepc; break;
+        case csr::kScause: value = m_csrs.scause; break;
+        case csr::kStval: value = m_csrs.stval; break;
+        case csr::kSip: value = m_csrs.mip & m_csrs.mideleg; break;
+        case csr::kSatp: value = m_csrs.satp; break;
+        case csr::kMstatus: value = m_csrs.mstatus; break;
+        case csr::kMisa: value = csr::kMisaValue; break;
+        case csr::kMedeleg: value = m_csrs.medeleg; break;
+        case csr::kMideleg: value = m_csrs.mideleg; break;
+        case csr::kMie: value = m_csrs.mie; break;
+        case csr::kMtvec: value = m_csrs.mtvec; break;
+        case csr::kMcounteren: value = m_csrs.mcounteren; break;
+        case csr::kMscratch: value = m_csrs.mscratch; break;
+        case csr::kMepc: value = m_csrs.mepc; break;
+        case csr::kMcause: value = m_csrs.mcause; break;
+        case csr::kMtval: value = m_csrs.mtval; break;
+        case csr::kMip: value = m_csrs.mip; break;
+        case csr::kMcycle: value = m_csrs.mcycle + running_retired(); break;
+        case csr::kMinstret: value = instret(); break;
+        case csr::kMvendorid:
+        case csr::kMarchid:
+        case csr::kMimpid:
+        case csr::kMhartid: value = 0; break;
+        default: return false;
+    }
+    return true;
+}
+
+bool Hart::write_csr(uint16_t csr, uint64_t value) {
+    if (m_csrs.privilege < csr::min_privilege(csr) || csr::is_read_only(csr)) {
+        return false;
+    }
+
+    // WARL fields keep their old value, or the closest legal one, on illegal writes
+    auto merge = [](uint64_t old_value, uint64_t new_value, uint64_t mask) {
+        return (old_value & ~mask) | (new_value & mask);
+    };
+    uint64_t supervisor_interrupts = m_csrs.mideleg & csr::kSupervisorInterrupts;
+
+    switch (csr) {
+        case csr::kSstatus:
+            m_csrs.mstatus = merge(m_csrs.mstatus, value, csr::kSstatusMask & csr::kMstatusWritable);
+            break;
+        case csr::kSie: m_csrs.mie = merge(m_csrs.mie, value, supervisor_interrupts); break;
+        case csr::kStvec: m_csrs.stvec = value & ~uint64_t(2); break;
+        case csr::kScounteren: m_csrs.scounteren = value & csr::kCounterenMask; break;
+        case csr::kSscratch: m_csrs.sscratch = value; break;
+        case csr::kSepc: m_csrs.sepc = value & ~uint64_t(3); break;
+        case csr::kScause: m_csrs.scause = value; break;
+        case csr::kStval: m_csrs.stval = value; break;
+        case csr::kSip: m_csrs.mip = merge(m_csrs.mip, value, supervisor_interrupts); break;
+        case csr::kSatp: {
+            uint64_t mode = value >> csr::kSatpModeShift;
+            if (mode != csr::kSatpModeBare && mode != csr::kSatpModeSv39) {
+                break;
+            }
+            m_csrs.satp = value & ((uint64_t(0xf) << csr::kSatpModeShift) |
+                                   (csr::kSatpAsidMask << csr::kSatpAsidShift) |
+                                   csr::kSatpPpnMask);
+            break;
+        }
+        case csr::kMstatus: {
+            // MPP can't hold the reserved mode 2
+            if (((value & csr::kStatusMpp) >> csr::kStatusMppShift) == 2) {
+                value &= ~csr::kStatusMpp;
+            }
+            m_csrs.mstatus = merge(m_csrs.mstatus, value, csr::kMstatusWritable);
+            break;
+        }
+        case csr::kMisa: break;
+        case csr::kMedeleg: m_csrs.medeleg = value & csr::kMedelegWritable; break;
+        case csr::kMideleg: m_csrs.mideleg = value & csr::kSupervisorInterrupts; break;
+        case csr::kMie: m_csrs.mie = value & csr::kInterrupts; break;
+        case csr::kMtvec: m_csrs.mtvec = value & ~uint64_t(2); break;
+        case csr::kMcounteren: m_csrs.mcounteren = value & csr::kCounterenMask; break;
+        case csr::kMscratch: m_csrs.mscratch = value; break;
+        case csr::kMepc: m_csrs.mepc = value & ~uint64_t(3); break;
+        case csr::kMcause: m_csrs.mcause = value; break;
+        case csr::kMtval: m_csrs.mtval = value; break;
+        case csr::kMip: m_csrs.mip = merge(m_csrs.mip, value, csr::kSupervisorInterrupts); break;
+        // the writing instruction still retires, the next one reads the written value
+        case csr::kMcycle: m_csrs.mcycle = value - running_retired() - 1; break;
+        case csr::kMinstret: m_csrs.minstret = value - running_retired() - 1; break;
+        default: return false;
+    }
+
+    update_translation();
+    return true;
+}
+
+void Hart::fence_vma(std::optional<addr_t> addr, std::optional<uint16_t> asid) noexcept {
+    std::optional<uint64_t> vpn;
+    if (addr) {
+        vpn = *addr >> mmu::kPageShift;
+    }
+    m_itlb.flush(vpn, asid);
+    m_dtlb.flush(vpn, asid);
+}
+
+void Hart::set_csrs(const csr::State &csrs) noexcept {
+    m_csrs = csrs;
+    m_itlb.flush();
+    m_dtlb.flush();
+    update_translation();
+}
+
+void Hart::update_translation() noexcept {
+    bool sv39 = (m_csrs.satp >> csr::kSatpModeShift) == csr::kSatpModeSv39;
+    csr::Privilege privilege = m_csrs.privilege;
+    csr::Privilege data_privilege = privilege;
+    if (privilege == csr::Privilege::machine && (m_csrs.mstatus & csr::kStatusMprv)) {
+        data_privilege = static_cast<csr::Privilege>((m_csrs.mstatus & csr::kStatusMpp) >>
+                                                     csr::kStatusMppShift);
+    }
+
+    m_translate_fetch = sv39 && privilege != csr::Privilege::machine;
+    m_translate_data = sv39 && data_privilege != csr::Privilege::machine;
+    m_asid = (m_csrs.satp >> csr::kSatpAsidShift) & csr::kSatpAsidMask;
+
+    bool sum = m_csrs.mstatus & csr::kStatusSum;
+    bool mxr = m_csrs.mstatus & csr::kStatusMxr;
+    m_permissions[static_cast<size_t>(mmu::Access::fetch)] =
+        mmu::permission(mmu::Access::fetch, privilege, sum, mxr);
+    m_permissions[static_cast<size_t>(mmu::Access::load)] =
+        mmu::permission(mmu::Access::load, data_privilege, sum, mxr);
+    m_permissions[static_cast<size_t>(mmu::Access::store)] =
+        mmu::permission(mmu::Access::store, data_privilege, sum, mxr);
+}
+
+bool Hart::translate_miss(addr_t addr, mmu::Access access, addr_t &paddr) {
+    static constexpr std::array<TrapCause, mmu::kAccessNum> kPageFaults{
+        TrapCause::instruction_page_fault, TrapCause::load_page_fault,
+        TrapCause::store_page_fault};
+    static constexpr std::array<TrapCause, mmu::kAccessNum> kAccessFaults{
+        TrapCause::instruction_access_fault, TrapCause::load_access_fault,
+        TrapCause::store_access_fault};
+    auto index = static_cast<size_t>(access);
+
+    addr_t page;
+    uint16_t flags;
+    switch (mmu::walk(m_mem, m_csrs.satp, addr, page, flags)) {
+        case mmu::WalkResult::ok:
+            break;
+        case mmu::WalkResult::page_fault:
+            raise_trap(kPageFaults[index], addr);
+            return false;
+        case mmu::WalkResult::access_fault:
+            raise_trap(kAccessFaults[index], addr);
+            return false;
+    }
+
+    flags = mmu::entry_flags(flags);
+    if (!m_permissions[index].allows(flags)) {
+        raise_trap(kPageFaults[index], addr);
+        return false;
+    }
+    (access == mmu::Access::fetch ? m_itlb : m_dtlb)
+        .insert(addr >> mmu::kPageShift, m_asid, page, flags);
+    paddr = page | (addr & mmu::kPageOffsetMask);
+    return true;
+}
+
+uint64_t Hart::input(uint64_t host_value) {
+    return m_session ? m_session->input(host_value) : host_value;
+}
+
+uint64_t Hart::time() {
+    if (m_virtual_time) {
+        return instret() / g_virtual_tick_instructions;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - m_time_origin;
+    return input(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() /
+                 (1'000'000'000 / g_timer_frequency));
+}
+
+uint8_t *Hart::host_pointer(addr_t addr, size_t count) noexcept {
+    if (addr > m_mem.size() || count > m_mem.size() - addr) {
+        return nullptr;
+    }
+    // the host may write text through it, which has to be decoded again
+    stale_code_on_write(addr, count);
+    m_mem.touch(addr, count);
+    return m_mem.data() + addr;
+}
+
+bool Hart::read_memory(addr_t addr, void *dst, size_t count) const {
+    if (addr > m_mem.size() || count > m_mem.size() - addr) {
+        return false;
+    }
+    m_mem.load(addr, dst, count);
+    return true;
+}
+
+bool Hart::write_memory(addr_t addr, const void *src, size_t count) {
+    if (addr > m_mem.size() || count > m_mem.size() - addr) {
+        return false;
+    }
+    stale_code_on_write(addr, count);
+    m_mem.store(addr, src, count);
+    return true;
+}
+
+void Hart::add_breakpoint(addr_t pc) {
+    m_breakpoints.insert(pc);
+    size_t bit = breakpoint_filter_bit(pc);
+    m_breakpoint_filter[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+void Hart::remove_breakpoint(addr_t pc) {
+    if (m_breakpoints.erase(pc) == 0) {
+        return;
+    }
+
+    m_breakpoint_filter.fill(0);
+    for (auto breakpoint : m_breakpoints) {
+        size_t bit = breakpoint_filter_bit(breakpoint);
+        m_breakpoint_filter[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
 }  // namespace hart
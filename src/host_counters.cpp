@@ -0,0 +1,104 @@
+#include "host_counters.hpp"
+
+#include <fmt/format.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace hostperf {
+
+namespace {
+
+constexpr uint64_t hw_cache_miss(uint64_t cache, uint64_t op) {
+    return cache | (op << 8) | (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+}
+
+int open_counter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+
+    // kernel side counts are often not allowed to unprivileged users, user space ones still are
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+}  // namespace
+
+HostCounters::HostCounters() {
+    m_fds[dtlb_load_misses] = open_counter(
+        PERF_TYPE_HW_CACHE, hw_cache_miss(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ));
+    m_fds[dtlb_store_misses] = open_counter(
+        PERF_TYPE_HW_CACHE, hw_cache_miss(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE));
+    m_fds[itlb_misses] = open_counter(
+        PERF_TYPE_HW_CACHE, hw_cache_miss(PERF_COUNT_HW_CACHE_ITLB, PERF_COUNT_HW_CACHE_OP_READ));
+    m_fds[page_faults] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+}
+
+HostCounters::~HostCounters() {
+    for (int fd : m_fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void HostCounters::start() {
+    for (int fd : m_fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    m_start = std::chrono::steady_clock::now();
+}
+
+void HostCounters::stop() {
+    m_elapsed = std::chrono::steady_clock::now() - m_start;
+    for (int fd : m_fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+std::optional<uint64_t> HostCounters::read(Counter counter) const {
+    uint64_t value;
+    if (m_fds[counter] < 0 || ::read(m_fds[counter], &value, sizeof(value)) != sizeof(value)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::string HostCounters::format(std::optional<uint64_t> instructions) const {
+    constexpr std::array<const char *, kCounterNum> kNames = {
+        "dTLB load misses", "dTLB store misses", "iTLB misses", "page faults"};
+
+    double seconds = std::chrono::duration<double>(m_elapsed).count();
+    std::string text = fmt::format("{:.3f} s", seconds);
+    if (instructions) {
+        text += fmt::format(", {} instructions, {:.1f} MIPS", *instructions,
+                            seconds > 0 ? *instructions / seconds / 1e6 : 0.0);
+    }
+
+    for (size_t counter = 0; counter < kCounterNum; ++counter) {
+        auto value = read(static_cast<Counter>(counter));
+        text += value ? fmt::format(", {}: {}", kNames[counter], *value)
+                      : fmt::format(", {}: n/a", kNames[counter]);
+    }
+    return text;
+}
+
+}  // namespace hostperf
@@ -29,10 +29,30 @@ void Logger::init(severity_level log_level) {
     boost::log::core::get()->add_sink(sink);
 
     boost::log::add_common_attributes();
+    m_initialized = true;
 }
 
+void Logger::init_async(severity_level log_level, size_t ring_capacity,
+                        AsyncSink::overflow_policy policy) {
+    m_log_level = log_level;
+    m_async_sink = std::make_unique<AsyncSink>("full.log", ring_capacity, policy);
+    m_initialized = true;
+}
+
+uint64_t Logger::dropped_messages() { return m_async_sink ? m_async_sink->dropped() : 0; }
+
 void Logger::message(severity_level level, const std::string_view& module_name,
                      const std::string_view& message) {
+    if (!m_initialized) {
+        return;
+    }
+    if (m_async_sink) {
+        if (level <= m_log_level) {
+            m_async_sink->push(module_name, message);
+        }
+        return;
+    }
+
     BOOST_LOG_SEV(Logger::getLogger(), level)
         << boost::log::add_value("log_level", severity_levels[level].name) << module_name << ": "
         << message;
@@ -1,9 +1,40 @@
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 
 #include "CLI/CLI.hpp"
+#include "aot.hpp"
+#include "code_cache.hpp"
+#include "delta_trace.hpp"
 #include "executor.hpp"
+#include "gdb_server.hpp"
 #include "hart.hpp"
+#include "host_counters.hpp"
 #include "logger.hpp"
+#include "mmio.hpp"
+#ifdef SIM_MEMORY_PROFILER
+#include "mem_profiler.hpp"
+#endif
+#include "replay.hpp"
+#include "scheduler.hpp"
+#include "stats_page.hpp"
+
+namespace {
+
+// the block predictor is only consulted by the fast run paths, the detailed run has no hits
+std::string format_predictions(const predictor::PredictorStats &stats) {
+    return fmt::format("returns predicted {}/{}, indirect jumps predicted {}/{}",
+                       stats.return_hits, stats.return_hits + stats.return_misses,
+                       stats.indirect_hits, stats.indirect_hits + stats.indirect_misses);
+}
+
+}  // namespace
 
 int main(int argc, char **argv) {
     CLI::App app{"RISV RV64_I simulator"};
@@ -16,18 +47,384 @@ int main(int argc, char **argv) {
     app.add_option("-l,--log_severity", log_level,
                    "Sets log level:\n"
                    "\t0: standard\n"
-                   "\t1: verbose\n"
+                   "\t1: verbose, single-hart runs also log every instruction\n"
                    "default = standard")
         ->default_val(Logger::severity_level::standard)
         ->check(CLI::Range(Logger::severity_level::standard, Logger::severity_level::verbose));
 
+    bool async_log = false;
+    app.add_flag("--async_log", async_log,
+                 "Writes the log from a background thread through per-thread ring buffers");
+
+    AsyncSink::overflow_policy log_overflow;
+    app.add_option("--log_overflow", log_overflow,
+                   "Sets async log behaviour on a full ring buffer:\n"
+                   "\t0: block\n"
+                   "\t1: drop\n"
+                   "\t2: drop and count\n"
+                   "default = block")
+        ->default_val(AsyncSink::overflow_policy::block)
+        ->check(CLI::Range(0, 2));
+
+    size_t log_ring_size = 1 << 20;
+    app.add_option("--log_ring_size", log_ring_size, "Async log ring buffer size per thread")
+        ->default_val(log_ring_size)
+        ->check(CLI::PositiveNumber);
+
+    executor::SamplingConfig sampling{};
+    app.add_option("--fast_forward", sampling.fast_forward,
+                   "Instructions executed without instrumentation before each detailed window");
+    app.add_option("--detail_window", sampling.detail_window,
+                   "Instructions executed with full instrumentation per sampling period");
+    app.add_option("--bbv_file", sampling.bbv_file,
+                   "Writes SimPoint basic-block vectors to the given file");
+    app.add_option("--bbv_interval", sampling.bbv_interval, "Instructions per bbv interval")
+        ->default_val(sampling.bbv_interval)
+        ->check(CLI::PositiveNumber);
+
+    std::string delta_trace_file;
+    app.add_option("--delta_trace", delta_trace_file,
+                   "Writes register and memory changes of every instruction to a binary trace "
+                   "instead of verbose register dumps");
+
+    uint64_t trace_keyframe_interval = 10000;
+    app.add_option("--trace_keyframe_interval", trace_keyframe_interval,
+                   "Instructions between full register keyframes in the delta trace")
+        ->default_val(trace_keyframe_interval)
+        ->check(CLI::PositiveNumber);
+
+    std::string record_file;
+    auto *record_option = app.add_option(
+        "--record", record_file, "Runs the program and saves a record/replay recording");
+
+    std::string replay_file;
+    app.add_option("--replay", replay_file, "Replays a recording up to the --seek instruction")
+        ->check(CLI::ExistingFile)
+        ->excludes(record_option);
+
+    uint64_t seek_index = 0;
+    app.add_option("--seek", seek_index, "Instruction the replay stops in front of");
+
+    uint64_t replay_keyframe_interval = 1000000;
+    app.add_option("--replay_keyframe_interval", replay_keyframe_interval,
+                   "Instructions between hart snapshots in a recording, bounds seek latency")
+        ->default_val(replay_keyframe_interval)
+        ->check(CLI::PositiveNumber);
+
+    uint16_t gdb_port = 0;
+    app.add_option("--gdb_port", gdb_port,
+                   "Waits for gdb remote protocol connection on the given localhost port");
+
+    bool decoded_cache = false;
+    app.add_flag("--decoded_cache", decoded_cache,
+                 "Keeps the predecoded text segment in <file>.decoded for the next runs");
+
+    size_t decode_threads = std::max(1u, std::thread::hardware_concurrency());
+    app.add_option("--decode_threads", decode_threads,
+                   "Threads predecoding a large text segment in parallel chunks at load time")
+        ->default_val(decode_threads)
+        ->check(CLI::PositiveNumber);
+
+    codecache::BlockOpt block_opt = codecache::BlockOpt::off;
+    app.add_option("--block_opt", block_opt,
+                   "Optimizes the predecoded blocks:\n"
+                   "\t0: off\n"
+                   "\t1: on\n"
+                   "\t2: verify, checks every optimized block against the decoded one "
+                   "instead of running it\n"
+                   "default = off")
+        ->default_val(codecache::BlockOpt::off)
+        ->check(CLI::Range(0, 2));
+
+#ifdef SIM_MEMORY_PROFILER
+    memprof::ProfilerConfig mem_profile{};
+    app.add_option("--mem_profile", mem_profile.report_file,
+                   "Writes a memory access report and a per-window page heatmap csv next to it");
+    app.add_option("--mem_profile_window", mem_profile.window,
+                   "Memory accesses per working-set window of the memory profile")
+        ->default_val(mem_profile.window)
+        ->check(CLI::PositiveNumber);
+    app.add_option("--mem_profile_sample", mem_profile.sample_period,
+                   "One cache line out of this many is followed for reuse distances")
+        ->default_val(mem_profile.sample_period)
+        ->check(CLI::PositiveNumber);
+#endif
+
+    size_t mem_size = memory::Memory::default_mem_size;
+    app.add_option("--mem_size", mem_size, "Guest memory size in bytes")
+        ->default_val(mem_size)
+        ->check(CLI::PositiveNumber);
+
+    memory::Backing backing{};
+    auto *huge_pages_option = app.add_option("--huge_pages", backing.huge_pages,
+                   "Backs guest memory with huge pages:\n"
+                   "\t0: none\n"
+                   "\t1: transparent\n"
+                   "\t2: hugetlb, transparent if the reserved pool is empty\n"
+                   "default = none")
+        ->default_val(memory::HugePages::none)
+        ->check(CLI::Range(0, 2));
+
+    app.add_option("--shared_memory", backing.shared_name,
+                   "Backs guest memory with /dev/shm/<name>, which other processes can map to "
+                   "read results or write input while the program runs and after it exits; "
+                   "--batch harts get <name>.<hart>")
+        ->excludes(huge_pages_option);
+
+    auto *numa_node_option =
+        app.add_option("--numa_node", backing.numa_node, "Binds guest memory to this NUMA node")
+            ->check(CLI::NonNegativeNumber);
+    bool numa_local = false;
+    app.add_flag("--numa_local", numa_local,
+                 "Binds guest memory to the NUMA node of the thread running the hart")
+        ->excludes(numa_node_option);
+
+    bool host_counters = false;
+    app.add_flag("--host_counters", host_counters,
+                 "Reports host TLB misses, page faults and the simulation speed at exit");
+
+    bool print_digest = false;
+    app.add_flag("--print_digest", print_digest,
+                 "Prints a hash of the final pc, registers and memory to stdout");
+
+    bool aot = false;
+    app.add_flag("--aot", aot,
+                 "Runs the program from a translation of its text into a shared object, which is "
+                 "built next to the elf file on first use");
+
+    std::string aot_compiler = "c++";
+    app.add_option("--aot_compiler", aot_compiler, "C++ compiler building the --aot module")
+        ->default_val(aot_compiler);
+
+    bool mmio_devices = false;
+    app.add_flag("--mmio_devices", mmio_devices,
+                 "Maps a 16550 UART writing to stdout at 0x10000000 and a CLINT timer at "
+                 "0x2000000, loads and stores there fault otherwise");
+
+    bool virtual_time = false;
+    app.add_flag("--virtual_time", virtual_time,
+                 "Derives the time csr and mtime from retired instructions instead of the host "
+                 "clock, one 10 MHz tick per 10 instructions, so runs read the same times");
+
+    size_t batch = 0;
+    app.add_option("--batch", batch,
+                   "Runs the given number of independent copies of the program on a thread pool");
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    app.add_option("--threads", threads, "Host threads running the --batch harts")
+        ->default_val(threads)
+        ->check(CLI::PositiveNumber);
+
+    uint64_t quantum = 100000;
+    app.add_option("--quantum", quantum,
+                   "Instructions a --batch hart runs before it yields its thread to the next one")
+        ->default_val(quantum)
+        ->check(CLI::PositiveNumber);
+
+    std::string stats_page;
+    app.add_option("--stats_page", stats_page,
+                   "Publishes live instruction counts and speed of every hart in /dev/shm/<name> "
+                   "for sim-top");
+
     CLI11_PARSE(app, argc, argv);
+    // devices are mapped above RAM, the CLINT is the lowest one
+    if (mmio_devices && mem_size > mmio::kClintBase) {
+        return app.exit(CLI::ValidationError{
+            "--mem_size", fmt::format("{:#x} bytes reach into the --mmio_devices at {:#x}",
+                                      mem_size, mmio::kClintBase)});
+    }
+    // the name is a file in /dev/shm, not a path
+    const auto &shared_name = backing.shared_name;
+    if (shared_name.find('/') != std::string::npos || shared_name == "." || shared_name == "..") {
+        return app.exit(CLI::ValidationError{
+            "--shared_memory", fmt::format("'{}' is no file name in /dev/shm", shared_name)});
+    }
 
     Logger &myLogger = Logger::getInstance();
-    myLogger.init(log_level);
+    if (async_log) {
+        myLogger.init_async(log_level, log_ring_size, log_overflow);
+    } else {
+        myLogger.init(log_level);
+    }
     myLogger.message(Logger::standard, "main", "RISV RV64_I simulator");
 
-    hart::Hart hart{elf_file};
+    codecache::CodeStore::getInstance().set_persistent(decoded_cache);
+    codecache::CodeStore::getInstance().set_block_opt(block_opt);
+    codecache::CodeStore::getInstance().set_decode_threads(decode_threads);
+
+    std::optional<hostperf::HostCounters> counters;
+    if (host_counters) {
+        counters.emplace();
+        counters->start();
+    }
+
+    // shared by every hart, falls back to the interpreter if it can't be built
+    std::unique_ptr<aot::Module> aot_module;
+    if (aot) {
+        aot_module = aot::Module::load_or_build(elf_file, aot_compiler);
+    }
+
+    // mtime is the hart's time csr
+    auto map_devices = [mmio_devices, virtual_time](hart::Hart &target) {
+        target.set_virtual_time(virtual_time);
+        if (!mmio_devices) {
+            return;
+        }
+        target.map_device(mmio::kUartBase, mmio::kUartSize, std::make_unique<mmio::Uart16550>());
+        target.map_device(mmio::kClintBase, mmio::kClintSize,
+                          std::make_unique<mmio::Clint>([&target] { return target.time(); }));
+    };
+
+    std::optional<stats::Publisher> stats_publisher;
+    if (!stats_page.empty()) {
+        stats_publisher.emplace(stats_page, std::max<size_t>(batch, 1), elf_file);
+    }
+
+    if (batch != 0) {
+        std::atomic<uint64_t> instructions = 0;
+        {
+            sched::Scheduler scheduler{threads, quantum, numa_local};
+            for (size_t i = 0; i < batch; ++i) {
+                memory::Backing hart_backing = backing;
+                if (!backing.shared_name.empty()) {
+                    hart_backing.shared_name = fmt::format("{}.{}", backing.shared_name, i);
+                }
+                auto batch_hart =
+                    std::make_unique<hart::Hart>(elf_file, memory::Memory{mem_size, hart_backing});
+                batch_hart->attach_aot(aot_module.get());
+                map_devices(*batch_hart);
+                if (stats_publisher) {
+                    batch_hart->set_stats(&stats_publisher->slot(i));
+                }
+                scheduler.submit(
+                    std::move(batch_hart),
+                    [&myLogger, &instructions, print_digest](uint64_t id, hart::Hart &done,
+                                                             const executor::RunResult &result) {
+                        instructions += result.instructions;
+                        done.flush_devices();
+                        if (auto *slot = done.get_stats()) {
+                            slot->finish(result.reason == executor::StopReason::fault
+                                             ? stats::HartStatus::trapped
+                                             : stats::HartStatus::exited);
+                        }
+                        if (print_digest) {
+                            fmt::print("hart {}: {:016x}\n", id, done.state_digest());
+                        }
+
+                        std::string stop = "exited";
+                        if (result.reason == executor::StopReason::fault) {
+                            stop = fmt::format("trapped ({}) at {:#x}",
+                                               hart::trap_cause_name(done.get_trap().cause),
+                                               done.get_trap().epc);
+                        }
+                        myLogger.message(
+                            Logger::standard, "main",
+                            fmt::format("hart {} {} after {} instructions, {}{}", id, stop,
+                                        result.instructions,
+                                        format_predictions(done.get_predictor().stats()),
+                                        done.format_registers()));
+                    });
+            }
+            scheduler.wait();
+        }  // the workers are joined here, which adds their counts to the host counters
+
+        if (counters) {
+            counters->stop();
+            myLogger.message(Logger::standard, "main", counters->format(instructions.load()));
+        }
+        return 0;
+    }
+
+    if (numa_local) {
+        backing.numa_node = memory::kLocalNode;
+    }
+    hart::Hart hart{elf_file, memory::Memory{mem_size, backing}};
+    hart.attach_aot(aot_module.get());
+    map_devices(hart);
+    if (stats_publisher) {
+        hart.set_stats(&stats_publisher->slot(0));
+    }
+
+    std::optional<trace::DeltaTrace> delta_trace;
+    if (!delta_trace_file.empty()) {
+        delta_trace.emplace(delta_trace_file, trace_keyframe_interval);
+        hart.set_trace(&*delta_trace);
+    }
+
+#ifdef SIM_MEMORY_PROFILER
+    std::optional<memprof::MemoryProfiler> mem_profiler;
+    if (!mem_profile.report_file.empty()) {
+        mem_profiler.emplace(mem_profile, hart.memory_size());
+        hart.set_mem_profiler(&*mem_profiler);
+    }
+#endif
+
+    if (!record_file.empty()) {
+        replay::Session session{replay_keyframe_interval};
+        session.record(hart);
+        session.save(record_file);
+        return 0;
+    }
+
+    if (!replay_file.empty()) {
+        auto session = replay::Session::load(replay_file);
+        session.seek(hart, seek_index);
+        myLogger.message(Logger::standard, "main",
+                         fmt::format("replayed to instruction {} of {} pc: {:#x}{}",
+                                     session.position(), session.length(), hart.get_pc(),
+                                     hart.format_registers()));
+        if (gdb_port == 0) {
+            return 0;
+        }
+    }
+
+    if (gdb_port != 0) {
+        gdb::GdbServer server{hart, gdb_port};
+        if (!server.serve()) {
+            return 0;
+        }
+    }
+
+    bool completed;
+    // only the block engine and the translated code consult the predictor
+    bool predicted = false;
+    if (sampling.fast_forward != 0 || sampling.detail_window != 0 || !sampling.bbv_file.empty()) {
+        completed = executor::Executor::run_sampled(hart, sampling);
+    } else if (log_level == Logger::severity_level::verbose && !aot_module) {
+        // logs every instruction, the translated code has none to log
+        completed = executor::Executor::run(hart);
+    } else {
+        // breakpoints left from a gdb session don't stop the program any more
+        executor::RunResult result;
+        do {
+            result = executor::Executor::run(hart, std::numeric_limits<uint64_t>::max());
+        } while (result.reason == executor::StopReason::breakpoint);
+        predicted = true;
+        completed = result.reason != executor::StopReason::fault;
+        if (!completed) {
+            const auto &trap = hart.get_trap();
+            myLogger.message(Logger::standard, "main",
+                             fmt::format("trap: {} epc: {:#x} tval: {:#x}",
+                                         hart::trap_cause_name(trap.cause), trap.epc, trap.tval));
+        }
+    }
 
-    executor::Executor::run(hart);
+    hart.flush_devices();
+    if (predicted) {
+        myLogger.message(Logger::standard, "main",
+                         format_predictions(hart.get_predictor().stats()));
+    }
+    if (stats_publisher) {
+        stats_publisher->slot(0).finish(completed ? stats::HartStatus::exited
+                                                  : stats::HartStatus::trapped);
+    }
+    if (counters) {
+        counters->stop();
+        // minstret of a fresh hart counts every instruction it retired
+        myLogger.message(Logger::standard, "main", counters->format(hart.instret()));
+    }
+    if (print_digest) {
+        fmt::print("{:016x}\n", hart.state_digest());
+    }
+    return completed ? 0 : 1;
 }
@@ -0,0 +1,221 @@
+#include "mem_profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <stdexcept>
+
+#include "logger.hpp"
+
+namespace memprof {
+
+MemoryProfiler::MemoryProfiler(const ProfilerConfig &config, size_t mem_size)
+    : m_config(config),
+      m_report(config.report_file),
+      m_csv(config.report_file + ".csv"),
+      m_window_reads((mem_size + memory::Memory::page_size - 1) / memory::Memory::page_size),
+      m_window_writes(m_window_reads.size()),
+      m_reads(m_window_reads.size()),
+      m_writes(m_window_reads.size()),
+      m_strides(kStrideTableSize),
+      m_fenwick(kFenwickSize) {
+    if (!m_report || !m_csv) {
+        throw std::runtime_error{
+            fmt::format("Can't open memory profile {} and {}.csv", config.report_file,
+                        config.report_file)};
+    }
+    if (m_config.window == 0 || m_config.window > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error{fmt::format("Memory profile window must be in [1, {}]",
+                                             std::numeric_limits<uint32_t>::max())};
+    }
+    if (m_config.sample_period == 0) {
+        throw std::runtime_error{"Memory profile sample period must be positive"};
+    }
+
+    m_sample_threshold = std::numeric_limits<uint64_t>::max() / m_config.sample_period;
+    m_csv << "window,page,reads,writes\n";
+}
+
+MemoryProfiler::~MemoryProfiler() { finish(); }
+
+// m_fenwick is 1-based, index 0 is unused
+void MemoryProfiler::fenwick_add(uint64_t time, int32_t delta) noexcept {
+    for (; time < m_fenwick.size(); time += time & -time) {
+        m_fenwick[time] += delta;
+    }
+}
+
+uint64_t MemoryProfiler::fenwick_sum(uint64_t time) const noexcept {
+    int64_t sum = 0;
+    for (; time != 0; time &= time - 1) {
+        sum += m_fenwick[time];
+    }
+    return sum;
+}
+
+// only the order of the last uses matters, so they are renumbered 1..n once the times run out;
+// the tree grows so that at least as many times as there are lines are left free
+void MemoryProfiler::compact() {
+    std::vector<std::pair<uint64_t, uint64_t>> uses;  // time, line
+    uses.reserve(m_last_use.size());
+    for (auto [line, time] : m_last_use) {
+        uses.emplace_back(time, line);
+    }
+    std::sort(uses.begin(), uses.end());
+
+    m_fenwick.assign(std::max(m_fenwick.size(), std::bit_ceil(2 * uses.size() + 2)), 0);
+    uint64_t window_start = 0;
+    for (size_t i = 0; i < uses.size(); ++i) {
+        if (uses[i].first <= m_window_start) {
+            window_start = i + 1;
+        }
+        m_last_use[uses[i].second] = i + 1;
+        fenwick_add(i + 1, 1);
+    }
+
+    m_time = uses.size();
+    m_window_start = window_start;
+}
+
+void MemoryProfiler::sample_line(uint64_t line) {
+    if (m_time + 1 >= m_fenwick.size()) {
+        compact();
+    }
+    uint64_t now = ++m_time;
+
+    auto [it, inserted] = m_last_use.try_emplace(line, now);
+    if (inserted) {
+        ++m_cold_accesses;
+        ++m_window_lines;
+    } else {
+        uint64_t last = it->second;
+        // sampled lines used since the last use of this one, scaled up to all lines
+        uint64_t distance = (fenwick_sum(now - 1) - fenwick_sum(last)) * m_config.sample_period;
+        ++m_reuse_histogram[std::min<size_t>(std::bit_width(distance), kHistogramBuckets - 1)];
+
+        fenwick_add(last, -1);
+        if (last <= m_window_start) {
+            ++m_window_lines;
+        }
+        it->second = now;
+    }
+    fenwick_add(now, 1);
+}
+
+void MemoryProfiler::evict_stride(const StrideEntry &entry) {
+    if (entry.accesses == 0) {
+        return;
+    }
+    auto [it, inserted] = m_evicted_strides.try_emplace(entry.pc, entry);
+    if (!inserted) {
+        auto &evicted = it->second;
+        evicted.accesses += entry.accesses;
+        evicted.strided += entry.strided;
+        evicted.stride = entry.stride;
+    }
+}
+
+void MemoryProfiler::end_window() {
+    uint64_t window = m_working_sets.size();
+    std::sort(m_touched.begin(), m_touched.end());
+    for (uint32_t page : m_touched) {
+        m_csv << window << ',' << page * memory::Memory::page_size << ','
+              << m_window_reads[page] << ',' << m_window_writes[page] << '\n';
+
+        m_reads[page] += m_window_reads[page];
+        m_writes[page] += m_window_writes[page];
+        m_window_reads[page] = 0;
+        m_window_writes[page] = 0;
+    }
+
+    m_working_sets.push_back(
+        {m_touched.size(), m_window_lines * m_config.sample_period * kLineSize});
+
+    m_touched.clear();
+    m_window_len = 0;
+    m_window_start = m_time;
+    m_window_lines = 0;
+}
+
+void MemoryProfiler::write_report() {
+    auto &out = m_report;
+
+    uint64_t reads = 0, writes = 0;
+    std::vector<uint32_t> pages;
+    for (size_t page = 0; page < m_reads.size(); ++page) {
+        reads += m_reads[page];
+        writes += m_writes[page];
+        if (m_reads[page] + m_writes[page] != 0) {
+            pages.push_back(page);
+        }
+    }
+    out << fmt::format("accesses: {} reads: {} writes: {} pages touched: {}\n", reads + writes,
+                       reads, writes, pages.size());
+
+    constexpr size_t kHotPages = 16;
+    std::stable_sort(pages.begin(), pages.end(), [&](uint32_t lhs, uint32_t rhs) {
+        return m_reads[lhs] + m_writes[lhs] > m_reads[rhs] + m_writes[rhs];
+    });
+    out << "\nhot pages:\n";
+    for (size_t i = 0; i < std::min(kHotPages, pages.size()); ++i) {
+        out << fmt::format("    {:#010x} reads: {} writes: {}\n",
+                           pages[i] * memory::Memory::page_size, m_reads[pages[i]],
+                           m_writes[pages[i]]);
+    }
+
+    constexpr size_t kStridePcs = 16;
+    std::vector<StrideEntry> strides;
+    for (const auto &[pc, entry] : m_evicted_strides) {
+        strides.push_back(entry);
+    }
+    std::sort(strides.begin(), strides.end(),
+              [](const auto &lhs, const auto &rhs) { return lhs.accesses > rhs.accesses; });
+    out << "\nstrides of the busiest load/store pcs:\n";
+    for (size_t i = 0; i < std::min(kStridePcs, strides.size()); ++i) {
+        const auto &entry = strides[i];
+        out << fmt::format("    {:#x} accesses: {} last stride: {} strided: {:.1f}%\n", entry.pc,
+                           entry.accesses, entry.stride, 100.0 * entry.strided / entry.accesses);
+    }
+
+    out << fmt::format("\nworking set per window of {} accesses:\n", m_config.window);
+    for (size_t window = 0; window < m_working_sets.size(); ++window) {
+        out << fmt::format("    {} pages: {} bytes: ~{}\n", window, m_working_sets[window].pages,
+                           m_working_sets[window].bytes);
+    }
+
+    out << fmt::format(
+        "\nreuse distance in {} byte lines, 1 in {} lines sampled:\n    cold: {}\n", kLineSize,
+        m_config.sample_period, m_cold_accesses);
+    for (size_t bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+        if (m_reuse_histogram[bucket] != 0) {
+            uint64_t low = bucket == 0 ? 0 : uint64_t(1) << (bucket - 1);
+            out << fmt::format("    [{}, {}): {}\n", low, uint64_t(1) << bucket,
+                               m_reuse_histogram[bucket]);
+        }
+    }
+}
+
+void MemoryProfiler::finish() {
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    if (m_window_len != 0) {
+        end_window();
+    }
+    for (const auto &entry : m_strides) {
+        evict_stride(entry);
+    }
+    m_csv.flush();
+    write_report();
+    m_report.flush();
+
+    Logger::getInstance().message(Logger::severity_level::standard, "MemoryProfiler",
+                                  fmt::format("memory profile written to {} and {}.csv",
+                                              m_config.report_file, m_config.report_file));
+}
+
+}  // namespace memprof
@@ -0,0 +1,192 @@
+#include "mmio.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "logger.hpp"
+
+namespace mmio {
+
+Uart16550::Uart16550(int fd, size_t capacity)
+    : m_fd(fd), m_line_buffered(isatty(fd)), m_capacity(std::max<size_t>(capacity, 1)) {
+    m_buffer.reserve(m_capacity);
+}
+
+Uart16550::~Uart16550() {
+    flush();
+    Logger::getInstance().message(
+        Logger::severity_level::standard, "Uart",
+        fmt::format("{} bytes sent in {} host writes", m_bytes, m_writes));
+}
+
+bool Uart16550::read(uint64_t offset, unsigned size, uint64_t &value) {
+    if (size != 1 || offset > scr) {
+        return false;
+    }
+    bool dlab = m_lcr & kLcrDlab;
+    switch (offset) {
+        case rbr_thr:
+            value = dlab ? m_dll : 0;  // receiver always empty
+            break;
+        case ier:
+            value = dlab ? m_dlm : m_ier;
+            break;
+        case iir_fcr:
+            value = kIirNone | ((m_fcr & 1) ? 0xc0 : 0);
+            break;
+        case lcr:
+            value = m_lcr;
+            break;
+        case mcr:
+            value = m_mcr;
+            break;
+        case lsr:
+            value = kLsrIdle;
+            break;
+        case msr:
+            value = 0;
+            break;
+        case scr:
+            value = m_scr;
+            break;
+    }
+    return true;
+}
+
+bool Uart16550::write(uint64_t offset, unsigned size, uint64_t value) {
+    if (size != 1 || offset > scr) {
+        return false;
+    }
+    bool dlab = m_lcr & kLcrDlab;
+    uint8_t byte = value;
+    switch (offset) {
+        case rbr_thr:
+            if (dlab) {
+                m_dll = byte;
+                break;
+            }
+            m_buffer.push_back(static_cast<char>(byte));
+            ++m_bytes;
+            if (m_buffer.size() >= m_capacity || (m_line_buffered && byte == '\n')) {
+                flush();
+            }
+            break;
+        case ier:
+            (dlab ? m_dlm : m_ier) = byte;
+            break;
+        case iir_fcr:
+            m_fcr = byte;
+            break;
+        case lcr:
+            m_lcr = byte;
+            break;
+        case mcr:
+            m_mcr = byte;
+            break;
+        case scr:
+            m_scr = byte;
+            break;
+        default:  // lsr and msr are read only
+            break;
+    }
+    return true;
+}
+
+void Uart16550::flush() {
+    size_t done = 0;
+    while (done < m_buffer.size()) {
+        ssize_t written = ::write(m_fd, m_buffer.data() + done, m_buffer.size() - done);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::getInstance().message(
+                Logger::severity_level::standard, "Uart",
+                fmt::format("dropping {} bytes, write failed with errno: {}",
+                            m_buffer.size() - done, std::strerror(errno)));
+            break;
+        }
+        done += written;
+        ++m_writes;
+    }
+    m_buffer.clear();
+}
+
+DeviceState Uart16550::save_state() const {
+    return {m_ier, m_fcr, m_lcr, m_mcr, m_scr, m_dll, m_dlm};
+}
+
+void Uart16550::restore_state(const DeviceState &state) {
+    if (state.size() != 7) {
+        throw std::runtime_error{"UART state doesn't match with the UART"};
+    }
+    m_ier = state[0];
+    m_fcr = state[1];
+    m_lcr = state[2];
+    m_mcr = state[3];
+    m_scr = state[4];
+    m_dll = state[5];
+    m_dlm = state[6];
+}
+
+// registers are 64 bit wide, 4 byte accesses reach either half
+bool Clint::access_64(uint64_t offset, unsigned size, uint64_t reg, unsigned &shift) {
+    if (size == 8 && offset == reg) {
+        shift = 0;
+        return true;
+    }
+    if (size == 4 && (offset == reg || offset == reg + 4)) {
+        shift = (offset - reg) * 8;
+        return true;
+    }
+    return false;
+}
+
+bool Clint::read(uint64_t offset, unsigned size, uint64_t &value) {
+    unsigned shift;
+    if (offset == kMsip && size == 4) {
+        value = m_msip;
+    } else if (access_64(offset, size, kMtimecmp, shift)) {
+        value = m_mtimecmp >> shift;
+    } else if (access_64(offset, size, kMtime, shift)) {
+        value = mtime() >> shift;
+    } else {
+        return false;
+    }
+    if (size == 4) {
+        value = static_cast<uint32_t>(value);
+    }
+    return true;
+}
+
+void Clint::restore_state(const DeviceState &state) {
+    if (state.size() != 3) {
+        throw std::runtime_error{"CLINT state doesn't match with the CLINT"};
+    }
+    m_mtime_offset = state[0];
+    m_mtimecmp = state[1];
+    m_msip = state[2];
+}
+
+bool Clint::write(uint64_t offset, unsigned size, uint64_t value) {
+    unsigned shift;
+    uint64_t mask = size == 8 ? ~uint64_t(0) : uint64_t(0xffffffff);
+    if (offset == kMsip && size == 4) {
+        m_msip = value & 1;
+    } else if (access_64(offset, size, kMtimecmp, shift)) {
+        m_mtimecmp = (m_mtimecmp & ~(mask << shift)) | ((value & mask) << shift);
+    } else if (access_64(offset, size, kMtime, shift)) {
+        uint64_t now = mtime();
+        uint64_t updated = (now & ~(mask << shift)) | ((value & mask) << shift);
+        m_mtime_offset += updated - now;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}  // namespace mmio
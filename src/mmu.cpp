@@ -0,0 +1,91 @@
+#include "mmu.hpp"
+
+namespace mmu {
+
+namespace {
+
+constexpr unsigned kLevels = 3;
+constexpr unsigned kVpnBits = 9;
+constexpr unsigned kVaBits = kPageShift + kLevels * kVpnBits;
+constexpr unsigned kPteSize = 8;
+constexpr unsigned kPtePpnShift = 10;
+constexpr uint64_t kPtePpnMask = (uint64_t(1) << 44) - 1;
+constexpr unsigned kPteReservedShift = 54;  // Svpbmt and Svnapot bits, not implemented
+
+}  // namespace
+
+WalkResult walk(const memory::Memory &mem, uint64_t satp, uint64_t addr, uint64_t &page,
+                uint16_t &flags) {
+    // the bits above the 39 bit address copy its top bit
+    auto canonical = static_cast<uint64_t>(static_cast<int64_t>(addr << (64 - kVaBits)) >>
+                                           (64 - kVaBits));
+    if (canonical != addr) {
+        return WalkResult::page_fault;
+    }
+
+    uint64_t table = (satp & csr::kSatpPpnMask) << kPageShift;
+    for (unsigned level = kLevels; level-- > 0;) {
+        uint64_t index = (addr >> (kPageShift + level * kVpnBits)) & ((1 << kVpnBits) - 1);
+        uint64_t pte;
+        if (!mem.load<uint64_t>(table + index * kPteSize, pte)) {
+            return WalkResult::access_fault;
+        }
+        if (!(pte & kPteV) || (!(pte & kPteR) && (pte & kPteW)) ||
+            (pte >> kPteReservedShift) != 0) {
+            return WalkResult::page_fault;
+        }
+
+        uint64_t ppn = (pte >> kPtePpnShift) & kPtePpnMask;
+        if (!(pte & (kPteR | kPteX))) {
+            table = ppn << kPageShift;
+            continue;
+        }
+
+        // a superpage's low ppn fields have to be zero, they come from the address instead
+        uint64_t low = (uint64_t(1) << (level * kVpnBits)) - 1;
+        if (ppn & low) {
+            return WalkResult::page_fault;
+        }
+        page = (ppn | ((addr >> kPageShift) & low)) << kPageShift;
+        flags = pte & 0xff;
+        return WalkResult::ok;
+    }
+    return WalkResult::page_fault;
+}
+
+Permission permission(Access access, csr::Privilege privilege, bool sum, bool mxr) {
+    Permission permission;
+    switch (access) {
+        case Access::fetch:
+            permission.need = kPteX | kPteA;
+            break;
+        case Access::load:
+            permission.need = (mxr ? kReadableOrExecutable : kPteR) | kPteA;
+            break;
+        case Access::store:
+            permission.need = kPteW | kPteA | kPteD;
+            break;
+    }
+
+    // S-mode never runs user code and only reaches user data under SUM
+    if (privilege == csr::Privilege::user) {
+        permission.need |= kPteU;
+    } else if (access == Access::fetch || !sum) {
+        permission.forbid |= kPteU;
+    }
+    return permission;
+}
+
+void Tlb::flush(std::optional<uint64_t> vpn, std::optional<uint16_t> asid) noexcept {
+    for (Entry &entry : m_entries) {
+        if (vpn && entry.vpn != *vpn) {
+            continue;
+        }
+        if (asid && (entry.asid != *asid || (entry.flags & kPteG))) {
+            continue;
+        }
+        entry = {};
+    }
+}
+
+}  // namespace mmu
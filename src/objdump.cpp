@@ -0,0 +1,251 @@
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CLI/CLI.hpp"
+#include "decoder.hpp"
+#include "disasm.hpp"
+#include "elfio/elfio.hpp"
+#include "instruction.hpp"
+
+namespace {
+
+constexpr size_t kInstrNum = instruction::InstrName.size();
+constexpr size_t kMinChunkSize = 0x1000;
+
+struct Line {
+    hart::addr_t addr;
+    instruction::instr_t raw;
+    instruction::InstrId id;
+    std::string text;
+};
+
+struct Segment {
+    hart::addr_t addr;
+    std::vector<Line> lines;
+};
+
+disasm::SymbolTable read_symbols(ELFIO::elfio &reader) {
+    disasm::SymbolTable symbols;
+
+    for (ELFIO::Elf_Half i = 0; i < reader.sections.size(); ++i) {
+        ELFIO::section *section = reader.sections[i];
+        if (section->get_type() != ELFIO::SHT_SYMTAB) {
+            continue;
+        }
+
+        ELFIO::symbol_section_accessor accessor{reader, section};
+        for (ELFIO::Elf_Xword j = 0; j < accessor.get_symbols_num(); ++j) {
+            std::string name;
+            ELFIO::Elf64_Addr value;
+            ELFIO::Elf_Xword size;
+            unsigned char bind, type, other;
+            ELFIO::Elf_Half section_index;
+            accessor.get_symbol(j, name, value, size, bind, type, section_index, other);
+
+            if (!name.empty() && (type == ELFIO::STT_FUNC || type == ELFIO::STT_NOTYPE)) {
+                symbols.emplace(value, name);
+            }
+        }
+    }
+
+    return symbols;
+}
+
+// every chunk is decoded by its own thread into its own slice of lines
+Segment disassemble(hart::addr_t addr, const char *data, size_t size, size_t threads,
+                    const disasm::SymbolTable &symbols) {
+    size_t count = size / sizeof(instruction::instr_t);
+    Segment segment{addr, std::vector<Line>(count)};
+
+    size_t chunk = std::max(kMinChunkSize / sizeof(instruction::instr_t),
+                            (count + threads - 1) / std::max<size_t>(threads, 1));
+
+    auto decode_chunk = [&](size_t begin, size_t end) {
+        instruction::EncInstr enc_instr;
+        for (size_t i = begin; i < end; ++i) {
+            Line &line = segment.lines[i];
+            line.addr = addr + i * sizeof(instruction::instr_t);
+            std::memcpy(&line.raw, data + i * sizeof(instruction::instr_t), sizeof(line.raw));
+
+            decoder::Decoder::decode_instruction(line.raw, enc_instr);
+            line.id = enc_instr.id;
+            line.text = disasm::format_instruction(enc_instr, line.addr, symbols);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t begin = 0; begin < count; begin += chunk) {
+        workers.emplace_back(decode_chunk, begin, std::min(count, begin + chunk));
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    return segment;
+}
+
+std::string json_escape(std::string_view text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+void print_text(const std::vector<Segment> &segments, const disasm::SymbolTable &symbols,
+                const std::array<uint64_t, kInstrNum> &histogram, bool stats_only) {
+    if (!stats_only) {
+        for (const auto &segment : segments) {
+            for (const auto &line : segment.lines) {
+                if (auto it = symbols.find(line.addr); it != symbols.end()) {
+                    fmt::print("\n{:016x} <{}>:\n", line.addr, it->second);
+                }
+                fmt::print("{:8x}: {:08x}  {}\n", line.addr, line.raw, line.text);
+            }
+        }
+        fmt::print("\n");
+    }
+
+    std::vector<instruction::InstrId> ids;
+    for (size_t id = 0; id < kInstrNum; ++id) {
+        if (histogram[id] != 0 && id != instruction::InstrId::ILLEGAL) {
+            ids.push_back(static_cast<instruction::InstrId>(id));
+        }
+    }
+    std::stable_sort(ids.begin(), ids.end(),
+                     [&](auto lhs, auto rhs) { return histogram[lhs] > histogram[rhs]; });
+
+    fmt::print("histogram:\n");
+    for (auto id : ids) {
+        fmt::print("    {:<8} {}\n", disasm::mnemonic(id), histogram[id]);
+    }
+
+    fmt::print("unsupported encodings: {}\n", histogram[instruction::InstrId::ILLEGAL]);
+    for (const auto &segment : segments) {
+        for (const auto &line : segment.lines) {
+            if (line.id == instruction::InstrId::ILLEGAL) {
+                fmt::print("    {}: {:08x}\n", disasm::format_target(line.addr, symbols),
+                           line.raw);
+            }
+        }
+    }
+}
+
+void print_json(const std::string &elf_file, hart::addr_t entry,
+                const std::vector<Segment> &segments, const disasm::SymbolTable &symbols,
+                const std::array<uint64_t, kInstrNum> &histogram, bool stats_only) {
+    fmt::print("{{\"file\": \"{}\", \"entry\": {}, \"segments\": [", json_escape(elf_file), entry);
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const auto &segment = segments[s];
+        fmt::print("{}{{\"addr\": {}, \"size\": {}", s ? ", " : "", segment.addr,
+                   segment.lines.size() * sizeof(instruction::instr_t));
+        if (!stats_only) {
+            fmt::print(", \"instructions\": [");
+            for (size_t i = 0; i < segment.lines.size(); ++i) {
+                const auto &line = segment.lines[i];
+                fmt::print("{}{{\"addr\": {}, \"raw\": {}, \"mnemonic\": \"{}\", \"asm\": \"{}\"",
+                           i ? ", " : "", line.addr, line.raw,
+                           line.id == instruction::InstrId::ILLEGAL ? "" : disasm::mnemonic(line.id),
+                           json_escape(line.text));
+                if (auto it = symbols.find(line.addr); it != symbols.end()) {
+                    fmt::print(", \"symbol\": \"{}\"", json_escape(it->second));
+                }
+                fmt::print("}}");
+            }
+            fmt::print("]");
+        }
+        fmt::print("}}");
+    }
+
+    fmt::print("], \"histogram\": {{");
+    bool first = true;
+    for (size_t id = 0; id < kInstrNum; ++id) {
+        if (histogram[id] != 0 && id != instruction::InstrId::ILLEGAL) {
+            fmt::print("{}\"{}\": {}", first ? "" : ", ",
+                       disasm::mnemonic(static_cast<instruction::InstrId>(id)), histogram[id]);
+            first = false;
+        }
+    }
+
+    fmt::print("}}, \"unsupported\": [");
+    first = true;
+    for (const auto &segment : segments) {
+        for (const auto &line : segment.lines) {
+            if (line.id == instruction::InstrId::ILLEGAL) {
+                fmt::print("{}{{\"addr\": {}, \"raw\": {}}}", first ? "" : ", ", line.addr,
+                           line.raw);
+                first = false;
+            }
+        }
+    }
+    fmt::print("]}}\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    CLI::App app{"RISV RV64_I disassembler"};
+    std::string elf_file;
+    app.add_option("-f,--file", elf_file, "Required RISC-V elf file")
+        ->required()
+        ->check(CLI::ExistingFile);
+
+    bool json = false;
+    app.add_flag("--json", json, "Prints JSON instead of assembly");
+
+    bool stats_only = false;
+    app.add_flag("--stats", stats_only,
+                 "Prints only the instruction histogram and unsupported encodings");
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    app.add_option("-j,--threads", threads, "Threads decoding a segment in parallel chunks")
+        ->default_val(threads)
+        ->check(CLI::PositiveNumber);
+
+    CLI11_PARSE(app, argc, argv);
+
+    ELFIO::elfio reader;
+    if (!reader.load(elf_file)) {
+        fmt::print(stderr, "Can't load elf file {}\n", elf_file);
+        return 1;
+    }
+    if (reader.get_class() != ELFIO::ELFCLASS64) {
+        fmt::print(stderr, "Elf file class doesn't match with ELFCLASS64\n");
+        return 1;
+    }
+
+    auto symbols = read_symbols(reader);
+
+    std::vector<Segment> segments;
+    std::array<uint64_t, kInstrNum> histogram{};
+    for (ELFIO::Elf_Half i = 0; i < reader.segments.size(); ++i) {
+        ELFIO::segment *segment = reader.segments[i];
+        if (segment->get_type() != ELFIO::PT_LOAD || !(segment->get_flags() & ELFIO::PF_X)) {
+            continue;
+        }
+
+        segments.push_back(disassemble(segment->get_virtual_address(), segment->get_data(),
+                                       segment->get_file_size(), threads, symbols));
+        for (const auto &line : segments.back().lines) {
+            ++histogram[line.id];
+        }
+    }
+
+    if (json) {
+        print_json(elf_file, reader.get_entry(), segments, symbols, histogram, stats_only);
+    } else {
+        print_text(segments, symbols, histogram, stats_only);
+    }
+
+    // a binary using encodings the simulator doesn't support is reported like a failed check
+    return histogram[instruction::InstrId::ILLEGAL] != 0;
+}
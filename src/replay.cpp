@@ -0,0 +1,284 @@
+#include "replay.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "executor.hpp"
+#include "logger.hpp"
+
+namespace replay {
+
+constexpr uint32_t kMagic = 0x52525652;  // "RVRR"
+constexpr uint32_t kVersion = 7;
+
+namespace {
+
+template <typename T>
+void write(std::ofstream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+T read(std::ifstream &in) {
+    T value;
+    in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    return value;
+}
+
+// a count of elements that follow, checked against the rest of the file before anything is
+// allocated for them
+uint64_t read_count(std::ifstream &in, uint64_t file_size, size_t element_size) {
+    auto count = read<uint64_t>(in);
+    auto position = static_cast<uint64_t>(in.tellg());
+    if (!in || position > file_size || count > (file_size - position) / element_size) {
+        throw std::runtime_error{"Recording is truncated"};
+    }
+    return count;
+}
+
+// the current contents of the pages marked in written
+std::vector<hart::PageCopy> copy_pages(const hart::Hart &hart, const std::vector<bool> &written) {
+    std::vector<hart::PageCopy> pages;
+    for (size_t page = 0; page < written.size(); ++page) {
+        if (!written[page]) {
+            continue;
+        }
+        hart::addr_t addr = page * memory::Memory::page_size;
+        auto &copy = pages.emplace_back(hart::PageCopy{
+            addr, std::vector<uint8_t>(
+                      std::min(memory::Memory::page_size, hart.memory_size() - addr))});
+        hart.read_memory(addr, copy.bytes.data(), copy.bytes.size());
+    }
+    return pages;
+}
+
+}  // namespace
+
+Session::Session(uint64_t keyframe_interval) : m_keyframe_interval(keyframe_interval) {
+    if (m_keyframe_interval == 0) {
+        throw std::runtime_error{"Replay keyframe interval must be positive"};
+    }
+}
+
+uint64_t Session::record(hart::Hart &hart) {
+    m_keyframes.clear();
+    m_inputs.clear();
+    m_position = 0;
+    m_input_index = 0;
+    m_replaying = false;
+
+    hart.set_session(this);
+    m_keyframes.push_back({m_position, m_inputs.size(), hart.snapshot(), {}});
+    hart.track_dirty_pages();
+    // every page written since the first keyframe, what a checkpoint holds
+    std::vector<bool> written((hart.memory_size() + memory::Memory::page_size - 1) /
+                              memory::Memory::page_size);
+    executor::RunResult result = executor::Executor::run(hart, m_keyframe_interval);
+    m_position += result.instructions;
+    while (result.reason == executor::StopReason::budget) {
+        auto pages = hart.take_dirty_pages();
+        for (const auto &page : pages) {
+            written[page.addr / memory::Memory::page_size] = true;
+        }
+        if (m_keyframes.size() % kCheckpointInterval == 0) {
+            pages = copy_pages(hart, written);
+        }
+        m_keyframes.push_back(
+            {m_position, m_inputs.size(), hart.snapshot(false), std::move(pages)});
+        result = executor::Executor::run(hart, m_keyframe_interval);
+        m_position += result.instructions;
+    }
+    hart.set_session(nullptr);
+
+    m_length = m_position;
+
+    Logger &myLogger = Logger::getInstance();
+    myLogger.message(Logger::severity_level::standard, "Replay",
+                     fmt::format("recorded {} instructions, {} keyframes, {} inputs", m_length,
+                                 m_keyframes.size(), m_inputs.size()));
+    return m_length;
+}
+
+uint64_t Session::input(uint64_t host_value) {
+    if (!m_replaying) {
+        m_inputs.push_back(host_value);
+        return host_value;
+    }
+
+    if (m_input_index >= m_inputs.size()) {
+        throw std::runtime_error{
+            fmt::format("Replay diverged: no recorded input left at instruction {}", m_position)};
+    }
+    return m_inputs[m_input_index++];
+}
+
+const Session::Keyframe &Session::keyframe_before(uint64_t index) const {
+    auto keyframe = std::upper_bound(
+        m_keyframes.begin(), m_keyframes.end(), index,
+        [](uint64_t value, const Keyframe &keyframe) { return value < keyframe.index; });
+    return *(keyframe - 1);
+}
+
+// the first keyframe's memory with the checkpoint in front of keyframe and the keyframes
+// from there on applied; the hart tracks the pages written since, so the next restore only
+// copies those back from the first keyframe
+void Session::restore(hart::Hart &hart, const Keyframe &keyframe) {
+    if (!m_replaying) {
+        hart.restore(m_keyframes.front().snapshot);
+        hart.track_dirty_pages();
+    } else {
+        hart.restore_dirty(m_keyframes.front().snapshot);
+    }
+
+    size_t last = &keyframe - m_keyframes.data();
+    for (size_t i = last - last % kCheckpointInterval; i <= last; ++i) {
+        hart.write_pages(m_keyframes[i].pages);
+    }
+    hart.restore_state(keyframe.snapshot);
+}
+
+void Session::seek(hart::Hart &hart, uint64_t index) {
+    if (m_keyframes.empty()) {
+        throw std::runtime_error{"Replay session has no recording"};
+    }
+    index = std::min(index, m_length);
+
+    const auto &keyframe = keyframe_before(index);
+
+    // executing forward from the current position is cheaper if no keyframe lies in between
+    if (!m_replaying || index < m_position || keyframe.index > m_position) {
+        restore(hart, keyframe);
+        m_position = keyframe.index;
+        m_input_index = keyframe.input_index;
+        m_replaying = true;
+    }
+
+    hart.set_session(this);
+    m_position += executor::Executor::run(hart, index - m_position).instructions;
+    hart.set_session(nullptr);
+}
+
+bool Session::reverse_step(hart::Hart &hart) {
+    if (!m_replaying || m_position == 0) {
+        return false;
+    }
+    seek(hart, m_position - 1);
+    return true;
+}
+
+void Session::save(const std::string &recording_file) const {
+    std::ofstream out(recording_file, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error{fmt::format("Can't open recording file {}", recording_file)};
+    }
+
+    write(out, kMagic);
+    write(out, kVersion);
+    write(out, m_keyframe_interval);
+    write(out, m_length);
+
+    write(out, static_cast<uint64_t>(m_inputs.size()));
+    out.write(reinterpret_cast<const char *>(m_inputs.data()),
+              m_inputs.size() * sizeof(m_inputs[0]));
+
+    write(out, static_cast<uint64_t>(m_keyframes.size()));
+    for (const auto &keyframe : m_keyframes) {
+        write(out, keyframe.index);
+        write(out, keyframe.input_index);
+        write(out, keyframe.snapshot.pc);
+        write(out, keyframe.snapshot.pc_next);
+        write(out, keyframe.snapshot.regfile);
+        write(out, keyframe.snapshot.csrs);
+        write(out, keyframe.snapshot.reservation);
+        write(out, static_cast<uint64_t>(keyframe.snapshot.devices.size()));
+        for (const auto &device : keyframe.snapshot.devices) {
+            write(out, static_cast<uint64_t>(device.size()));
+            out.write(reinterpret_cast<const char *>(device.data()),
+                      device.size() * sizeof(device[0]));
+        }
+        write(out, static_cast<uint64_t>(keyframe.snapshot.memory.size()));
+        out.write(reinterpret_cast<const char *>(keyframe.snapshot.memory.data()),
+                  keyframe.snapshot.memory.size());
+        write(out, static_cast<uint64_t>(keyframe.pages.size()));
+        for (const auto &page : keyframe.pages) {
+            write(out, page.addr);
+            write(out, static_cast<uint64_t>(page.bytes.size()));
+            out.write(reinterpret_cast<const char *>(page.bytes.data()), page.bytes.size());
+        }
+    }
+}
+
+Session Session::load(const std::string &recording_file) {
+    std::ifstream in(recording_file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error{fmt::format("Can't open recording file {}", recording_file)};
+    }
+
+    in.seekg(0, std::ios::end);
+    auto file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    if (read<uint32_t>(in) != kMagic || read<uint32_t>(in) != kVersion) {
+        throw std::runtime_error{fmt::format("{} is not a recording", recording_file)};
+    }
+
+    Session session{read<uint64_t>(in)};
+    session.m_length = read<uint64_t>(in);
+
+    try {
+        session.m_inputs.resize(read_count(in, file_size, sizeof(session.m_inputs[0])));
+        in.read(reinterpret_cast<char *>(session.m_inputs.data()),
+                session.m_inputs.size() * sizeof(session.m_inputs[0]));
+
+        // every keyframe holds at least its fixed fields and three counts
+        constexpr size_t kMinKeyframeSize = 2 * sizeof(uint64_t) + 2 * sizeof(hart::addr_t) +
+                                            sizeof(hart::Snapshot::regfile) + sizeof(csr::State) +
+                                            sizeof(hart::Reservation) + 3 * sizeof(uint64_t);
+        auto keyframes = read_count(in, file_size, kMinKeyframeSize);
+        for (uint64_t i = 0; i < keyframes && in; ++i) {
+            Keyframe keyframe{};
+            keyframe.index = read<uint64_t>(in);
+            keyframe.input_index = read<uint64_t>(in);
+            keyframe.snapshot.pc = read<hart::addr_t>(in);
+            keyframe.snapshot.pc_next = read<hart::addr_t>(in);
+            keyframe.snapshot.regfile = read<decltype(keyframe.snapshot.regfile)>(in);
+            keyframe.snapshot.csrs = read<csr::State>(in);
+            keyframe.snapshot.reservation = read<hart::Reservation>(in);
+            keyframe.snapshot.devices.resize(read_count(in, file_size, sizeof(uint64_t)));
+            for (auto &device : keyframe.snapshot.devices) {
+                device.resize(read_count(in, file_size, sizeof(device[0])));
+                in.read(reinterpret_cast<char *>(device.data()), device.size() * sizeof(device[0]));
+            }
+            keyframe.snapshot.memory.resize(read_count(in, file_size, 1));
+            in.read(reinterpret_cast<char *>(keyframe.snapshot.memory.data()),
+                    keyframe.snapshot.memory.size());
+
+            keyframe.pages.resize(read_count(in, file_size, 2 * sizeof(uint64_t)));
+            for (auto &page : keyframe.pages) {
+                page.addr = read<hart::addr_t>(in);
+                page.bytes.resize(read_count(in, file_size, 1));
+                in.read(reinterpret_cast<char *>(page.bytes.data()), page.bytes.size());
+            }
+            session.m_keyframes.push_back(std::move(keyframe));
+        }
+    } catch (const std::runtime_error &) {
+        in.setstate(std::ios::failbit);
+    }
+
+    // seek restores the other keyframes on top of the first one's memory
+    if (in && !session.m_keyframes.empty() &&
+        session.m_keyframes.front().snapshot.memory.empty()) {
+        throw std::runtime_error{
+            fmt::format("Recording {} has no memory in its first keyframe", recording_file)};
+    }
+
+    if (!in) {
+        throw std::runtime_error{fmt::format("Recording {} is truncated", recording_file)};
+    }
+    return session;
+}
+
+}  // namespace replay
@@ -0,0 +1,94 @@
+#include "scheduler.hpp"
+
+#include <stdexcept>
+
+namespace sched {
+
+Scheduler::Scheduler(size_t threads, uint64_t quantum, bool numa_local)
+    : m_quantum(quantum), m_numa_local(numa_local) {
+    if (threads == 0 || quantum == 0) {
+        throw std::runtime_error{"Scheduler needs at least one thread and a positive quantum"};
+    }
+
+    m_workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.emplace_back(&Scheduler::worker_loop, this);
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+    m_task_ready.notify_all();
+
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+uint64_t Scheduler::submit(std::unique_ptr<hart::Hart> hart, done_callback_t on_done) {
+    uint64_t id;
+    {
+        std::lock_guard lock{m_mutex};
+        id = m_next_id++;
+        ++m_pending;
+        m_queue.push_back({id, std::move(hart), std::move(on_done)});
+    }
+    m_task_ready.notify_one();
+    return id;
+}
+
+void Scheduler::wait() {
+    std::unique_lock lock{m_mutex};
+    m_all_done.wait(lock, [this] { return m_pending == 0; });
+}
+
+void Scheduler::worker_loop() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock lock{m_mutex};
+            m_task_ready.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;  // stopping
+            }
+            task = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        if (m_numa_local && !task.placed) {
+            task.hart->bind_memory_numa(memory::kLocalNode);
+            task.placed = true;
+        }
+
+        auto result = executor::Executor::run(*task.hart, m_quantum);
+        task.instructions += result.instructions;
+
+        if (result.reason == executor::StopReason::budget) {
+            {
+                std::lock_guard lock{m_mutex};
+                m_queue.push_back(std::move(task));
+            }
+            m_task_ready.notify_one();
+            continue;
+        }
+
+        if (task.on_done) {
+            task.on_done(task.id, *task.hart, {result.reason, task.instructions});
+        }
+        task.hart.reset();
+
+        bool all_done;
+        {
+            std::lock_guard lock{m_mutex};
+            all_done = --m_pending == 0;
+        }
+        if (all_done) {
+            m_all_done.notify_all();
+        }
+    }
+}
+
+}  // namespace sched
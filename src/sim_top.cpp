@@ -0,0 +1,132 @@
+#include <fmt/format.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CLI/CLI.hpp"
+#include "stats_page.hpp"
+
+namespace {
+
+std::string_view state(const stats::Header &header) {
+    if (header.finished.load(std::memory_order_relaxed)) {
+        return "finished";
+    }
+    // killed simulators leave their page behind
+    if (kill(static_cast<pid_t>(header.pid), 0) != 0 && errno == ESRCH) {
+        return "gone";
+    }
+    return "running";
+}
+
+std::string_view hart_status(const stats::HartSlot &slot) {
+    switch (static_cast<stats::HartStatus>(slot.status.load(std::memory_order_relaxed))) {
+        case stats::HartStatus::running: return "running";
+        case stats::HartStatus::exited: return "exited";
+        case stats::HartStatus::trapped: return "trapped";
+    }
+    return "?";
+}
+
+// every page in /dev/shm that reads as one
+std::vector<std::string> find_pages() {
+    std::vector<std::string> names;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator{stats::kShmDir, error}) {
+        if (!entry.is_regular_file(error)) {
+            continue;
+        }
+        try {
+            stats::Reader reader{entry.path()};
+            names.push_back(entry.path().filename());
+        } catch (const std::exception &) {
+        }
+    }
+    std::ranges::sort(names);
+    return names;
+}
+
+void print_page(const std::string &name, bool all_harts) {
+    std::string path = fmt::format("{}/{}", stats::kShmDir, name);
+    try {
+        stats::Reader reader{path};
+        const auto &header = reader.header();
+
+        uint64_t traps = 0;
+        for (size_t hart = 0; hart < header.hart_count; ++hart) {
+            traps += reader.slot(hart).traps.load(std::memory_order_relaxed);
+        }
+        // zero until the publisher's first refresh
+        uint64_t update_ns = header.update_ns.load(std::memory_order_relaxed);
+        uint64_t age_ns = std::max(update_ns, header.start_ns) - header.start_ns;
+
+        fmt::print("{:<16} {:>8} {:<9} {:>5} {:>14} {:>9.1f} {:>18} {:>7} {:>9} {:>8.1f}s  {}\n",
+                   name, header.pid, state(header), header.hart_count,
+                   header.retired.load(std::memory_order_relaxed),
+                   header.milli_mips.load(std::memory_order_relaxed) / 1000.0,
+                   fmt::format("{:#x}", reader.slot(0).pc.load(std::memory_order_relaxed)), traps,
+                   header.log_drops.load(std::memory_order_relaxed), age_ns / 1e9,
+                   header.program);
+
+        if (!all_harts) {
+            return;
+        }
+        for (size_t hart = 0; hart < header.hart_count; ++hart) {
+            const auto &slot = reader.slot(hart);
+            fmt::print("  hart {:<10} {:>8} {:<9} {:>5} {:>14} {:>9} {:>18} {:>7}\n", hart, "",
+                       hart_status(slot), "", slot.retired.load(std::memory_order_relaxed), "",
+                       fmt::format("{:#x}", slot.pc.load(std::memory_order_relaxed)),
+                       slot.traps.load(std::memory_order_relaxed));
+        }
+    } catch (const std::exception &error) {
+        fmt::print("{:<16} {}\n", name, error.what());
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    CLI::App app{"RISV RV64_I simulator monitor"};
+    std::vector<std::string> names;
+    app.add_option("names", names,
+                   "--stats_page names to show, every page in /dev/shm if none is given");
+
+    unsigned interval = 1000;
+    app.add_option("-i,--interval", interval, "Milliseconds between refreshes")
+        ->default_val(interval)
+        ->check(CLI::PositiveNumber);
+
+    bool once = false;
+    app.add_flag("--once", once, "Prints the table once instead of refreshing it");
+
+    bool all_harts = false;
+    app.add_flag("-a,--all_harts", all_harts, "Adds a line for every hart of a simulation");
+
+    CLI11_PARSE(app, argc, argv);
+
+    while (true) {
+        if (!once) {
+            // home and clear the terminal
+            fmt::print("\x1b[H\x1b[2J");
+        }
+        fmt::print("{:<16} {:>8} {:<9} {:>5} {:>14} {:>9} {:>18} {:>7} {:>9} {:>9}  {}\n", "NAME",
+                   "PID", "STATE", "HARTS", "RETIRED", "MIPS", "PC", "TRAPS", "LOG DROPS",
+                   "TIME", "PROGRAM");
+        for (const auto &name : names.empty() ? find_pages() : names) {
+            print_page(name, all_harts);
+        }
+        std::fflush(stdout);
+
+        if (once) {
+            return 0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{interval});
+    }
+}
@@ -0,0 +1,134 @@
+#include "stats_page.hpp"
+
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "logger.hpp"
+
+namespace stats {
+
+uint64_t now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+}
+
+Publisher::Publisher(const std::string &name, size_t hart_count, std::string_view program,
+                     std::chrono::milliseconds interval)
+    : m_path(fmt::format("{}/{}", kShmDir, name)), m_interval(interval) {
+    if (name.empty() || name.find('/') != std::string::npos) {
+        throw std::runtime_error{fmt::format("Invalid stats page name: '{}'", name)};
+    }
+
+    // a monitor may still map the old page, truncating it under the monitor would fault there
+    unlink(m_path.c_str());
+    int fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        throw std::runtime_error{fmt::format("Can't create stats page {} with errno: {}", m_path,
+                                             std::strerror(errno))};
+    }
+    m_size = sizeof(Header) + hart_count * sizeof(HartSlot);
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, m_size) == 0) {
+        mapping = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int map_errno = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error{fmt::format("Can't map stats page {} with errno: {}", m_path,
+                                             std::strerror(map_errno))};
+    }
+
+    // the file is zero filled, so every counter starts at 0 and every hart as running
+    m_header = static_cast<Header *>(mapping);
+    m_header->version = kVersion;
+    m_header->slot_size = sizeof(HartSlot);
+    m_header->hart_count = hart_count;
+    m_header->pid = getpid();
+    m_header->start_ns = now_ns();
+    program.copy(m_header->program, std::min(program.size(), sizeof(m_header->program) - 1));
+    std::atomic_ref<uint64_t>{m_header->magic}.store(kMagic, std::memory_order_release);
+
+    m_last_ns = m_header->start_ns;
+    m_thread = std::thread{&Publisher::publish_loop, this};
+}
+
+Publisher::~Publisher() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+
+    refresh();
+    m_header->finished.store(1, std::memory_order_relaxed);
+    munmap(m_header, m_size);
+}
+
+void Publisher::refresh() {
+    uint64_t retired = 0;
+    for (size_t hart = 0; hart < m_header->hart_count; ++hart) {
+        retired += slot(hart).retired.load(std::memory_order_relaxed);
+    }
+    uint64_t now = now_ns();
+
+    // instructions per microsecond, in thousandths
+    if (now > m_last_ns) {
+        m_header->milli_mips.store((retired - m_last_retired) * 1'000'000 / (now - m_last_ns),
+                                   std::memory_order_relaxed);
+    }
+    m_header->retired.store(retired, std::memory_order_relaxed);
+    m_header->log_drops.store(Logger::getInstance().dropped_messages(),
+                              std::memory_order_relaxed);
+    m_header->update_ns.store(now, std::memory_order_relaxed);
+    m_last_ns = now;
+    m_last_retired = retired;
+}
+
+void Publisher::publish_loop() {
+    std::unique_lock lock{m_mutex};
+    while (!m_wake.wait_for(lock, m_interval, [this] { return m_stop; })) {
+        refresh();
+    }
+}
+
+Reader::Reader(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{
+            fmt::format("Can't open stats page {} with errno: {}", path, std::strerror(errno))};
+    }
+    struct stat file_stat;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && static_cast<size_t>(file_stat.st_size) >= sizeof(Header)) {
+        m_size = file_stat.st_size;
+        mapping = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error{fmt::format("{} is no stats page", path)};
+    }
+
+    m_header = static_cast<const Header *>(mapping);
+    uint64_t magic =
+        std::atomic_ref<const uint64_t>{m_header->magic}.load(std::memory_order_acquire);
+    if (magic != kMagic || m_header->version != kVersion ||
+        m_header->slot_size != sizeof(HartSlot) ||
+        m_size < sizeof(Header) + m_header->hart_count * sizeof(HartSlot)) {
+        munmap(const_cast<Header *>(m_header), m_size);
+        throw std::runtime_error{fmt::format("{} is no stats page of version {}", path, kVersion)};
+    }
+}
+
+Reader::~Reader() { munmap(const_cast<Header *>(m_header), m_size); }
+
+}  // namespace stats
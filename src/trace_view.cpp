@@ -0,0 +1,57 @@
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <string>
+
+#include "CLI/CLI.hpp"
+#include "delta_trace.hpp"
+#include "hart.hpp"
+
+int main(int argc, char **argv) {
+    CLI::App app{"RISV RV64_I delta trace viewer"};
+    std::string trace_file;
+    app.add_option("-f,--file", trace_file, "Required delta trace file")
+        ->required()
+        ->check(CLI::ExistingFile);
+
+    uint64_t index = 0;
+    app.add_option("-i,--index", index, "Instruction to rebuild the register state for")
+        ->default_val(index);
+
+    uint64_t count = 1;
+    app.add_option("-n,--count", count,
+                   "Number of instructions to show, the following ones are printed as changes")
+        ->default_val(count);
+
+    CLI11_PARSE(app, argc, argv);
+
+    trace::DeltaTraceReader reader{trace_file};
+    fmt::print("{} instructions, keyframe every {}\n", reader.instructions(),
+               reader.keyframe_interval());
+
+    if (index >= reader.instructions()) {
+        return 0;
+    }
+
+    auto state = reader.state_at(index);
+
+    fmt::print("registers before instruction {}:\n", index);
+    for (size_t i = 0; i < state.regs.size(); ++i) {
+        fmt::print("    {:>4}: {:#018x}\n", hart::g_reg_names[i], state.regs[i]);
+    }
+
+    // every shown instruction is followed by the changes it made
+    uint64_t end = std::min(reader.instructions(), index + count);
+    for (uint64_t i = index; i < end; ++i) {
+        trace::InstrChanges changes;
+        state = reader.state_at(i, &changes);
+
+        fmt::print("[{}] pc: {:#x}\n", i, state.pc);
+        for (const auto &write : changes.regs) {
+            fmt::print("    {:>4} <- {:#x}\n", hart::g_reg_names[write.reg_id], write.value);
+        }
+        for (const auto &write : changes.mem) {
+            fmt::print("    mem[{:#x}]:{} <- {:#x}\n", write.addr, write.size, write.value);
+        }
+    }
+}